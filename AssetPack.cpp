@@ -0,0 +1,320 @@
+#include "AssetPack.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+
+		const char PACK_MAGIC[8] = { 'G', 'P', 'S', 'P', 'A', 'C', 'K', '\0' };
+		const uint32_t PACK_VERSION = 1;
+
+		// On-disk layout: header, entry table, blob table, path strings, then the blobs,
+		// each 16-byte aligned. Several entries may share one blob.
+		struct PackHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t entryCount;
+			uint32_t blobCount;
+			uint32_t padding;
+		};
+
+		struct EntryRecord {
+			uint64_t pathOffset;
+			uint32_t pathLength;
+			uint32_t blob;
+		};
+
+		struct BlobRecord {
+			uint64_t offset;
+			uint64_t size;
+			uint64_t hash;
+		};
+
+		uint64_t AlignOffset(uint64_t offset) {
+
+			return (offset + 15) & ~(uint64_t)15;
+		}
+
+		void WritePadding(std::ofstream& out, uint64_t from, uint64_t to) {
+
+			static const char zeros[16] = {};
+			out.write(zeros, (std::streamsize)(to - from));
+		}
+
+		// Files listed by name before the rest are only counted
+		const size_t MAX_LISTED_NEWER_FILES = 5;
+	}
+
+	AssetPack& AssetPack::Get() {
+
+		static AssetPack pack;
+		return pack;
+	}
+
+	bool AssetPack::Open(const std::string& packFile) {
+
+		entries.clear();
+
+		if (!file.Open(packFile)) {
+			return false;
+		}
+
+		if (!Parse()) {
+			std::cerr << "WARNING: ignoring corrupt asset pack " << packFile << std::endl;
+			entries.clear();
+			file.Close();
+			return false;
+		}
+
+		WarnAboutNewerFiles(packFile);
+
+		// One sequential read of the whole pack instead of a seek per asset
+		file.Prefetch();
+		return true;
+	}
+
+	void AssetPack::WarnAboutNewerFiles(const std::string& packFile) const {
+
+		std::error_code ec;
+		auto packTime = std::filesystem::last_write_time(packFile, ec);
+		if (ec) {
+			return;
+		}
+
+		// The loaders keep reading the packed copy, so an edit to the loose file would silently not show
+		std::vector<std::string> newer;
+		for (const auto& entry : entries) {
+			auto time = std::filesystem::last_write_time(entry.first, ec);
+			if (!ec && time > packTime) {
+				newer.push_back(entry.first);
+			}
+		}
+		if (newer.empty()) {
+			return;
+		}
+
+		std::sort(newer.begin(), newer.end());
+		std::cerr << "WARNING: " << newer.size() << " files changed after " << packFile << " was built, rebuild it to use them:" << std::endl;
+		for (size_t i = 0; i < newer.size() && i < MAX_LISTED_NEWER_FILES; i++) {
+			std::cerr << "  " << newer[i] << std::endl;
+		}
+		if (newer.size() > MAX_LISTED_NEWER_FILES) {
+			std::cerr << "  and " << newer.size() - MAX_LISTED_NEWER_FILES << " more" << std::endl;
+		}
+	}
+
+	bool AssetPack::Find(const std::string& fileName, AssetView* asset) const {
+
+		if (entries.empty()) {
+			return false;
+		}
+
+		auto found = entries.find(NormalizePath(fileName));
+		if (found == entries.end()) {
+			return false;
+		}
+		*asset = found->second;
+		return true;
+	}
+
+	std::string AssetPack::NormalizePath(const std::string& fileName) {
+
+		return std::filesystem::path(fileName).lexically_normal().generic_string();
+	}
+
+	bool AssetPack::Parse() {
+
+		const unsigned char* base = file.GetData();
+		uint64_t fileSize = file.GetSize();
+
+		if (fileSize < sizeof(PackHeader)) {
+			return false;
+		}
+
+		PackHeader header;
+		std::memcpy(&header, base, sizeof(header));
+
+		if (std::memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) != 0 || header.version != PACK_VERSION) {
+			return false;
+		}
+
+		uint64_t blobTable = sizeof(PackHeader) + (uint64_t)header.entryCount * sizeof(EntryRecord);
+		if (blobTable + (uint64_t)header.blobCount * sizeof(BlobRecord) > fileSize) {
+			return false;
+		}
+
+		std::vector<BlobRecord> blobs(header.blobCount);
+		std::memcpy(blobs.data(), base + blobTable, blobs.size() * sizeof(BlobRecord));
+		for (const BlobRecord& blob : blobs) {
+			if (blob.offset > fileSize || blob.size > fileSize - blob.offset) {
+				return false;
+			}
+		}
+
+		entries.reserve(header.entryCount);
+		for (uint32_t e = 0; e < header.entryCount; e++) {
+
+			EntryRecord entry;
+			std::memcpy(&entry, base + sizeof(PackHeader) + e * sizeof(EntryRecord), sizeof(entry));
+			if (entry.blob >= header.blobCount || entry.pathOffset > fileSize || entry.pathLength > fileSize - entry.pathOffset) {
+				return false;
+			}
+
+			const BlobRecord& blob = blobs[entry.blob];
+			std::string path(reinterpret_cast<const char*>(base + entry.pathOffset), entry.pathLength);
+			entries[path] = { base + blob.offset, (size_t)blob.size, blob.hash };
+		}
+
+		return true;
+	}
+
+	bool AssetPack::Build(const std::string& packFile, const std::vector<std::string>& directories) {
+
+		std::vector<std::string> paths;
+		for (const std::string& directory : directories) {
+
+			std::error_code ec;
+			for (auto it = std::filesystem::recursive_directory_iterator(directory, ec);
+				 !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+
+				if (!it->is_regular_file()) {
+					continue;
+				}
+				std::string extension = it->path().extension().string();
+				if (extension == ".meshcache" || extension == ".tmp" || extension == ".pack") {
+					continue;
+				}
+				paths.push_back(NormalizePath(it->path().string()));
+			}
+			if (ec) {
+				std::cerr << "ERROR: cannot read directory " << directory << ": " << ec.message() << std::endl;
+				return false;
+			}
+		}
+
+		// Sorted so assets of one model sit next to each other in the pack
+		std::sort(paths.begin(), paths.end());
+		paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+
+		std::vector<MappedFile> contents;
+		std::vector<BlobRecord> blobs;
+		std::vector<uint32_t> entryBlobs;
+		// Content hash -> blobs with that hash, compared byte by byte before sharing
+		std::unordered_map<uint64_t, std::vector<uint32_t>> blobsByHash;
+		size_t totalBytes = 0;
+
+		for (const std::string& path : paths) {
+
+			MappedFile content;
+			// Empty files have nothing to map and are packed as empty blobs; any other file that cannot be
+			// read would be packed empty as well, so it fails the build instead
+			if (!content.Open(path)) {
+				std::error_code ec;
+				if (std::filesystem::file_size(path, ec) != 0 || ec) {
+					std::cerr << "ERROR: cannot read " << path << std::endl;
+					return false;
+				}
+			}
+
+			BlobRecord blob = { 0, content.GetSize(), HashBytes(content.GetData(), content.GetSize()) };
+			totalBytes += content.GetSize();
+
+			uint32_t shared = UINT32_MAX;
+			for (uint32_t candidate : blobsByHash[blob.hash]) {
+				if (blobs[candidate].size == blob.size &&
+					(blob.size == 0 || std::memcmp(contents[candidate].GetData(), content.GetData(), blob.size) == 0)) {
+					shared = candidate;
+					break;
+				}
+			}
+
+			if (shared == UINT32_MAX) {
+				shared = (uint32_t)blobs.size();
+				blobsByHash[blob.hash].push_back(shared);
+				blobs.push_back(blob);
+				contents.push_back(std::move(content));
+			}
+			entryBlobs.push_back(shared);
+		}
+
+		// Lay out the path strings and blobs
+		PackHeader header = {};
+		std::memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+		header.version = PACK_VERSION;
+		header.entryCount = (uint32_t)paths.size();
+		header.blobCount = (uint32_t)blobs.size();
+
+		uint64_t offset = sizeof(PackHeader) + paths.size() * sizeof(EntryRecord) + blobs.size() * sizeof(BlobRecord);
+
+		std::vector<EntryRecord> entryRecords(paths.size());
+		for (size_t e = 0; e < paths.size(); e++) {
+			entryRecords[e] = { offset, (uint32_t)paths[e].size(), entryBlobs[e] };
+			offset += paths[e].size();
+		}
+		uint64_t stringsEnd = offset;
+
+		size_t packedBytes = 0;
+		for (BlobRecord& blob : blobs) {
+			offset = AlignOffset(offset);
+			blob.offset = offset;
+			offset += blob.size;
+			packedBytes += blob.size;
+		}
+
+		// Write to a temporary file first so a crash never leaves a half-written pack behind
+		std::string tempPath = packFile + ".tmp";
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			std::cerr << "ERROR: cannot write " << tempPath << std::endl;
+			return false;
+		}
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(entryRecords.data()), (std::streamsize)(entryRecords.size() * sizeof(EntryRecord)));
+		out.write(reinterpret_cast<const char*>(blobs.data()), (std::streamsize)(blobs.size() * sizeof(BlobRecord)));
+		for (const std::string& path : paths) {
+			out.write(path.data(), (std::streamsize)path.size());
+		}
+
+		offset = stringsEnd;
+		for (size_t b = 0; b < blobs.size(); b++) {
+			WritePadding(out, offset, blobs[b].offset);
+			out.write(reinterpret_cast<const char*>(contents[b].GetData()), (std::streamsize)blobs[b].size);
+			offset = blobs[b].offset + blobs[b].size;
+		}
+
+		out.close();
+		if (!out) {
+			std::filesystem::remove(tempPath);
+			return false;
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tempPath, packFile, ec);
+		if (ec) {
+			return false;
+		}
+
+		std::cout << "Packed " << paths.size() << " files into " << blobs.size() << " unique blobs, "
+				  << packedBytes / (1024.0 * 1024.0) << " MB (" << (totalBytes - packedBytes) / (1024.0 * 1024.0)
+				  << " MB deduplicated)" << std::endl;
+		return true;
+	}
+
+	AssetStream::Buffer::Buffer(const AssetView& asset) {
+
+		char* begin = const_cast<char*>(reinterpret_cast<const char*>(asset.data));
+		setg(begin, begin, begin + asset.size);
+	}
+
+	AssetStream::AssetStream(const AssetView& asset)
+		: std::istream(nullptr), buffer(asset) {
+
+		rdbuf(&buffer);
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef AssetPack_hpp
+#define AssetPack_hpp
+
+#include "MappedFile.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <streambuf>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+	// One file stored in the pack, pointing straight into the mapping
+	struct AssetView {
+		const unsigned char* data;
+		size_t size;
+		// HashBytes of the contents
+		uint64_t hash;
+	};
+
+	// Single memory-mapped file holding every asset under its relative path. Identical files are
+	// stored once (content-addressed by hash), and the whole pack is read ahead sequentially on open.
+	class AssetPack {
+
+	public:
+		// The pack the loaders read from; paths missing from it (or no pack at all) fall back to the filesystem
+		static AssetPack& Get();
+
+		// Maps the pack and builds its path index, returns false if it is missing or corrupt. Warns about loose
+		// files modified after the pack was built, which the pack still shadows.
+		bool Open(const std::string& packFile);
+
+		bool IsOpen() const { return file.IsOpen(); }
+
+		// Looks up a file by path, relative to the working directory like the loaders use them
+		bool Find(const std::string& fileName, AssetView* asset) const;
+
+		// Packs every regular file below the given directories (mesh caches and packs excluded)
+		static bool Build(const std::string& packFile, const std::vector<std::string>& directories);
+
+		// Normalized path used as the index key, so "a/./b/../c.png" and "a/c.png" match
+		static std::string NormalizePath(const std::string& fileName);
+
+	private:
+		MappedFile file;
+		std::unordered_map<std::string, AssetView> entries;
+
+		bool Parse();
+
+		void WarnAboutNewerFiles(const std::string& packFile) const;
+	};
+
+	// std::istream over an asset's bytes for parsers that read streams, without copying
+	class AssetStream : public std::istream {
+
+	public:
+		explicit AssetStream(const AssetView& asset);
+
+	private:
+		struct Buffer : public std::streambuf {
+			Buffer(const AssetView& asset);
+		};
+
+		Buffer buffer;
+	};
+}
+
+#endif /* AssetPack_hpp */
@@ -0,0 +1,18 @@
+#include "AssetPack.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Builds the asset pack the demo reads its models and textures from, e.g.
+//   asset_packer assets.pack models skybox
+int main(int argc, const char * argv[]) {
+
+	if (argc < 3) {
+		std::cerr << "Usage: " << argv[0] << " <output.pack> <directory>..." << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> directories(argv + 2, argv + argc);
+	return gps::AssetPack::Build(argv[1], directories) ? 0 : 1;
+}
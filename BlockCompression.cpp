@@ -0,0 +1,541 @@
+#include "BlockCompression.hpp"
+#include "AssetPack.hpp"
+#include "MipGenerator.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+
+		// DDS layout: "DDS " followed by a 124-byte header, the 20-byte DX10 header when the fourCC is "DX10",
+		// then the levels largest first
+		const char DDS_MAGIC[4] = { 'D', 'D', 'S', ' ' };
+
+		const uint32_t DDSD_CAPS = 0x1;
+		const uint32_t DDSD_HEIGHT = 0x2;
+		const uint32_t DDSD_WIDTH = 0x4;
+		const uint32_t DDSD_PIXELFORMAT = 0x1000;
+		const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+		const uint32_t DDSD_LINEARSIZE = 0x80000;
+		const uint32_t DDPF_FOURCC = 0x4;
+		const uint32_t DDSCAPS_COMPLEX = 0x8;
+		const uint32_t DDSCAPS_TEXTURE = 0x1000;
+		const uint32_t DDSCAPS_MIPMAP = 0x400000;
+
+		constexpr uint32_t FourCC(char a, char b, char c, char d) {
+
+			return (uint32_t)(unsigned char)a | (uint32_t)(unsigned char)b << 8 |
+				   (uint32_t)(unsigned char)c << 16 | (uint32_t)(unsigned char)d << 24;
+		}
+
+		const uint32_t FOURCC_DXT1 = FourCC('D', 'X', 'T', '1');
+		const uint32_t FOURCC_DXT5 = FourCC('D', 'X', 'T', '5');
+		const uint32_t FOURCC_DX10 = FourCC('D', 'X', '1', '0');
+
+		// Writer tag and BAKE_VERSION go in the last two reserved header words, where other tools put theirs
+		const uint32_t BAKE_TAG = FourCC('G', 'P', 'S', 'T');
+		const int BAKE_TAG_WORD = 9;
+		const int BAKE_VERSION_WORD = 10;
+
+		// The DXGI formats of the DX10 header are the only place a .dds records its colour space
+		const uint32_t DXGI_FORMAT_BC1_UNORM = 71;
+		const uint32_t DXGI_FORMAT_BC1_UNORM_SRGB = 72;
+		const uint32_t DXGI_FORMAT_BC3_UNORM = 77;
+		const uint32_t DXGI_FORMAT_BC3_UNORM_SRGB = 78;
+		const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+		struct DdsPixelFormat {
+			uint32_t size;
+			uint32_t flags;
+			uint32_t fourCC;
+			uint32_t rgbBitCount;
+			uint32_t masks[4];
+		};
+
+		struct DdsHeader {
+			uint32_t size;
+			uint32_t flags;
+			uint32_t height;
+			uint32_t width;
+			uint32_t linearSize;
+			uint32_t depth;
+			uint32_t mipMapCount;
+			uint32_t reserved1[11];
+			DdsPixelFormat pixelFormat;
+			uint32_t caps[4];
+			uint32_t reserved2;
+		};
+
+		struct DdsHeaderDx10 {
+			uint32_t dxgiFormat;
+			uint32_t resourceDimension;
+			uint32_t miscFlag;
+			uint32_t arraySize;
+			uint32_t miscFlags2;
+		};
+
+		static_assert(sizeof(DdsHeader) == 124, "DDS header must match the file format");
+		static_assert(sizeof(DdsHeaderDx10) == 20, "DX10 header must match the file format");
+
+		// Largest texture the loaders accept, keeps corrupt headers from overflowing the size math
+		const uint32_t MAX_DIMENSION = 16384;
+
+		uint16_t Pack565(const float color[3]) {
+
+			int r = std::clamp((int)(color[0] * 31.0f / 255.0f + 0.5f), 0, 31);
+			int g = std::clamp((int)(color[1] * 63.0f / 255.0f + 0.5f), 0, 63);
+			int b = std::clamp((int)(color[2] * 31.0f / 255.0f + 0.5f), 0, 31);
+			return (uint16_t)(r << 11 | g << 5 | b);
+		}
+
+		void Unpack565(uint16_t packed, int color[3]) {
+
+			int r = packed >> 11 & 31;
+			int g = packed >> 5 & 63;
+			int b = packed & 31;
+			color[0] = r << 3 | r >> 2;
+			color[1] = g << 2 | g >> 4;
+			color[2] = b << 3 | b >> 2;
+		}
+
+		int ColorError(const unsigned char* pixel, const int color[3]) {
+
+			int error = 0;
+			for (int k = 0; k < 3; k++) {
+				int d = pixel[k] - color[k];
+				error += d * d;
+			}
+			return error;
+		}
+
+		// Writes a BC1 block for the given endpoints with the nearest palette entry per pixel, returns the
+		// squared error. Endpoints are ordered c0 > c1 for four-colour mode; equal ones only use index 0.
+		int EncodeEndpoints(const unsigned char block[64], uint16_t c0, uint16_t c1, unsigned char out[8]) {
+
+			if (c0 < c1) {
+				std::swap(c0, c1);
+			}
+
+			int palette[4][3];
+			Unpack565(c0, palette[0]);
+			Unpack565(c1, palette[1]);
+			for (int k = 0; k < 3; k++) {
+				palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+				palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+			}
+
+			int paletteSize = c0 == c1 ? 1 : 4;
+			uint32_t indices = 0;
+			int error = 0;
+			for (int i = 0; i < 16; i++) {
+
+				int best = 0;
+				int bestError = INT_MAX;
+				for (int j = 0; j < paletteSize; j++) {
+					int e = ColorError(block + i * 4, palette[j]);
+					if (e < bestError) {
+						best = j;
+						bestError = e;
+					}
+				}
+				indices |= (uint32_t)best << (2 * i);
+				error += bestError;
+			}
+
+			out[0] = (unsigned char)(c0 & 0xFF);
+			out[1] = (unsigned char)(c0 >> 8);
+			out[2] = (unsigned char)(c1 & 0xFF);
+			out[3] = (unsigned char)(c1 >> 8);
+			for (int b = 0; b < 4; b++) {
+				out[4 + b] = (unsigned char)(indices >> (8 * b));
+			}
+			return error;
+		}
+
+		// Endpoints at the extremes of the block's principal axis, then refitted by least squares to the
+		// indices they produced
+		void EncodeColorBlock(const unsigned char block[64], unsigned char out[8]) {
+
+			float mean[3] = {};
+			float low[3] = { 255.0f, 255.0f, 255.0f };
+			float high[3] = {};
+			for (int i = 0; i < 16; i++) {
+				for (int k = 0; k < 3; k++) {
+					mean[k] += block[i * 4 + k] / 16.0f;
+					low[k] = std::min(low[k], (float)block[i * 4 + k]);
+					high[k] = std::max(high[k], (float)block[i * 4 + k]);
+				}
+			}
+
+			// Covariance xx, xy, xz, yy, yz, zz
+			float covariance[6] = {};
+			for (int i = 0; i < 16; i++) {
+				float d[3] = { block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2] };
+				covariance[0] += d[0] * d[0];
+				covariance[1] += d[0] * d[1];
+				covariance[2] += d[0] * d[2];
+				covariance[3] += d[1] * d[1];
+				covariance[4] += d[1] * d[2];
+				covariance[5] += d[2] * d[2];
+			}
+
+			// Power iteration from the bounding box diagonal
+			float axis[3] = { high[0] - low[0], high[1] - low[1], high[2] - low[2] };
+			for (int iteration = 0; iteration < 8; iteration++) {
+
+				float next[3] = {
+					covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+					covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+					covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+				};
+				float length = std::max({ std::fabs(next[0]), std::fabs(next[1]), std::fabs(next[2]) });
+				if (length < 1e-6f) {
+					break;
+				}
+				for (int k = 0; k < 3; k++) {
+					axis[k] = next[k] / length;
+				}
+			}
+
+			int minPixel = 0;
+			int maxPixel = 0;
+			float minProjection = INFINITY;
+			float maxProjection = -INFINITY;
+			for (int i = 0; i < 16; i++) {
+				float projection = 0.0f;
+				for (int k = 0; k < 3; k++) {
+					projection += (block[i * 4 + k] - mean[k]) * axis[k];
+				}
+				if (projection < minProjection) {
+					minProjection = projection;
+					minPixel = i;
+				}
+				if (projection > maxProjection) {
+					maxProjection = projection;
+					maxPixel = i;
+				}
+			}
+
+			float start[3];
+			float end[3];
+			for (int k = 0; k < 3; k++) {
+				start[k] = block[maxPixel * 4 + k];
+				end[k] = block[minPixel * 4 + k];
+			}
+			int bestError = EncodeEndpoints(block, Pack565(start), Pack565(end), out);
+
+			for (int refinement = 0; refinement < 2 && bestError > 0; refinement++) {
+
+				uint16_t c0 = (uint16_t)(out[0] | out[1] << 8);
+				uint16_t c1 = (uint16_t)(out[2] | out[3] << 8);
+				if (c0 == c1) {
+					break;
+				}
+				uint32_t indices = (uint32_t)out[4] | (uint32_t)out[5] << 8 | (uint32_t)out[6] << 16 | (uint32_t)out[7] << 24;
+
+				// Weight of each endpoint in the palette entry an index selects
+				static const float weights[4][2] = { { 1.0f, 0.0f }, { 0.0f, 1.0f }, { 2.0f / 3.0f, 1.0f / 3.0f }, { 1.0f / 3.0f, 2.0f / 3.0f } };
+				float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+				float ax[3] = {};
+				float bx[3] = {};
+				for (int i = 0; i < 16; i++) {
+					const float* w = weights[indices >> (2 * i) & 3];
+					aa += w[0] * w[0];
+					ab += w[0] * w[1];
+					bb += w[1] * w[1];
+					for (int k = 0; k < 3; k++) {
+						ax[k] += w[0] * block[i * 4 + k];
+						bx[k] += w[1] * block[i * 4 + k];
+					}
+				}
+
+				float determinant = aa * bb - ab * ab;
+				if (std::fabs(determinant) < 1e-6f) {
+					break;
+				}
+				for (int k = 0; k < 3; k++) {
+					start[k] = std::clamp((ax[k] * bb - bx[k] * ab) / determinant, 0.0f, 255.0f);
+					end[k] = std::clamp((bx[k] * aa - ax[k] * ab) / determinant, 0.0f, 255.0f);
+				}
+
+				unsigned char candidate[8];
+				int error = EncodeEndpoints(block, Pack565(start), Pack565(end), candidate);
+				if (error >= bestError) {
+					break;
+				}
+				std::memcpy(out, candidate, sizeof(candidate));
+				bestError = error;
+			}
+		}
+
+		// BC3 alpha block in eight-value mode between the block's extremes
+		void EncodeAlphaBlock(const unsigned char block[64], unsigned char out[8]) {
+
+			int low = 255;
+			int high = 0;
+			for (int i = 0; i < 16; i++) {
+				low = std::min(low, (int)block[i * 4 + 3]);
+				high = std::max(high, (int)block[i * 4 + 3]);
+			}
+
+			uint64_t indices = 0;
+			if (high > low) {
+
+				int palette[8] = { high, low };
+				for (int j = 2; j < 8; j++) {
+					palette[j] = ((8 - j) * high + (j - 1) * low) / 7;
+				}
+				for (int i = 0; i < 16; i++) {
+
+					int best = 0;
+					for (int j = 1; j < 8; j++) {
+						if (std::abs(block[i * 4 + 3] - palette[j]) < std::abs(block[i * 4 + 3] - palette[best])) {
+							best = j;
+						}
+					}
+					indices |= (uint64_t)best << (3 * i);
+				}
+			}
+
+			out[0] = (unsigned char)high;
+			out[1] = (unsigned char)low;
+			for (int b = 0; b < 6; b++) {
+				out[2 + b] = (unsigned char)(indices >> (8 * b));
+			}
+		}
+
+		bool WriteDds(const std::string& fileName, BlockFormat format, bool srgb, int width, int height,
+					  const std::vector<std::vector<unsigned char>>& levels) {
+
+			DdsHeader header = {};
+			header.size = sizeof(DdsHeader);
+			header.flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_MIPMAPCOUNT | DDSD_LINEARSIZE;
+			header.height = (uint32_t)height;
+			header.width = (uint32_t)width;
+			header.linearSize = (uint32_t)levels[0].size();
+			header.mipMapCount = (uint32_t)levels.size();
+			header.reserved1[BAKE_TAG_WORD] = BAKE_TAG;
+			header.reserved1[BAKE_VERSION_WORD] = BlockCompression::BAKE_VERSION;
+			header.pixelFormat.size = sizeof(DdsPixelFormat);
+			header.pixelFormat.flags = DDPF_FOURCC;
+			header.pixelFormat.fourCC = FOURCC_DX10;
+			header.caps[0] = DDSCAPS_TEXTURE | (levels.size() > 1 ? DDSCAPS_COMPLEX | DDSCAPS_MIPMAP : 0);
+
+			DdsHeaderDx10 dx10 = {};
+			if (format == BlockFormat::BC3) {
+				dx10.dxgiFormat = srgb ? DXGI_FORMAT_BC3_UNORM_SRGB : DXGI_FORMAT_BC3_UNORM;
+			} else {
+				dx10.dxgiFormat = srgb ? DXGI_FORMAT_BC1_UNORM_SRGB : DXGI_FORMAT_BC1_UNORM;
+			}
+			dx10.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+			dx10.arraySize = 1;
+
+			// Write to a temporary file first so a crash never leaves a half-written texture behind
+			std::string tempPath = fileName + ".tmp";
+			std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+			if (!out) {
+				std::cerr << "ERROR: cannot write " << tempPath << std::endl;
+				return false;
+			}
+
+			out.write(DDS_MAGIC, sizeof(DDS_MAGIC));
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(reinterpret_cast<const char*>(&dx10), sizeof(dx10));
+			for (const std::vector<unsigned char>& level : levels) {
+				out.write(reinterpret_cast<const char*>(level.data()), (std::streamsize)level.size());
+			}
+
+			out.close();
+			if (!out) {
+				std::filesystem::remove(tempPath);
+				return false;
+			}
+
+			std::error_code ec;
+			std::filesystem::rename(tempPath, fileName, ec);
+			return !ec;
+		}
+	}
+
+	size_t BlockCompression::BlockBytes(BlockFormat format) {
+
+		return format == BlockFormat::BC3 ? 16 : 8;
+	}
+
+	size_t BlockCompression::LevelBytes(BlockFormat format, int width, int height) {
+
+		return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * BlockBytes(format);
+	}
+
+	size_t BlockCompression::LevelOffset(const CompressedImage& image, int level) {
+
+		size_t offset = 0;
+		int width = image.width;
+		int height = image.height;
+		for (int l = 0; l < level; l++) {
+			offset += LevelBytes(image.format, width, height);
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		return offset;
+	}
+
+	std::vector<unsigned char> BlockCompression::Compress(BlockFormat format, const unsigned char* pixels, int width, int height) {
+
+		std::vector<unsigned char> blocks(LevelBytes(format, width, height));
+		unsigned char* out = blocks.data();
+
+		for (int blockY = 0; blockY < height; blockY += 4) {
+			for (int blockX = 0; blockX < width; blockX += 4) {
+
+				unsigned char block[64];
+				for (int y = 0; y < 4; y++) {
+					int sourceY = std::min(blockY + y, height - 1);
+					for (int x = 0; x < 4; x++) {
+						int sourceX = std::min(blockX + x, width - 1);
+						std::memcpy(block + (y * 4 + x) * 4, pixels + ((size_t)sourceY * width + sourceX) * 4, 4);
+					}
+				}
+
+				if (format == BlockFormat::BC3) {
+					EncodeAlphaBlock(block, out);
+					out += 8;
+				}
+				EncodeColorBlock(block, out);
+				out += 8;
+			}
+		}
+		return blocks;
+	}
+
+	bool BlockCompression::CompressFile(const std::string& imageFile, bool srgb, size_t* uncompressedBytes, size_t* compressedBytes) {
+
+		// Same row order as the uncompressed loaders upload
+		stbi_set_flip_vertically_on_load_thread(1);
+
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(imageFile.c_str(), &width, &height, &channels, 4);
+		if (!pixels) {
+			std::cerr << "ERROR: could not load " << imageFile << std::endl;
+			return false;
+		}
+
+		std::vector<unsigned char> chain(pixels, pixels + (size_t)width * height * 4);
+		stbi_image_free(pixels);
+
+		bool translucent = false;
+		for (size_t i = 3; i < chain.size() && !translucent; i += 4) {
+			translucent = chain[i] < 255;
+		}
+		BlockFormat format = translucent ? BlockFormat::BC3 : BlockFormat::BC1;
+
+		int levelCount = MipGenerator::Generate(chain, width, height, srgb);
+
+		std::vector<std::vector<unsigned char>> levels;
+		size_t offset = 0;
+		for (int level = 0, levelWidth = width, levelHeight = height; level < levelCount; level++) {
+			levels.push_back(Compress(format, chain.data() + offset, levelWidth, levelHeight));
+			offset += (size_t)levelWidth * levelHeight * 4;
+			levelWidth = std::max(1, levelWidth / 2);
+			levelHeight = std::max(1, levelHeight / 2);
+		}
+
+		if (!WriteDds(CompressedPath(imageFile), format, srgb, width, height, levels)) {
+			return false;
+		}
+
+		*uncompressedBytes = chain.size();
+		*compressedBytes = 0;
+		for (const std::vector<unsigned char>& blocks : levels) {
+			*compressedBytes += blocks.size();
+		}
+		return true;
+	}
+
+	bool BlockCompression::LoadCompressed(const std::string& imageFile, CompressedImage* image) {
+
+		std::string path = CompressedPath(imageFile);
+
+		AssetView asset;
+		bool parsed;
+		if (AssetPack::Get().Find(path, &asset)) {
+			parsed = Parse(asset.data, asset.size, image);
+		} else if (image->file.Open(path)) {
+			parsed = Parse(image->file.GetData(), image->file.GetSize(), image);
+		} else {
+			return false;
+		}
+
+		if (!parsed) {
+			std::cerr << "WARNING: ignoring unsupported or corrupt " << path << std::endl;
+			image->file.Close();
+		}
+		return parsed;
+	}
+
+	bool BlockCompression::Parse(const unsigned char* data, size_t size, CompressedImage* image) {
+
+		if (size < sizeof(DDS_MAGIC) + sizeof(DdsHeader) || std::memcmp(data, DDS_MAGIC, sizeof(DDS_MAGIC)) != 0) {
+			return false;
+		}
+
+		DdsHeader header;
+		std::memcpy(&header, data + sizeof(DDS_MAGIC), sizeof(header));
+		if (header.size != sizeof(DdsHeader) || !(header.pixelFormat.flags & DDPF_FOURCC)) {
+			return false;
+		}
+
+		image->bakeVersion = header.reserved1[BAKE_TAG_WORD] == BAKE_TAG ? header.reserved1[BAKE_VERSION_WORD] : 0;
+
+		// Files without the DX10 header predate linear bakes, and were all filtered as sRGB colour
+		size_t headerSize = sizeof(DDS_MAGIC) + sizeof(DdsHeader);
+		image->srgb = true;
+		if (header.pixelFormat.fourCC == FOURCC_DXT1) {
+			image->format = BlockFormat::BC1;
+		} else if (header.pixelFormat.fourCC == FOURCC_DXT5) {
+			image->format = BlockFormat::BC3;
+		} else if (header.pixelFormat.fourCC == FOURCC_DX10 && size >= headerSize + sizeof(DdsHeaderDx10)) {
+
+			DdsHeaderDx10 dx10;
+			std::memcpy(&dx10, data + headerSize, sizeof(dx10));
+			headerSize += sizeof(dx10);
+			if (dx10.resourceDimension != DDS_DIMENSION_TEXTURE2D || dx10.arraySize > 1) {
+				return false;
+			}
+			switch (dx10.dxgiFormat) {
+			case DXGI_FORMAT_BC1_UNORM: image->format = BlockFormat::BC1; image->srgb = false; break;
+			case DXGI_FORMAT_BC1_UNORM_SRGB: image->format = BlockFormat::BC1; break;
+			case DXGI_FORMAT_BC3_UNORM: image->format = BlockFormat::BC3; image->srgb = false; break;
+			case DXGI_FORMAT_BC3_UNORM_SRGB: image->format = BlockFormat::BC3; break;
+			default: return false;
+			}
+		} else {
+			return false;
+		}
+
+		if (header.width == 0 || header.height == 0 || header.width > MAX_DIMENSION || header.height > MAX_DIMENSION) {
+			return false;
+		}
+		image->width = (int)header.width;
+		image->height = (int)header.height;
+
+		image->levelCount = (header.flags & DDSD_MIPMAPCOUNT) && header.mipMapCount > 0 ? (int)header.mipMapCount : 1;
+		if (image->levelCount > MipGenerator::LevelCount(image->width, image->height)) {
+			return false;
+		}
+
+		image->data = data + headerSize;
+		image->size = LevelOffset(*image, image->levelCount);
+		return image->size <= size - headerSize;
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef BlockCompression_hpp
+#define BlockCompression_hpp
+
+#include "MappedFile.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+	enum class BlockFormat {
+		// 8 bytes per 4x4 block, opaque colour
+		BC1,
+		// 16 bytes per 4x4 block, BC1 colour plus interpolated alpha
+		BC3
+	};
+
+	// Block-compressed image with its whole mipmap chain, as read from a .dds file
+	struct CompressedImage {
+		BlockFormat format = BlockFormat::BC1;
+		int width = 0;
+		int height = 0;
+		int levelCount = 0;
+		// Whether the mipmaps were filtered as sRGB colour rather than as linear data
+		bool srgb = true;
+		// BlockCompression::BAKE_VERSION of the texture_compressor that wrote the file, 0 for other writers
+		uint32_t bakeVersion = 0;
+		// Every level back to back, largest first, rows bottom-up like OpenGL expects
+		const unsigned char* data = nullptr;
+		size_t size = 0;
+		// Owns data when it was read from its own file rather than the asset pack
+		MappedFile file;
+	};
+
+	// BC1/BC3 encoding and the DDS container the compressed textures are shipped in. The
+	// texture_compressor tool writes "<image>.dds" next to each image; the loaders prefer it over the image.
+	class BlockCompression {
+
+	public:
+		// Recorded in every .dds CompressFile writes; bump whenever the encoder or the mipmap filter changes
+		// its output, so texture_compressor rebuilds files written by an older version
+		static const uint32_t BAKE_VERSION = 1;
+
+		static size_t BlockBytes(BlockFormat format);
+
+		// Size of one level, partial edge blocks count as whole ones
+		static size_t LevelBytes(BlockFormat format, int width, int height);
+
+		// Encodes tightly packed RGBA8 pixels, partial edge blocks repeat their last row and column
+		static std::vector<unsigned char> Compress(BlockFormat format, const unsigned char* pixels, int width, int height);
+
+		// Encodes an image file with its full mipmap chain into CompressedPath(imageFile); BC3 when any pixel is
+		// translucent, BC1 otherwise. The mipmaps are filtered as sRGB colour when srgb is set and as linear data
+		// otherwise, and the file records which. Reports the sizes of the uncompressed and compressed chains.
+		static bool CompressFile(const std::string& imageFile, bool srgb, size_t* uncompressedBytes, size_t* compressedBytes);
+
+		// Reads the compressed companion of an image, from the asset pack when it holds it
+		static bool LoadCompressed(const std::string& imageFile, CompressedImage* image);
+
+		static std::string CompressedPath(const std::string& imageFile) { return imageFile + ".dds"; }
+
+		// Offset of a level within CompressedImage::data
+		static size_t LevelOffset(const CompressedImage& image, int level);
+
+	private:
+		static bool Parse(const unsigned char* data, size_t size, CompressedImage* image);
+	};
+}
+
+#endif /* BlockCompression_hpp */
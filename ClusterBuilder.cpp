@@ -0,0 +1,212 @@
+#include "ClusterBuilder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace gps {
+
+	void ClusterBuilder::Build(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+							   GLuint indexOffset, GLsizei indexCount, std::vector<MeshCluster>& clusters) {
+
+		size_t triangleCount = (size_t)indexCount / 3;
+		if (triangleCount == 0) {
+			return;
+		}
+
+		const GLuint* source = &indices[indexOffset];
+		size_t vertexCount = vertices.size();
+
+		// Vertex -> triangle adjacency in compressed rows
+		std::vector<unsigned> offsets(vertexCount + 1, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++) {
+			offsets[source[i] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++) {
+			offsets[v + 1] += offsets[v];
+		}
+
+		std::vector<unsigned> adjacency(triangleCount * 3);
+		std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++) {
+			adjacency[fill[source[i]]++] = (unsigned)(i / 3);
+		}
+
+		std::vector<bool> emitted(triangleCount, false);
+		// A vertex belongs to the cluster being built when its stamp matches
+		std::vector<unsigned> clusterStamp(vertexCount, 0);
+		unsigned stamp = 0;
+
+		std::vector<GLuint> output;
+		output.reserve(triangleCount * 3);
+		std::vector<unsigned> candidates;
+		size_t cursor = 0;
+
+		auto countNewVertices = [&](size_t triangle) {
+			int count = 0;
+			for (int c = 0; c < 3; c++) {
+				if (clusterStamp[source[3 * triangle + c]] != stamp) {
+					count++;
+				}
+			}
+			return count;
+		};
+
+		while (true) {
+
+			while (cursor < triangleCount && emitted[cursor]) {
+				cursor++;
+			}
+			if (cursor == triangleCount) {
+				break;
+			}
+
+			stamp++;
+			size_t clusterStart = output.size();
+			int clusterVertices = 0;
+			int clusterTriangles = 0;
+			glm::vec3 positionSum(0.0f);
+			candidates.clear();
+
+			size_t next = cursor;
+			while (true) {
+
+				emitted[next] = true;
+				clusterTriangles++;
+				for (int c = 0; c < 3; c++) {
+
+					GLuint v = source[3 * next + c];
+					output.push_back(v);
+
+					if (clusterStamp[v] != stamp) {
+						clusterStamp[v] = stamp;
+						clusterVertices++;
+						positionSum += vertices[v].Position;
+
+						for (unsigned k = offsets[v]; k < offsets[v + 1]; k++) {
+							if (!emitted[adjacency[k]]) {
+								candidates.push_back(adjacency[k]);
+							}
+						}
+					}
+				}
+
+				if (clusterTriangles == MAX_CLUSTER_TRIANGLES) {
+					break;
+				}
+
+				// Grow along the surface: fewest new vertices first, then closest to the cluster's center
+				glm::vec3 center = positionSum / (float)clusterVertices;
+				long best = -1;
+				int bestNewVertices = 4;
+				float bestDistance = std::numeric_limits<float>::max();
+				size_t write = 0;
+
+				for (unsigned triangle : candidates) {
+
+					if (emitted[triangle]) {
+						continue;
+					}
+					candidates[write++] = triangle;
+
+					int newVertices = countNewVertices(triangle);
+					if (clusterVertices + newVertices > MAX_CLUSTER_VERTICES) {
+						continue;
+					}
+
+					glm::vec3 centroid = (vertices[source[3 * triangle + 0]].Position +
+										  vertices[source[3 * triangle + 1]].Position +
+										  vertices[source[3 * triangle + 2]].Position) / 3.0f;
+					glm::vec3 offset = centroid - center;
+					float distance = glm::dot(offset, offset);
+
+					if (newVertices < bestNewVertices || (newVertices == bestNewVertices && distance < bestDistance)) {
+						best = (long)triangle;
+						bestNewVertices = newVertices;
+						bestDistance = distance;
+					}
+				}
+				candidates.resize(write);
+
+				// Disconnected pieces (e.g. triangle soups) continue in index order instead
+				if (best < 0) {
+					while (cursor < triangleCount && emitted[cursor]) {
+						cursor++;
+					}
+					if (cursor < triangleCount && clusterVertices + countNewVertices(cursor) <= MAX_CLUSTER_VERTICES) {
+						best = (long)cursor;
+					}
+				}
+
+				if (best < 0) {
+					break;
+				}
+				next = (size_t)best;
+			}
+
+			MeshCluster cluster = ComputeBounds(vertices, &output[clusterStart], (GLsizei)(output.size() - clusterStart));
+			cluster.indexOffset = indexOffset + (GLuint)clusterStart;
+			clusters.push_back(cluster);
+		}
+
+		std::copy(output.begin(), output.end(), indices.begin() + indexOffset);
+	}
+
+	MeshCluster ClusterBuilder::ComputeBounds(const std::vector<Vertex>& vertices, const GLuint* indices, GLsizei indexCount) {
+
+		MeshCluster cluster;
+		cluster.indexOffset = 0;
+		cluster.indexCount = indexCount;
+
+		glm::vec3 boundsMin(std::numeric_limits<float>::max());
+		glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
+		for (GLsizei i = 0; i < indexCount; i++) {
+			boundsMin = glm::min(boundsMin, vertices[indices[i]].Position);
+			boundsMax = glm::max(boundsMax, vertices[indices[i]].Position);
+		}
+
+		cluster.center = (boundsMin + boundsMax) * 0.5f;
+		cluster.radius = 0.0f;
+		for (GLsizei i = 0; i < indexCount; i++) {
+			cluster.radius = std::max(cluster.radius, glm::length(vertices[indices[i]].Position - cluster.center));
+		}
+
+		// Normal cone around the average face direction
+		std::vector<glm::vec3> normals;
+		glm::vec3 normalSum(0.0f);
+		for (GLsizei i = 0; i + 2 < indexCount; i += 3) {
+
+			const glm::vec3& p0 = vertices[indices[i + 0]].Position;
+			const glm::vec3& p1 = vertices[indices[i + 1]].Position;
+			const glm::vec3& p2 = vertices[indices[i + 2]].Position;
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(normal);
+			if (length > 0.0f) {
+				normals.push_back(normal / length);
+				normalSum += normal / length;
+			}
+		}
+
+		cluster.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+		cluster.coneCutoff = 1.0f;
+
+		float axisLength = glm::length(normalSum);
+		if (axisLength > 0.0f) {
+
+			cluster.coneAxis = normalSum / axisLength;
+
+			float minDot = 1.0f;
+			for (const glm::vec3& normal : normals) {
+				minDot = std::min(minDot, glm::dot(normal, cluster.coneAxis));
+			}
+
+			// Cones of 90 degrees or wider always contain a front face
+			if (minDot > 0.0f) {
+				cluster.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+			}
+		}
+
+		return cluster;
+	}
+}
@@ -0,0 +1,28 @@
+#ifndef ClusterBuilder_hpp
+#define ClusterBuilder_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+	// Splits index ranges into small clusters (meshlets) with bounds for CPU culling
+	class ClusterBuilder {
+
+	public:
+		static const int MAX_CLUSTER_VERTICES = 64;
+		static const int MAX_CLUSTER_TRIANGLES = 124;
+
+		// Regroups the triangles of indices[indexOffset, indexOffset + indexCount) so every cluster
+		// is a contiguous run, and appends the clusters to clusters
+		static void Build(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices,
+						  GLuint indexOffset, GLsizei indexCount, std::vector<MeshCluster>& clusters);
+
+	private:
+		// Bounding sphere and normal cone of one finished cluster
+		static MeshCluster ComputeBounds(const std::vector<Vertex>& vertices, const GLuint* indices, GLsizei indexCount);
+	};
+}
+
+#endif /* ClusterBuilder_hpp */
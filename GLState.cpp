@@ -0,0 +1,145 @@
+#include "GLState.hpp"
+
+namespace gps {
+
+	namespace {
+
+		// Slot of a texture target in the binding table, -1 when it is not tracked
+		int TargetIndex(GLenum target) {
+
+			switch (target) {
+				case GL_TEXTURE_2D: return 0;
+				case GL_TEXTURE_2D_ARRAY: return 1;
+				case GL_TEXTURE_CUBE_MAP: return 2;
+				default: return -1;
+			}
+		}
+
+	}
+
+	GLState& GLState::Get() {
+
+		static GLState* state = new GLState();
+		return *state;
+	}
+
+	bool GLState::Change(GLuint& state, GLuint value) {
+
+		if (state == value) {
+			stats.filtered++;
+			return false;
+		}
+		state = value;
+		stats.issued++;
+		return true;
+	}
+
+	void GLState::UseProgram(GLuint program) {
+
+		if (Change(this->program, program)) {
+			glUseProgram(program);
+		}
+	}
+
+	void GLState::BindVertexArray(GLuint vertexArray) {
+
+		if (Change(this->vertexArray, vertexArray)) {
+			glBindVertexArray(vertexArray);
+		}
+	}
+
+	void GLState::BindTexture(GLuint unit, GLenum target, GLuint texture) {
+
+		int targetIndex = TargetIndex(target);
+		if (unit < TRACKED_UNITS && targetIndex >= 0 && textures[unit][targetIndex] == texture) {
+			stats.filtered++;
+			return;
+		}
+
+		if (Change(activeUnit, unit)) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+		}
+		if (unit < TRACKED_UNITS && targetIndex >= 0) {
+			textures[unit][targetIndex] = texture;
+		}
+		glBindTexture(target, texture);
+		stats.issued++;
+	}
+
+	void GLState::SetBlend(bool enabled) {
+
+		if (Change(blend, enabled ? 1 : 0)) {
+			enabled ? glEnable(GL_BLEND) : glDisable(GL_BLEND);
+		}
+	}
+
+	void GLState::SetBlendFunc(GLenum source, GLenum destination) {
+
+		if (blendSource == source && blendDestination == destination) {
+			stats.filtered++;
+			return;
+		}
+		blendSource = source;
+		blendDestination = destination;
+		glBlendFunc(source, destination);
+		stats.issued++;
+	}
+
+	void GLState::SetDepthTest(bool enabled) {
+
+		if (Change(depthTest, enabled ? 1 : 0)) {
+			enabled ? glEnable(GL_DEPTH_TEST) : glDisable(GL_DEPTH_TEST);
+		}
+	}
+
+	void GLState::SetDepthFunc(GLenum func) {
+
+		if (Change(depthFunc, func)) {
+			glDepthFunc(func);
+		}
+	}
+
+	void GLState::SetPolygonMode(GLenum mode) {
+
+		if (Change(polygonMode, mode)) {
+			glPolygonMode(GL_FRONT_AND_BACK, mode);
+		}
+	}
+
+	void GLState::ForgetTexture(GLuint texture) {
+
+		for (GLuint unit = 0; unit < TRACKED_UNITS; unit++) {
+			for (int target = 0; target < TRACKED_TARGETS; target++) {
+				if (textures[unit][target] == texture) {
+					textures[unit][target] = 0;
+				}
+			}
+		}
+	}
+
+	void GLState::ForgetVertexArray(GLuint vertexArray) {
+
+		if (this->vertexArray == vertexArray) {
+			this->vertexArray = 0;
+		}
+	}
+
+	void GLState::Invalidate() {
+
+		program = UNKNOWN;
+		vertexArray = UNKNOWN;
+		activeUnit = UNKNOWN;
+		for (GLuint unit = 0; unit < TRACKED_UNITS; unit++) {
+			for (int target = 0; target < TRACKED_TARGETS; target++) {
+				textures[unit][target] = UNKNOWN;
+			}
+		}
+		blend = UNKNOWN;
+		blendSource = UNKNOWN;
+		blendDestination = UNKNOWN;
+		depthTest = UNKNOWN;
+		depthFunc = UNKNOWN;
+		polygonMode = UNKNOWN;
+	}
+
+}
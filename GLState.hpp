@@ -0,0 +1,89 @@
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+
+namespace gps {
+
+	// State changes requested through GLState, reset by whoever prints them
+	struct StateStats {
+		// Calls that reached GL
+		size_t issued = 0;
+		// Calls dropped because GL already had that state
+		size_t filtered = 0;
+	};
+
+	// Shadow copy of the GL state the renderer switches between draws, so setting what is already
+	// set costs no GL call. Everything starts unknown and is issued the first time. All changes to
+	// this state must go through here; whoever deletes a texture or vertex array has to Forget it,
+	// as GL silently unbinds deleted objects.
+	class GLState {
+
+	public:
+		// Never destroyed, like the models that forget their objects from static destructors
+		static GLState& Get();
+
+		GLState(const GLState&) = delete;
+		GLState& operator=(const GLState&) = delete;
+
+		void UseProgram(GLuint program);
+		void BindVertexArray(GLuint vertexArray);
+
+		// Binds a texture to a target of a texture unit, switching the active unit only when the
+		// binding changes. Supports GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY and GL_TEXTURE_CUBE_MAP.
+		void BindTexture(GLuint unit, GLenum target, GLuint texture);
+
+		void SetBlend(bool enabled);
+		void SetBlendFunc(GLenum source, GLenum destination);
+		void SetDepthTest(bool enabled);
+		void SetDepthFunc(GLenum func);
+		// Applies to front and back faces
+		void SetPolygonMode(GLenum mode);
+
+		// Drops the bindings of a deleted object
+		void ForgetTexture(GLuint texture);
+		void ForgetVertexArray(GLuint vertexArray);
+
+		// Marks everything unknown, for code that changed state behind the cache's back
+		void Invalidate();
+
+		const StateStats& GetStats() const { return stats; }
+		void ResetStats() { stats = StateStats(); }
+
+	private:
+		// Units whose bindings are tracked, binds to higher units always reach GL
+		static const GLuint TRACKED_UNITS = 16;
+		static const int TRACKED_TARGETS = 3;
+
+		// Value of state nothing is known about
+		static const GLuint UNKNOWN = ~0u;
+
+		GLuint program;
+		GLuint vertexArray;
+		GLuint activeUnit;
+		GLuint textures[TRACKED_UNITS][TRACKED_TARGETS];
+		GLuint blend;
+		GLenum blendSource;
+		GLenum blendDestination;
+		GLuint depthTest;
+		GLenum depthFunc;
+		GLenum polygonMode;
+		StateStats stats;
+
+		GLState() { Invalidate(); }
+
+		// Stores value into state and returns true when it differs, counting either way
+		bool Change(GLuint& state, GLuint value);
+	};
+
+}
+
+#endif /* GLState_hpp */
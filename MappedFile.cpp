@@ -0,0 +1,87 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utility>
+
+namespace gps {
+
+	MappedFile::~MappedFile() {
+
+		Close();
+	}
+
+	MappedFile::MappedFile(MappedFile&& other) noexcept
+		: data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)) {
+	}
+
+	MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+
+		if (this != &other) {
+			Close();
+			data = std::exchange(other.data, nullptr);
+			size = std::exchange(other.size, 0);
+		}
+		return *this;
+	}
+
+	bool MappedFile::Open(const std::string& fileName) {
+
+		Close();
+
+		int fd = open(fileName.c_str(), O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+			close(fd);
+			return false;
+		}
+
+		void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		// The mapping keeps its own reference to the file
+		close(fd);
+
+		if (mapping == MAP_FAILED) {
+			return false;
+		}
+
+		data = mapping;
+		size = (size_t)info.st_size;
+		return true;
+	}
+
+	void MappedFile::Close() {
+
+		if (data) {
+			munmap(data, size);
+		}
+		data = nullptr;
+		size = 0;
+	}
+
+	void MappedFile::Prefetch() const {
+
+		if (data) {
+			posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+			posix_madvise(data, size, POSIX_MADV_WILLNEED);
+		}
+	}
+
+	uint64_t HashBytes(const void* bytes, size_t length) {
+
+		const unsigned char* p = static_cast<const unsigned char*>(bytes);
+		uint64_t hash = 14695981039346656037ull;
+
+		for (size_t i = 0; i < length; i++) {
+			hash ^= p[i];
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+}
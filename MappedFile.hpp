@@ -0,0 +1,43 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace gps {
+
+	// Read-only memory mapping of a whole file
+	class MappedFile {
+
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+		MappedFile(MappedFile&& other) noexcept;
+		MappedFile& operator=(MappedFile&& other) noexcept;
+
+		// Maps the file, returns false if it is missing or empty
+		bool Open(const std::string& fileName);
+
+		void Close();
+
+		// Asks the kernel to read the whole file ahead, sequentially
+		void Prefetch() const;
+
+		bool IsOpen() const { return data != nullptr; }
+		const unsigned char* GetData() const { return static_cast<const unsigned char*>(data); }
+		size_t GetSize() const { return size; }
+
+	private:
+		void* data = nullptr;
+		size_t size = 0;
+	};
+
+	// 64-bit FNV-1a hash, used to fingerprint file contents
+	uint64_t HashBytes(const void* bytes, size_t length);
+}
+
+#endif /* MappedFile_hpp */
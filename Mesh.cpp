@@ -1,72 +1,422 @@
 #include "Mesh.hpp"
+#include "GLState.hpp"
+#include "TextureRegistry.hpp"
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
 namespace gps {
 
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures) {
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+			   std::vector<MeshLod> lods, std::vector<MeshCluster> clusters) {
+
+		this->vertices = std::move(vertices);
+		this->indices = std::move(indices);
+		this->textures = std::move(textures);
+		this->lods = std::move(lods);
+		this->clusters = std::move(clusters);
+
+		// The CPU copy stays 32-bit for the processing passes, only the upload narrows
+		this->vertexCount = (GLsizei)this->vertices.size();
+		this->indexCount = (GLsizei)this->indices.size();
+		this->indexType = GL_UNSIGNED_INT;
+		this->computeBounds(this->vertices.data());
+	}
+
+	Mesh::Mesh(const Vertex* vertexData, GLsizei vertexCount, const void* indexData, GLenum indexType, GLsizei indexCount,
+			   std::vector<Texture> textures, std::vector<MeshLod> lods, std::vector<MeshCluster> clusters) {
+
+		this->textures = std::move(textures);
+		this->lods = std::move(lods);
+		this->clusters = std::move(clusters);
+
+		this->vertexData = vertexData;
+		this->indexData = indexData;
+		this->vertexCount = vertexCount;
+		this->indexCount = indexCount;
+		this->indexType = indexType;
+		this->computeBounds(vertexData);
+	}
+
+	GLenum Mesh::ChooseIndexType(size_t vertexCount) {
+
+		return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	}
+
+	// Binds the sampled arrays to their texture units
+	void Mesh::BindTextures(gps::Shader& shader) const {
+
+		GLState& state = GLState::Get();
+
+		// Every sampler is bound, black where the mesh has no image, so nothing is read from the previous
+		// draw's textures; the layers come with the vertices
+		for (GLuint unit = 0; unit < SAMPLED_TEXTURE_COUNT; unit++) {
+
+			shader.setInt(SAMPLED_TEXTURES[unit], (GLint)unit);
+			state.BindTexture(unit, GL_TEXTURE_2D_ARRAY, this->sampledArrays[unit]);
+		}
+	}
+
+	// Appends one level, or its visible clusters when a view is given, to the ranges of a draw
+	bool Mesh::CollectRanges(size_t level, const ClusterView* view, DrawStats& stats, DrawRanges& ranges) const {
+
+		const MeshLod& lod = this->lods[level];
+		size_t indexSize = IndexSize(this->bufferIndexType);
+
+		if (view == nullptr || lod.clusterCount == 0) {
+			stats.triangles += lod.indexCount / 3;
+			ranges.counts.push_back(lod.indexCount);
+			ranges.offsets.push_back((const GLvoid*)((this->firstIndex + lod.indexOffset) * indexSize));
+			ranges.baseVertices.push_back(this->baseVertex);
+			return true;
+		}
+
+		size_t firstRange = ranges.counts.size();
+		GLuint rangeEnd = 0;
+
+		for (GLuint c = lod.clusterOffset; c < lod.clusterOffset + lod.clusterCount; c++) {
+
+			const MeshCluster& cluster = this->clusters[c];
+			stats.clusters++;
+
+			bool visible = true;
+			for (int p = 0; p < 6 && visible; p++) {
+				visible = glm::dot(glm::vec3(view->planes[p]), cluster.center) + view->planes[p].w >= -cluster.radius;
+			}
+
+			// Back-face culling is on, so a cluster whose normal cone points away from the eye draws nothing
+			if (visible && cluster.coneCutoff < 1.0f) {
+				if (view->orthographic) {
+					visible = glm::dot(view->viewPoint, cluster.coneAxis) < cluster.coneCutoff;
+				} else {
+					glm::vec3 toCenter = cluster.center - view->viewPoint;
+					visible = glm::dot(toCenter, cluster.coneAxis) <
+						cluster.coneCutoff * glm::length(toCenter) + cluster.radius * (1.0f + cluster.coneCutoff);
+				}
+			}
 
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+			if (!visible) {
+				stats.culledClusters++;
+				continue;
+			}
 
-		this->setupMesh();
+			stats.triangles += cluster.indexCount / 3;
+
+			// Neighbouring visible clusters merge into one range
+			if (ranges.counts.size() > firstRange && rangeEnd == cluster.indexOffset) {
+				ranges.counts.back() += cluster.indexCount;
+			} else {
+				ranges.counts.push_back(cluster.indexCount);
+				ranges.offsets.push_back((const GLvoid*)((this->firstIndex + cluster.indexOffset) * indexSize));
+				ranges.baseVertices.push_back(this->baseVertex);
+			}
+			rangeEnd = cluster.indexOffset + cluster.indexCount;
+		}
+
+		return ranges.counts.size() > firstRange;
 	}
 
-	Buffers Mesh::getBuffers() {
-	    return this->buffers;
+	// Bounds of the mesh alone, used for level of detail selection and position quantization
+	void Mesh::computeBounds(const Vertex* vertexData) {
+
+		if (this->lods.empty()) {
+			this->lods.push_back({ 0, this->indexCount, 0.0f });
+		}
+
+		this->bounds.min = glm::vec3(0.0f);
+		this->bounds.max = glm::vec3(0.0f);
+		if (this->vertexCount > 0) {
+			this->bounds.min = this->bounds.max = vertexData[0].Position;
+		}
+		for (GLsizei i = 1; i < this->vertexCount; i++) {
+			this->bounds.min = glm::min(this->bounds.min, vertexData[i].Position);
+			this->bounds.max = glm::max(this->bounds.max, vertexData[i].Position);
+		}
 	}
 
-	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)	{
+	// Picks the array and layer every sampler reads from the acquired textures
+	void Mesh::resolveSampledTextures() {
 
-		shader.useShaderProgram();
+		GLuint blackArray = TextureRegistry::Get().GetBlackArray();
+		for (size_t unit = 0; unit < SAMPLED_TEXTURE_COUNT; unit++) {
+
+			this->sampledArrays[unit] = blackArray;
+			this->sampledLayers[unit] = 0;
+			for (const Texture& texture : this->textures) {
+				if (texture.type == SAMPLED_TEXTURES[unit] && texture.id != 0) {
+					this->sampledArrays[unit] = texture.id;
+					this->sampledLayers[unit] = texture.layer;
+					break;
+				}
+			}
+		}
+	}
 
-		//set textures
-		for (GLuint i = 0; i < textures.size(); i++) {
+	// Derives the frustum and the eye from a model-to-clip-space transform
+	ClusterView ClusterView::FromClipMatrix(const glm::mat4& modelClip) {
 
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+		ClusterView view;
+
+		// Gribb-Hartmann: each plane is the last row of the matrix plus or minus one of the others
+		glm::vec4 rows[4];
+		for (int r = 0; r < 4; r++) {
+			rows[r] = glm::vec4(modelClip[0][r], modelClip[1][r], modelClip[2][r], modelClip[3][r]);
+		}
+		for (int axis = 0; axis < 3; axis++) {
+			view.planes[2 * axis + 0] = rows[3] + rows[axis];
+			view.planes[2 * axis + 1] = rows[3] - rows[axis];
+		}
+		for (glm::vec4& plane : view.planes) {
+			float length = glm::length(glm::vec3(plane));
+			if (length > 0.0f) {
+				plane /= length;
+			}
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		// The clip-space point at infinity along +z maps back to the eye (perspective)
+		// or to the viewing direction (orthographic)
+		glm::vec4 eye = glm::inverse(modelClip) * glm::vec4(0.0f, 0.0f, 1.0f, 0.0f);
+		view.orthographic = std::fabs(eye.w) < 1e-6f * glm::length(glm::vec3(eye));
+		view.viewPoint = view.orthographic ? glm::normalize(glm::vec3(eye)) : glm::vec3(eye) / eye.w;
+
+		return view;
+	}
+
+	// Uploads the meshes back to back and tells each where it went
+	void MeshBuffers::Upload(std::vector<Mesh>& meshes, VertexFormat format) {
 
-        for(GLuint i = 0; i < this->textures.size(); i++) {
+		this->format = format;
 
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		// One index type for the whole buffer; indices stay relative to their mesh's base vertex, so 16 bits
+		// only have to address the largest mesh
+		size_t vertexTotal = 0;
+		size_t indexTotal = 0;
+		bool shortIndices = true;
+		BoundingBox bounds = { glm::vec3(std::numeric_limits<float>::max()), glm::vec3(-std::numeric_limits<float>::max()) };
+		for (Mesh& mesh : meshes) {
 
-    }
+			mesh.resolveSampledTextures();
+			mesh.baseVertex = (GLint)vertexTotal;
+			mesh.firstIndex = indexTotal;
+			vertexTotal += mesh.vertexCount;
+			indexTotal += mesh.indexCount;
+			shortIndices = shortIndices && Mesh::ChooseIndexType(mesh.vertexCount) == GL_UNSIGNED_SHORT;
+			if (mesh.vertexCount > 0) {
+				bounds.min = glm::min(bounds.min, mesh.bounds.min);
+				bounds.max = glm::max(bounds.max, mesh.bounds.max);
+			}
+		}
+		this->indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		this->indexBufferSize = indexTotal * Mesh::IndexSize(this->indexType);
+		for (Mesh& mesh : meshes) {
+			mesh.bufferIndexType = this->indexType;
+		}
 
-	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh() {
+		bool packed = this->format == VertexFormat::Packed;
+		if (packed && vertexTotal > 0) {
+			this->positionOffset = bounds.min;
+			this->positionScale = bounds.max - bounds.min;
+		}
+		size_t vertexSize = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+		size_t positionSize = packed ? 4 * sizeof(GLushort) : sizeof(glm::vec3);
+		size_t layerSize = SAMPLED_TEXTURE_COUNT * sizeof(GLushort);
 
 		// Create buffers/arrays
 		glGenVertexArrays(1, &this->buffers.VAO);
+		glGenVertexArrays(1, &this->buffers.depthVAO);
 		glGenBuffers(1, &this->buffers.VBO);
 		glGenBuffers(1, &this->buffers.EBO);
+		glGenBuffers(1, &this->buffers.positionVBO);
+		glGenBuffers(1, &this->buffers.layerVBO);
 
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
+		GLState::Get().BindVertexArray(this->buffers.VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferSize, nullptr, GL_STATIC_DRAW);
 		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vertexTotal * vertexSize, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexTotal * positionSize, nullptr, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.layerVBO);
+		glBufferData(GL_ARRAY_BUFFER, vertexTotal * layerSize, nullptr, GL_STATIC_DRAW);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		// Converted one mesh at a time, so the scratch memory never holds more than the largest mesh
+		std::vector<PackedVertex> packedVertices;
+		std::vector<GLushort> packedPositions;
+		std::vector<glm::vec3> positions;
+		std::vector<GLushort> layers;
+		std::vector<GLushort> shortIndexData;
+		std::vector<GLuint> intIndexData;
+
+		for (Mesh& mesh : meshes) {
+
+			const Vertex* vertexData = mesh.vertices.empty() ? mesh.vertexData : mesh.vertices.data();
+			const void* indexData = mesh.indices.empty() ? mesh.indexData : mesh.indices.data();
+			size_t count = (size_t)mesh.vertexCount;
+			size_t base = (size_t)mesh.baseVertex;
+
+			glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
+			if (packed) {
+				packedVertices.resize(count);
+				for (size_t i = 0; i < count; i++) {
+
+					const Vertex& vertex = vertexData[i];
+					quantizePosition(vertex.Position, packedVertices[i].Position);
+					packedVertices[i].Normal = glm::packSnorm3x10_1x2(glm::vec4(vertex.Normal, 0.0f));
+					packedVertices[i].TexCoords[0] = glm::packHalf1x16(vertex.TexCoords.x);
+					packedVertices[i].TexCoords[1] = glm::packHalf1x16(vertex.TexCoords.y);
+				}
+				glBufferSubData(GL_ARRAY_BUFFER, base * vertexSize, count * vertexSize, packedVertices.data());
+			} else {
+				glBufferSubData(GL_ARRAY_BUFFER, base * vertexSize, count * vertexSize, vertexData);
+			}
+
+			// Tightly packed position-only stream for depth passes, sharing the index buffer
+			glBindBuffer(GL_ARRAY_BUFFER, this->buffers.positionVBO);
+			if (packed) {
+				packedPositions.resize(4 * count);
+				for (size_t i = 0; i < count; i++) {
+					quantizePosition(vertexData[i].Position, &packedPositions[4 * i]);
+				}
+				glBufferSubData(GL_ARRAY_BUFFER, base * positionSize, count * positionSize, packedPositions.data());
+			} else {
+				positions.resize(count);
+				for (size_t i = 0; i < count; i++) {
+					positions[i] = vertexData[i].Position;
+				}
+				glBufferSubData(GL_ARRAY_BUFFER, base * positionSize, count * positionSize, positions.data());
+			}
+
+			layers.resize(SAMPLED_TEXTURE_COUNT * count);
+			for (size_t i = 0; i < count; i++) {
+				for (size_t unit = 0; unit < SAMPLED_TEXTURE_COUNT; unit++) {
+					layers[SAMPLED_TEXTURE_COUNT * i + unit] = (GLushort)mesh.sampledLayers[unit];
+				}
+			}
+			glBindBuffer(GL_ARRAY_BUFFER, this->buffers.layerVBO);
+			glBufferSubData(GL_ARRAY_BUFFER, base * layerSize, count * layerSize, layers.data());
+
+			// Indices come as parsed (32-bit) or as cached (the mesh's own type) and go in as the buffer's type
+			size_t indexCount = (size_t)mesh.indexCount;
+			if (mesh.indexType != this->indexType) {
+				if (this->indexType == GL_UNSIGNED_SHORT) {
+					const GLuint* source = static_cast<const GLuint*>(indexData);
+					shortIndexData.assign(source, source + indexCount);
+					indexData = shortIndexData.data();
+				} else {
+					const GLushort* source = static_cast<const GLushort*>(indexData);
+					intIndexData.assign(source, source + indexCount);
+					indexData = intIndexData.data();
+				}
+			}
+			size_t indexSize = Mesh::IndexSize(this->indexType);
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, mesh.firstIndex * indexSize, indexCount * indexSize, indexData);
+
+			// Geometry outside the mesh is not needed any more, a mesh cache may be closed now
+			mesh.vertexData = nullptr;
+			mesh.indexData = nullptr;
+		}
+
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
+		if (packed) {
+
+			// Positions, normalized to [0, 1] and rescaled in the vertex shader
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Position));
+			// Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, Normal));
+			// Texture coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, TexCoords));
+		}
+		else {
+
+			// Set the vertex attribute pointers
+			// Vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+			// Vertex Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		}
+
+		// Texture layers, integers all the way to the fragment shader
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.layerVBO);
+		glEnableVertexAttribArray(3);
+		glVertexAttribIPointer(3, (GLint)SAMPLED_TEXTURE_COUNT, GL_UNSIGNED_SHORT, (GLsizei)layerSize, (GLvoid*)0);
 
-		// Set the vertex attribute pointers
-		// Vertex Positions
+		GLState::Get().BindVertexArray(this->buffers.depthVAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.positionVBO);
 		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+		if (packed) {
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, (GLsizei)positionSize, (GLvoid*)0);
+		} else {
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, (GLsizei)positionSize, (GLvoid*)0);
+		}
+
+		GLState::Get().BindVertexArray(0);
+	}
+
+	void MeshBuffers::Draw(gps::Shader& shader, const DrawRanges& ranges) const {
+
+		// Identity for float vertices, so the same shaders serve both layouts
+		shader.setVec3("positionOffset", this->positionOffset);
+		shader.setVec3("positionScale", this->positionScale);
+
+		GLState::Get().BindVertexArray(this->buffers.VAO);
+		drawRanges(ranges);
+	}
+
+	// Depth-only draw from the position stream, no textures
+	void MeshBuffers::DrawDepth(gps::Shader& shader, const DrawRanges& ranges) const {
+
+		shader.setVec3("positionOffset", this->positionOffset);
+		shader.setVec3("positionScale", this->positionScale);
+
+		GLState::Get().BindVertexArray(this->buffers.depthVAO);
+		drawRanges(ranges);
+	}
+
+	void MeshBuffers::Delete() {
+
+		glDeleteBuffers(1, &this->buffers.VBO);
+		glDeleteBuffers(1, &this->buffers.EBO);
+		glDeleteBuffers(1, &this->buffers.positionVBO);
+		glDeleteBuffers(1, &this->buffers.layerVBO);
+		glDeleteVertexArrays(1, &this->buffers.VAO);
+		glDeleteVertexArrays(1, &this->buffers.depthVAO);
+		GLState::Get().ForgetVertexArray(this->buffers.VAO);
+		GLState::Get().ForgetVertexArray(this->buffers.depthVAO);
+		this->buffers = {};
+	}
+
+	// Quantizes a position to 16 bits per axis relative to the shared bounds (w unused)
+	void MeshBuffers::quantizePosition(const glm::vec3& position, GLushort quantized[4]) const {
+
+		for (int axis = 0; axis < 3; axis++) {
+			float unit = this->positionScale[axis] > 0.0f ? (position[axis] - this->positionOffset[axis]) / this->positionScale[axis] : 0.0f;
+			quantized[axis] = (GLushort)std::lround(glm::clamp(unit, 0.0f, 1.0f) * 65535.0f);
+		}
+		quantized[3] = 0;
+	}
+
+	// Issues the ranges on the bound vertex array
+	void MeshBuffers::drawRanges(const DrawRanges& ranges) const {
+
+		if (ranges.counts.size() == 1) {
+			glDrawElementsBaseVertex(GL_TRIANGLES, ranges.counts[0], this->indexType, ranges.offsets[0], ranges.baseVertices[0]);
+		} else {
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, ranges.counts.data(), this->indexType, ranges.offsets.data(),
+										  (GLsizei)ranges.counts.size(), ranges.baseVertices.data());
+		}
 	}
 }
@@ -26,9 +26,26 @@ namespace gps {
         glm::vec2 TexCoords;
     };
 
+    // 16-byte upload layout: position quantized to the model bounds (w unused),
+    // normal as signed 10:10:10:2 and half-float texture coordinates
+    struct PackedVertex {
+
+        GLushort Position[4];
+        GLuint Normal;
+        GLushort TexCoords[2];
+    };
+
+    // Vertex layout the GPU buffers are built with
+    enum class VertexFormat {
+        Float,
+        Packed
+    };
+
     struct Texture {
 
+        // Array texture holding the image, and the image's layer in it
         GLuint id;
+        GLint layer = 0;
         //ambientTexture, diffuseTexture, specularTexture
         std::string type;
         std::string path;
@@ -41,10 +58,79 @@ namespace gps {
         glm::vec3 specular;
     };
 
+    struct BoundingBox {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    // One level of detail, a range of the mesh's index buffer
+    struct MeshLod {
+        GLuint indexOffset;
+        GLsizei indexCount;
+        // Largest distance the simplification moved the surface by, in model units
+        float error;
+        // Range of the mesh's clusters covering this level
+        GLuint clusterOffset;
+        GLuint clusterCount;
+    };
+
+    // Small contiguous run of triangles with the bounds needed to cull it on the CPU
+    struct MeshCluster {
+        GLuint indexOffset;
+        GLsizei indexCount;
+        glm::vec3 center;
+        float radius;
+        // Every face normal lies within the cone around this axis
+        glm::vec3 coneAxis;
+        // Sine of the cone's half angle, 1 when the cone is too wide to ever face away
+        float coneCutoff;
+    };
+
+    // Pass the clusters are culled against, in the mesh's model space
+    struct ClusterView {
+        // Frustum planes, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+        glm::vec4 planes[6];
+        // Eye position, or the viewing direction for orthographic passes
+        glm::vec3 viewPoint;
+        bool orthographic;
+
+        // Derives the frustum and the eye from a model-to-clip-space transform
+        static ClusterView FromClipMatrix(const glm::mat4& modelClip);
+    };
+
+    // Work submitted since the counters were last reset
+    struct DrawStats {
+        size_t triangles = 0;
+        // What the same draws would have cost at full detail
+        size_t fullTriangles = 0;
+        size_t clusters = 0;
+        size_t culledClusters = 0;
+        size_t drawCalls = 0;
+    };
+
     struct Buffers {
         GLuint VAO;
         GLuint VBO;
         GLuint EBO;
+        // Position-only stream and its vertex array for depth passes
+        GLuint depthVAO;
+        GLuint positionVBO;
+        // Texture layer of every vertex, one per sampler
+        GLuint layerVBO;
+    };
+
+    // Samplers of the basic shader, each bound to the texture unit of its index
+    const size_t SAMPLED_TEXTURE_COUNT = 2;
+    const char* const SAMPLED_TEXTURES[SAMPLED_TEXTURE_COUNT] = { "diffuseTexture", "specularTexture" };
+
+    // Index ranges of one draw over a model's shared buffers, each with the base vertex of its mesh
+    struct DrawRanges {
+        std::vector<GLsizei> counts;
+        std::vector<const GLvoid*> offsets;
+        std::vector<GLint> baseVertices;
+
+        void clear() { counts.clear(); offsets.clear(); baseVertices.clear(); }
+        bool empty() const { return counts.empty(); }
     };
 
     class Mesh {
@@ -53,20 +139,111 @@ namespace gps {
         std::vector<Vertex> vertices;
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
+        // Levels of detail, all of them live in indices; empty means a single full level
+        std::vector<MeshLod> lods;
+        // Clusters of all levels, each level owns a range of them
+        std::vector<MeshCluster> clusters;
+
+	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+	         std::vector<MeshLod> lods = {}, std::vector<MeshCluster> clusters = {});
+
+	    // Geometry that lives outside the mesh (e.g. a mapped cache file) and is uploaded from there without a CPU copy,
+	    // it must stay valid until MeshBuffers::Upload; indexData holds GLushort or GLuint indices as given by indexType
+	    Mesh(const Vertex* vertexData, GLsizei vertexCount, const void* indexData, GLenum indexType, GLsizei indexCount,
+	         std::vector<Texture> textures, std::vector<MeshLod> lods = {}, std::vector<MeshCluster> clusters = {});
+
+	    // Smallest index type that can address vertexCount vertices
+	    static GLenum ChooseIndexType(size_t vertexCount);
+
+	    static size_t IndexSize(GLenum indexType) { return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint); }
+
+	    BoundingBox getBounds() const { return bounds; }
+
+	    size_t getLodCount() const { return lods.size(); }
+
+	    const MeshLod& getLod(size_t level) const { return lods[level]; }
+
+	    GLsizei getVertexCount() const { return vertexCount; }
+
+	    // Smallest index type for the mesh's own vertices, the one the mesh cache stores
+	    GLenum getIndexType() const { return ChooseIndexType(vertexCount); }
 
-	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	    // Array texture a sampler reads for this mesh (SAMPLED_TEXTURES order), the black array where the mesh
+	    // has no image; valid once the mesh is uploaded
+	    GLuint getSampledArray(size_t unit) const { return sampledArrays[unit]; }
 
-	    Buffers getBuffers();
+	    // Binds the sampled arrays to their texture units
+	    void BindTextures(gps::Shader& shader) const;
 
-	    void Draw(gps::Shader shader);
+	    // Appends one level to the ranges of a draw, or only its clusters that are inside the view and not facing
+	    // away from it when a view is given; false when none of them is
+	    bool CollectRanges(size_t level, const ClusterView* view, DrawStats& stats, DrawRanges& ranges) const;
 
     private:
-        /*  Render data  */
-        Buffers buffers;
+        friend class MeshBuffers;
+
+        // Geometry handed to the second constructor, until it is uploaded
+        const Vertex* vertexData = nullptr;
+        const void* indexData = nullptr;
+        GLsizei vertexCount;
+        GLsizei indexCount;
+        // Index type of the geometry the mesh was built from
+        GLenum indexType;
+        BoundingBox bounds;
+        // Where the model's shared buffers hold the mesh
+        GLint baseVertex = 0;
+        size_t firstIndex = 0;
+        GLenum bufferIndexType = GL_UNSIGNED_INT;
+        // Array texture and layer of every sampler
+        GLuint sampledArrays[SAMPLED_TEXTURE_COUNT] = {};
+        GLint sampledLayers[SAMPLED_TEXTURE_COUNT] = {};
+
+	    // Bounds of the mesh alone, used for level of detail selection and position quantization
+	    void computeBounds(const Vertex* vertexData);
+
+	    // Picks the array and layer every sampler reads from the acquired textures
+	    void resolveSampledTextures();
+    };
+
+    // GPU buffers all meshes of a model share: interleaved vertices, positions alone for depth passes, the
+    // texture layers of every vertex and the indices. Meshes binding the same arrays differ only in their
+    // layers, which the vertices carry, so any set of them is drawn with one glMultiDrawElementsBaseVertex.
+    class MeshBuffers {
+
+    public:
+	    // Uploads the meshes back to back and tells each where it went; their textures must be acquired.
+	    // Packed positions are quantized to the bounds of all meshes together, so they share one dequantization.
+	    void Upload(std::vector<Mesh>& meshes, VertexFormat format);
+
+	    // Draws the ranges with whatever textures are bound
+	    void Draw(gps::Shader& shader, const DrawRanges& ranges) const;
 
-	    // Initializes all the buffer objects/arrays
-	    void setupMesh();
+	    // Depth-only draw from the position stream, the depth program must be in use
+	    void DrawDepth(gps::Shader& shader, const DrawRanges& ranges) const;
 
+	    // Deletes the buffers, must run while the GL context exists
+	    void Delete();
+
+	    // GL_UNSIGNED_SHORT whenever every mesh's vertex count allows it, indices are relative to each mesh's base vertex
+	    GLenum getIndexType() const { return indexType; }
+
+	    // Size of the GPU index buffer in bytes
+	    size_t getIndexBufferSize() const { return indexBufferSize; }
+
+    private:
+        Buffers buffers = {};
+        GLenum indexType = GL_UNSIGNED_INT;
+        size_t indexBufferSize = 0;
+        VertexFormat format = VertexFormat::Float;
+        // Dequantization of packed positions, position = offset + scale * normalized value
+        glm::vec3 positionOffset = glm::vec3(0.0f);
+        glm::vec3 positionScale = glm::vec3(1.0f);
+
+	    // Quantizes a position to 16 bits per axis relative to the shared bounds (w unused)
+	    void quantizePosition(const glm::vec3& position, GLushort quantized[4]) const;
+
+	    // Issues the ranges on the bound vertex array
+	    void drawRanges(const DrawRanges& ranges) const;
     };
 
 }
@@ -0,0 +1,542 @@
+#include "MeshCache.hpp"
+#include "AssetPack.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+
+		const char CACHE_MAGIC[8] = { 'G', 'P', 'S', 'M', 'E', 'S', 'H', '\0' };
+
+		// Identifies the contents of a source file the cache was built from
+		struct SourceRecord {
+			uint64_t size;
+			int64_t time;
+			uint64_t hash;
+		};
+
+		// Size of a source file that did not exist when the cache was built
+		const uint64_t MISSING_SOURCE = ~(uint64_t)0;
+
+		// On-disk layout: header, one record per mesh, then per mesh its texture references, level of detail
+		// table, clusters, vertices and indices, then the .mtl files the model depends on. Data blocks are
+		// 16-byte aligned.
+		struct FileHeader {
+			char magic[8];
+			uint32_t version;
+			uint32_t meshCount;
+			uint32_t buildFlags;
+			uint32_t dependencyCount;
+			SourceRecord source;
+			float aabbMin[3];
+			float aabbMax[3];
+			uint64_t dependencyOffset;
+		};
+
+		// Followed by the path of the dependency, relative to the material base path
+		struct DependencyRecord {
+			SourceRecord source;
+			uint32_t pathLength;
+			uint32_t padding;
+		};
+
+		struct MeshRecord {
+			uint64_t textureOffset;
+			uint64_t vertexOffset;
+			uint64_t indexOffset;
+			uint64_t lodOffset;
+			uint64_t clusterOffset;
+			uint32_t textureCount;
+			uint32_t vertexCount;
+			uint32_t indexCount;
+			uint32_t lodCount;
+			uint32_t clusterCount;
+			// Bytes per index, 2 for meshes small enough for GL_UNSIGNED_SHORT
+			uint32_t indexSize;
+		};
+
+		struct LodRecord {
+			uint32_t indexOffset;
+			uint32_t indexCount;
+			float error;
+			uint32_t clusterOffset;
+			uint32_t clusterCount;
+			uint32_t padding;
+		};
+
+		struct ClusterRecord {
+			uint32_t indexOffset;
+			uint32_t indexCount;
+			float center[3];
+			float radius;
+			float coneAxis[3];
+			float coneCutoff;
+		};
+
+		// Fills in size and time
+		bool ReadSourceStamp(const std::string& fileName, SourceRecord* stamp) {
+
+			std::error_code ec;
+			uintmax_t size = std::filesystem::file_size(fileName, ec);
+			if (ec) {
+				return false;
+			}
+			auto time = std::filesystem::last_write_time(fileName, ec);
+			if (ec) {
+				return false;
+			}
+			stamp->size = (uint64_t)size;
+			stamp->time = (int64_t)time.time_since_epoch().count();
+			return true;
+		}
+
+		bool HashSourceFile(const std::string& fileName, uint64_t* hash) {
+
+			MappedFile source;
+			if (!source.Open(fileName)) {
+				return false;
+			}
+			*hash = HashBytes(source.GetData(), source.GetSize());
+			return true;
+		}
+
+		// Records a source as the asset pack holds it, or as it is on disk; returns false if it is in neither
+		bool RecordSource(const std::string& fileName, SourceRecord* record) {
+
+			AssetView asset;
+			if (AssetPack::Get().Find(fileName, &asset)) {
+				// No file time in the pack; a later filesystem load falls back to comparing the hash
+				*record = { asset.size, 0, asset.hash };
+				return true;
+			}
+			*record = { MISSING_SOURCE, 0, 0 };
+			return ReadSourceStamp(fileName, record) && HashSourceFile(fileName, &record->hash);
+		}
+
+		// Whether a source still has the contents it was recorded with, or is still missing. A file that was
+		// only touched gets its new time in the record, and restamped set.
+		bool MatchesSource(const std::string& fileName, SourceRecord* record, bool* restamped) {
+
+			// A packed source is identified by the content hash the pack already stores
+			AssetView asset;
+			if (AssetPack::Get().Find(fileName, &asset)) {
+				return asset.size == record->size && asset.hash == record->hash;
+			}
+
+			SourceRecord stamp;
+			if (!ReadSourceStamp(fileName, &stamp)) {
+				return record->size == MISSING_SOURCE;
+			}
+			if (stamp.size != record->size) {
+				return false;
+			}
+
+			if (stamp.time != record->time) {
+				// Touched but possibly unchanged (e.g. a fresh checkout) - let the contents decide
+				uint64_t hash;
+				if (!HashSourceFile(fileName, &hash) || hash != record->hash) {
+					return false;
+				}
+				record->time = stamp.time;
+				*restamped = true;
+			}
+			return true;
+		}
+
+		// The material libraries named by the mtllib lines of an .obj file
+		std::vector<std::string> FindMaterialLibraries(const std::string& objFileName) {
+
+			AssetView asset;
+			MappedFile source;
+			const char* text;
+			size_t size;
+			if (AssetPack::Get().Find(objFileName, &asset)) {
+				text = reinterpret_cast<const char*>(asset.data);
+				size = asset.size;
+			} else if (source.Open(objFileName)) {
+				text = reinterpret_cast<const char*>(source.GetData());
+				size = source.GetSize();
+			} else {
+				return {};
+			}
+
+			auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+
+			std::vector<std::string> libraries;
+			for (size_t begin = 0; begin < size;) {
+
+				const char* lineEnd = static_cast<const char*>(std::memchr(text + begin, '\n', size - begin));
+				size_t end = lineEnd ? (size_t)(lineEnd - text) : size;
+
+				size_t p = begin;
+				while (p < end && isSpace(text[p])) {
+					p++;
+				}
+				if (end - p > 6 && std::strncmp(text + p, "mtllib", 6) == 0 && isSpace(text[p + 6])) {
+
+					// One or more file names separated by spaces
+					for (p += 6; p < end;) {
+						while (p < end && isSpace(text[p])) {
+							p++;
+						}
+						size_t nameBegin = p;
+						while (p < end && !isSpace(text[p])) {
+							p++;
+						}
+						std::string name(text + nameBegin, p - nameBegin);
+						if (!name.empty() && std::find(libraries.begin(), libraries.end(), name) == libraries.end()) {
+							libraries.push_back(name);
+						}
+					}
+				}
+				begin = end + 1;
+			}
+			return libraries;
+		}
+
+		uint64_t AlignOffset(uint64_t offset) {
+
+			return (offset + 15) & ~(uint64_t)15;
+		}
+
+		void WritePadding(std::ofstream& out, uint64_t from, uint64_t to) {
+
+			static const char zeros[16] = {};
+			out.write(zeros, (std::streamsize)(to - from));
+		}
+	}
+
+	std::string MeshCache::GetCachePath(const std::string& objFileName) {
+
+		return objFileName + ".meshcache";
+	}
+
+	bool MeshCache::Open(const std::string& objFileName, const std::string& materialBasePath, uint32_t buildFlags) {
+
+		meshes.clear();
+
+		std::string cachePath = GetCachePath(objFileName);
+		if (!file.Open(cachePath)) {
+			return false;
+		}
+
+		if (!Parse()) {
+			std::cerr << "WARNING: ignoring corrupt mesh cache " << cachePath << std::endl;
+			file.Close();
+			return false;
+		}
+
+		FileHeader header;
+		std::memcpy(&header, file.GetData(), sizeof(header));
+
+		if (header.buildFlags != buildFlags) {
+			file.Close();
+			return false;
+		}
+
+		// Records whose source was touched but unchanged, by offset in the file
+		std::vector<std::pair<uint64_t, SourceRecord>> restamps;
+
+		bool restamped = false;
+		if (!MatchesSource(objFileName, &header.source, &restamped)) {
+			file.Close();
+			return false;
+		}
+		if (restamped) {
+			restamps.push_back({ offsetof(FileHeader, source), header.source });
+		}
+
+		// The materials decide the textures baked into the meshes, and how the faces were merged
+		uint64_t offset = header.dependencyOffset;
+		for (uint32_t d = 0; d < header.dependencyCount; d++) {
+
+			DependencyRecord dependency;
+			std::memcpy(&dependency, file.GetData() + offset, sizeof(dependency));
+			std::string path(reinterpret_cast<const char*>(file.GetData() + offset + sizeof(dependency)), dependency.pathLength);
+
+			restamped = false;
+			if (!MatchesSource(materialBasePath + path, &dependency.source, &restamped)) {
+				file.Close();
+				return false;
+			}
+			if (restamped) {
+				restamps.push_back({ offset + offsetof(DependencyRecord, source), dependency.source });
+			}
+			offset += sizeof(dependency) + dependency.pathLength;
+		}
+
+		if (!restamps.empty()) {
+			std::fstream restamp(cachePath, std::ios::in | std::ios::out | std::ios::binary);
+			for (const auto& [recordOffset, source] : restamps) {
+				restamp.seekp((std::streamoff)(recordOffset + offsetof(SourceRecord, time)));
+				restamp.write(reinterpret_cast<const char*>(&source.time), sizeof(source.time));
+			}
+		}
+
+		return true;
+	}
+
+	// Validates the mapped file and builds the per-mesh views into it
+	bool MeshCache::Parse() {
+
+		const unsigned char* base = file.GetData();
+		uint64_t fileSize = file.GetSize();
+
+		if (fileSize < sizeof(FileHeader)) {
+			return false;
+		}
+
+		FileHeader header;
+		std::memcpy(&header, base, sizeof(header));
+
+		if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != MESH_CACHE_VERSION) {
+			return false;
+		}
+
+		uint64_t recordsEnd = sizeof(FileHeader) + (uint64_t)header.meshCount * sizeof(MeshRecord);
+		if (recordsEnd > fileSize) {
+			return false;
+		}
+
+		uint64_t dependencyEnd = header.dependencyOffset;
+		for (uint32_t d = 0; d < header.dependencyCount; d++) {
+
+			DependencyRecord dependency;
+			if (dependencyEnd + sizeof(dependency) > fileSize) {
+				return false;
+			}
+			std::memcpy(&dependency, base + dependencyEnd, sizeof(dependency));
+			dependencyEnd += sizeof(dependency) + dependency.pathLength;
+			if (dependencyEnd > fileSize) {
+				return false;
+			}
+		}
+
+		aabb.min = glm::vec3(header.aabbMin[0], header.aabbMin[1], header.aabbMin[2]);
+		aabb.max = glm::vec3(header.aabbMax[0], header.aabbMax[1], header.aabbMax[2]);
+
+		meshes.reserve(header.meshCount);
+
+		for (uint32_t m = 0; m < header.meshCount; m++) {
+
+			MeshRecord record;
+			std::memcpy(&record, base + sizeof(FileHeader) + m * sizeof(MeshRecord), sizeof(record));
+
+			GLenum indexType = Mesh::ChooseIndexType(record.vertexCount);
+			if (record.indexSize != Mesh::IndexSize(indexType)) {
+				return false;
+			}
+
+			if (record.vertexOffset + (uint64_t)record.vertexCount * sizeof(Vertex) > fileSize ||
+				record.indexOffset + (uint64_t)record.indexCount * record.indexSize > fileSize ||
+				record.lodOffset + (uint64_t)record.lodCount * sizeof(LodRecord) > fileSize ||
+				record.clusterOffset + (uint64_t)record.clusterCount * sizeof(ClusterRecord) > fileSize ||
+				record.vertexOffset % 16 != 0 || record.indexOffset % 16 != 0) {
+				return false;
+			}
+
+			CachedMesh mesh;
+			mesh.vertices = reinterpret_cast<const Vertex*>(base + record.vertexOffset);
+			mesh.vertexCount = (GLsizei)record.vertexCount;
+			mesh.indices = base + record.indexOffset;
+			mesh.indexType = indexType;
+			mesh.indexCount = (GLsizei)record.indexCount;
+
+			for (uint32_t l = 0; l < record.lodCount; l++) {
+
+				LodRecord lod;
+				std::memcpy(&lod, base + record.lodOffset + l * sizeof(LodRecord), sizeof(lod));
+				if ((uint64_t)lod.indexOffset + lod.indexCount > record.indexCount ||
+					(uint64_t)lod.clusterOffset + lod.clusterCount > record.clusterCount) {
+					return false;
+				}
+				mesh.lods.push_back({ lod.indexOffset, (GLsizei)lod.indexCount, lod.error, lod.clusterOffset, lod.clusterCount });
+			}
+
+			mesh.clusters.reserve(record.clusterCount);
+			for (uint32_t c = 0; c < record.clusterCount; c++) {
+
+				ClusterRecord cluster;
+				std::memcpy(&cluster, base + record.clusterOffset + c * sizeof(ClusterRecord), sizeof(cluster));
+				if ((uint64_t)cluster.indexOffset + cluster.indexCount > record.indexCount) {
+					return false;
+				}
+
+				MeshCluster meshCluster;
+				meshCluster.indexOffset = cluster.indexOffset;
+				meshCluster.indexCount = (GLsizei)cluster.indexCount;
+				meshCluster.center = glm::vec3(cluster.center[0], cluster.center[1], cluster.center[2]);
+				meshCluster.radius = cluster.radius;
+				meshCluster.coneAxis = glm::vec3(cluster.coneAxis[0], cluster.coneAxis[1], cluster.coneAxis[2]);
+				meshCluster.coneCutoff = cluster.coneCutoff;
+				mesh.clusters.push_back(meshCluster);
+			}
+
+			uint64_t offset = record.textureOffset;
+			for (uint32_t t = 0; t < record.textureCount; t++) {
+
+				uint32_t lengths[2];
+				if (offset + sizeof(lengths) > fileSize) {
+					return false;
+				}
+				std::memcpy(lengths, base + offset, sizeof(lengths));
+				offset += sizeof(lengths);
+
+				if (offset + lengths[0] + lengths[1] > fileSize) {
+					return false;
+				}
+
+				Texture texture;
+				texture.id = 0;
+				texture.type.assign(reinterpret_cast<const char*>(base + offset), lengths[0]);
+				offset += lengths[0];
+				texture.path.assign(reinterpret_cast<const char*>(base + offset), lengths[1]);
+				offset += lengths[1];
+
+				mesh.textures.push_back(texture);
+			}
+
+			meshes.push_back(mesh);
+		}
+
+		return true;
+	}
+
+	bool MeshCache::Write(const std::string& objFileName, const std::string& materialBasePath, uint32_t buildFlags,
+						  const std::vector<Mesh>& meshes, const BoundingBox& aabb) {
+
+		FileHeader header = {};
+		std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.version = MESH_CACHE_VERSION;
+		header.meshCount = (uint32_t)meshes.size();
+		header.buildFlags = buildFlags;
+
+		if (!RecordSource(objFileName, &header.source)) {
+			return false;
+		}
+
+		// A missing library is recorded too, so the cache goes stale when it turns up
+		std::vector<std::string> libraries = FindMaterialLibraries(objFileName);
+		std::vector<DependencyRecord> dependencies(libraries.size());
+		for (size_t d = 0; d < libraries.size(); d++) {
+			dependencies[d] = {};
+			RecordSource(materialBasePath + libraries[d], &dependencies[d].source);
+			dependencies[d].pathLength = (uint32_t)libraries[d].size();
+		}
+		header.dependencyCount = (uint32_t)dependencies.size();
+
+		for (int i = 0; i < 3; i++) {
+			header.aabbMin[i] = aabb.min[i];
+			header.aabbMax[i] = aabb.max[i];
+		}
+
+		// Lay out the data blocks
+		std::vector<MeshRecord> records(meshes.size());
+		uint64_t offset = sizeof(FileHeader) + meshes.size() * sizeof(MeshRecord);
+
+		for (size_t m = 0; m < meshes.size(); m++) {
+
+			MeshRecord& record = records[m];
+			record = {};
+			record.textureOffset = offset;
+			record.textureCount = (uint32_t)meshes[m].textures.size();
+			for (const Texture& texture : meshes[m].textures) {
+				offset += 2 * sizeof(uint32_t) + texture.type.size() + texture.path.size();
+			}
+
+			offset = AlignOffset(offset);
+			record.lodOffset = offset;
+			record.lodCount = (uint32_t)meshes[m].lods.size();
+			offset += (uint64_t)record.lodCount * sizeof(LodRecord);
+
+			record.clusterOffset = offset;
+			record.clusterCount = (uint32_t)meshes[m].clusters.size();
+			offset += (uint64_t)record.clusterCount * sizeof(ClusterRecord);
+
+			offset = AlignOffset(offset);
+			record.vertexOffset = offset;
+			record.vertexCount = (uint32_t)meshes[m].vertices.size();
+			offset += (uint64_t)record.vertexCount * sizeof(Vertex);
+
+			offset = AlignOffset(offset);
+			record.indexOffset = offset;
+			record.indexCount = (uint32_t)meshes[m].indices.size();
+			record.indexSize = (uint32_t)Mesh::IndexSize(meshes[m].getIndexType());
+			offset += (uint64_t)record.indexCount * record.indexSize;
+		}
+		header.dependencyOffset = offset;
+
+		// Write to a temporary file first so a crash never leaves a half-written cache behind
+		std::string cachePath = GetCachePath(objFileName);
+		std::string tempPath = cachePath + ".tmp";
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return false;
+		}
+
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(records.data()), (std::streamsize)(records.size() * sizeof(MeshRecord)));
+
+		offset = sizeof(FileHeader) + meshes.size() * sizeof(MeshRecord);
+
+		for (size_t m = 0; m < meshes.size(); m++) {
+
+			for (const Texture& texture : meshes[m].textures) {
+
+				uint32_t lengths[2] = { (uint32_t)texture.type.size(), (uint32_t)texture.path.size() };
+				out.write(reinterpret_cast<const char*>(lengths), sizeof(lengths));
+				out.write(texture.type.data(), lengths[0]);
+				out.write(texture.path.data(), lengths[1]);
+				offset += sizeof(lengths) + lengths[0] + lengths[1];
+			}
+
+			WritePadding(out, offset, records[m].lodOffset);
+			for (const MeshLod& lod : meshes[m].lods) {
+
+				LodRecord record = { lod.indexOffset, (uint32_t)lod.indexCount, lod.error, lod.clusterOffset, lod.clusterCount, 0 };
+				out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			}
+			for (const MeshCluster& cluster : meshes[m].clusters) {
+
+				ClusterRecord record = { cluster.indexOffset, (uint32_t)cluster.indexCount,
+										 { cluster.center.x, cluster.center.y, cluster.center.z }, cluster.radius,
+										 { cluster.coneAxis.x, cluster.coneAxis.y, cluster.coneAxis.z }, cluster.coneCutoff };
+				out.write(reinterpret_cast<const char*>(&record), sizeof(record));
+			}
+			offset = records[m].clusterOffset + records[m].clusterCount * sizeof(ClusterRecord);
+
+			WritePadding(out, offset, records[m].vertexOffset);
+			out.write(reinterpret_cast<const char*>(meshes[m].vertices.data()), (std::streamsize)(records[m].vertexCount * sizeof(Vertex)));
+			offset = records[m].vertexOffset + records[m].vertexCount * sizeof(Vertex);
+
+			WritePadding(out, offset, records[m].indexOffset);
+			if (records[m].indexSize == sizeof(GLushort)) {
+				std::vector<GLushort> shortIndices(meshes[m].indices.begin(), meshes[m].indices.end());
+				out.write(reinterpret_cast<const char*>(shortIndices.data()), (std::streamsize)(records[m].indexCount * sizeof(GLushort)));
+			} else {
+				out.write(reinterpret_cast<const char*>(meshes[m].indices.data()), (std::streamsize)(records[m].indexCount * sizeof(GLuint)));
+			}
+			offset = records[m].indexOffset + records[m].indexCount * records[m].indexSize;
+		}
+
+		for (size_t d = 0; d < dependencies.size(); d++) {
+			out.write(reinterpret_cast<const char*>(&dependencies[d]), sizeof(DependencyRecord));
+			out.write(libraries[d].data(), (std::streamsize)libraries[d].size());
+		}
+
+		out.close();
+		if (!out) {
+			std::filesystem::remove(tempPath);
+			return false;
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tempPath, cachePath, ec);
+		return !ec;
+	}
+}
@@ -0,0 +1,64 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+	// Bump whenever the file layout or the geometry produced by the .obj loader changes
+	const uint32_t MESH_CACHE_VERSION = 10;
+
+	// Load-time processing baked into a cache; a cache built with other flags is stale
+	const uint32_t MESH_CACHE_OPTIMIZED = 1 << 0;
+	const uint32_t MESH_CACHE_LODS = 1 << 1;
+	const uint32_t MESH_CACHE_CLUSTERS = 1 << 2;
+	const uint32_t MESH_CACHE_MERGED = 1 << 3;
+
+	// View of one baked mesh, pointing straight into the mapped cache file
+	struct CachedMesh {
+		const Vertex* vertices;
+		GLsizei vertexCount;
+		// Stored in the index type the GPU buffer uses
+		const void* indices;
+		GLenum indexType;
+		GLsizei indexCount;
+		std::vector<MeshLod> lods;
+		std::vector<MeshCluster> clusters;
+		// Texture ids are not baked, only type and path
+		std::vector<Texture> textures;
+	};
+
+	// Baked binary copy of a model's finished meshes, stored next to the source .obj file
+	class MeshCache {
+
+	public:
+		// Location of the cache file belonging to a source .obj file
+		static std::string GetCachePath(const std::string& objFileName);
+
+		// Maps the cache, returns false if it is missing, corrupt, built with other flags, or stale: the .obj or one
+		// of the .mtl files it names (looked up under materialBasePath) changed, appeared or went away
+		bool Open(const std::string& objFileName, const std::string& materialBasePath, uint32_t buildFlags);
+
+		// Bakes the meshes of a freshly parsed model
+		static bool Write(const std::string& objFileName, const std::string& materialBasePath, uint32_t buildFlags,
+						  const std::vector<Mesh>& meshes, const BoundingBox& aabb);
+
+		size_t GetMeshCount() const { return meshes.size(); }
+		const CachedMesh& GetMesh(size_t index) const { return meshes[index]; }
+		BoundingBox GetBoundingBox() const { return aabb; }
+
+	private:
+		MappedFile file;
+		std::vector<CachedMesh> meshes;
+		BoundingBox aabb;
+
+		bool Parse();
+	};
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,311 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <numeric>
+
+namespace gps {
+
+	namespace {
+
+		// Clusters are split where their own ACMR is within this factor of the whole mesh's,
+		// trading a little cache efficiency for finer overdraw ordering (lambda in the paper)
+		const float OVERDRAW_THRESHOLD = 1.05f;
+
+		// Simulated FIFO cache, a vertex hits while fewer than CACHE_SIZE misses happened since it was loaded
+		class CacheSimulator {
+
+		public:
+			explicit CacheSimulator(size_t vertexCount)
+				: timestamps(vertexCount, 0), time(MeshOptimizer::CACHE_SIZE + 1) {
+			}
+
+			bool Access(GLuint vertex) {
+
+				if (time - timestamps[vertex] > (unsigned)MeshOptimizer::CACHE_SIZE) {
+					timestamps[vertex] = time++;
+					return false;
+				}
+				return true;
+			}
+
+			void Reset() {
+
+				// Pushing the clock past every stamp empties the cache
+				time += MeshOptimizer::CACHE_SIZE + 1;
+			}
+
+		private:
+			std::vector<unsigned> timestamps;
+			unsigned time;
+		};
+	}
+
+	void MeshOptimizer::Optimize(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+
+		if (indices.size() < 3 || vertices.empty()) {
+			return;
+		}
+
+		OptimizeTriangleOrder(vertices, indices);
+		OptimizeVertexFetch(vertices, indices);
+	}
+
+	void MeshOptimizer::OptimizeTriangleOrder(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+
+		if (indices.size() < 3) {
+			return;
+		}
+
+		std::vector<size_t> hardBoundaries;
+		std::vector<GLuint> reordered = OptimizeVertexCache(indices, vertices.size(), hardBoundaries);
+		OptimizeOverdraw(reordered, vertices, hardBoundaries);
+
+		// Already well-ordered input (e.g. exported strips) can beat Tipsify, keep it then
+		if (AnalyzeVertexCache(reordered, vertices.size()).acmr <= AnalyzeVertexCache(indices, vertices.size()).acmr) {
+			indices.swap(reordered);
+		}
+	}
+
+	VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount) {
+
+		VertexCacheStats stats = { 0.0f, 0.0f };
+		if (indices.size() < 3) {
+			return stats;
+		}
+
+		CacheSimulator cache(vertexCount);
+		std::vector<bool> referenced(vertexCount, false);
+		size_t misses = 0;
+		size_t referencedCount = 0;
+
+		for (GLuint index : indices) {
+			if (!cache.Access(index)) {
+				misses++;
+			}
+			if (!referenced[index]) {
+				referenced[index] = true;
+				referencedCount++;
+			}
+		}
+
+		stats.acmr = (float)misses / (float)(indices.size() / 3);
+		stats.atvr = (float)misses / (float)referencedCount;
+		return stats;
+	}
+
+	std::vector<GLuint> MeshOptimizer::OptimizeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount,
+														   std::vector<size_t>& hardBoundaries) {
+
+		size_t triangleCount = indices.size() / 3;
+
+		// Vertex -> triangle adjacency in compressed rows
+		std::vector<unsigned> liveTriangles(vertexCount, 0);
+		for (size_t i = 0; i < triangleCount * 3; i++) {
+			liveTriangles[indices[i]]++;
+		}
+
+		std::vector<size_t> offsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++) {
+			offsets[v + 1] = offsets[v] + liveTriangles[v];
+		}
+
+		std::vector<unsigned> adjacency(offsets[vertexCount]);
+		std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; i++) {
+			adjacency[fill[indices[i]]++] = (unsigned)(i / 3);
+		}
+
+		std::vector<unsigned> cacheTime(vertexCount, 0);
+		std::vector<bool> emitted(triangleCount, false);
+		std::vector<GLuint> deadEnds;
+		std::vector<GLuint> candidates;
+		std::vector<GLuint> output;
+		deadEnds.reserve(triangleCount * 3);
+		output.reserve(triangleCount * 3);
+
+		const unsigned cacheSize = (unsigned)CACHE_SIZE;
+		unsigned time = cacheSize + 1;
+		size_t cursor = 1;
+		long fanning = 0;
+
+		while (fanning >= 0) {
+
+			// Emit every remaining triangle around the fanning vertex
+			candidates.clear();
+			for (size_t k = offsets[fanning]; k < offsets[fanning + 1]; k++) {
+
+				unsigned triangle = adjacency[k];
+				if (emitted[triangle]) {
+					continue;
+				}
+
+				for (int corner = 0; corner < 3; corner++) {
+					GLuint v = indices[3 * triangle + corner];
+					output.push_back(v);
+					deadEnds.push_back(v);
+					candidates.push_back(v);
+					liveTriangles[v]--;
+					if (time - cacheTime[v] > cacheSize) {
+						cacheTime[v] = time++;
+					}
+				}
+				emitted[triangle] = true;
+			}
+
+			// Next fan: the candidate that stays in cache for all its remaining triangles and entered it earliest
+			long next = -1;
+			long bestPriority = -1;
+			for (GLuint v : candidates) {
+				if (liveTriangles[v] == 0) {
+					continue;
+				}
+				long priority = 0;
+				if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize) {
+					priority = time - cacheTime[v];
+				}
+				if (priority > bestPriority) {
+					bestPriority = priority;
+					next = v;
+				}
+			}
+
+			if (next == -1) {
+				// Dead end: back up to a recently used vertex, or scan forward in input order
+				while (!deadEnds.empty()) {
+					GLuint v = deadEnds.back();
+					deadEnds.pop_back();
+					if (liveTriangles[v] > 0) {
+						next = v;
+						break;
+					}
+				}
+				while (next == -1 && cursor < vertexCount) {
+					if (liveTriangles[cursor] > 0) {
+						next = (long)cursor;
+					}
+					cursor++;
+				}
+
+				if (next != -1 && time - cacheTime[next] > cacheSize) {
+					hardBoundaries.push_back(output.size() / 3);
+				}
+			}
+
+			fanning = next;
+		}
+
+		return output;
+	}
+
+	void MeshOptimizer::OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+										 const std::vector<size_t>& hardBoundaries) {
+
+		size_t triangleCount = indices.size() / 3;
+		float meshAcmr = AnalyzeVertexCache(indices, vertices.size()).acmr;
+
+		// Cut the hard clusters further wherever the cache would not suffer from it
+		std::vector<size_t> clusterStarts;
+		CacheSimulator cache(vertices.size());
+		size_t nextHard = 0;
+		size_t clusterMisses = 0;
+		size_t clusterTriangles = 0;
+
+		for (size_t t = 0; t < triangleCount; t++) {
+
+			bool hardStart = t == 0 || (nextHard < hardBoundaries.size() && hardBoundaries[nextHard] == t);
+			bool softStart = clusterTriangles > 0 && (float)clusterMisses / (float)clusterTriangles <= meshAcmr * OVERDRAW_THRESHOLD;
+
+			if (hardStart || softStart) {
+				if (hardStart && t != 0) {
+					nextHard++;
+				}
+				clusterStarts.push_back(t);
+				cache.Reset();
+				clusterMisses = 0;
+				clusterTriangles = 0;
+			}
+
+			for (int corner = 0; corner < 3; corner++) {
+				if (!cache.Access(indices[3 * t + corner])) {
+					clusterMisses++;
+				}
+			}
+			clusterTriangles++;
+		}
+		clusterStarts.push_back(triangleCount);
+
+		// Area-weighted centroid and normal of every cluster and of the mesh
+		size_t clusterCount = clusterStarts.size() - 1;
+		std::vector<glm::vec3> clusterCentroids(clusterCount, glm::vec3(0.0f));
+		std::vector<glm::vec3> clusterNormals(clusterCount, glm::vec3(0.0f));
+		glm::vec3 meshCentroid(0.0f);
+		float meshArea = 0.0f;
+
+		for (size_t c = 0; c < clusterCount; c++) {
+
+			float clusterArea = 0.0f;
+			for (size_t t = clusterStarts[c]; t < clusterStarts[c + 1]; t++) {
+
+				const glm::vec3& a = vertices[indices[3 * t + 0]].Position;
+				const glm::vec3& b = vertices[indices[3 * t + 1]].Position;
+				const glm::vec3& p = vertices[indices[3 * t + 2]].Position;
+
+				glm::vec3 normal = glm::cross(b - a, p - a);
+				float area = glm::length(normal);
+				glm::vec3 centroid = (a + b + p) / 3.0f;
+
+				clusterCentroids[c] += centroid * area;
+				clusterNormals[c] += normal;
+				clusterArea += area;
+			}
+
+			meshCentroid += clusterCentroids[c];
+			meshArea += clusterArea;
+			if (clusterArea > 0.0f) {
+				clusterCentroids[c] /= clusterArea;
+			}
+		}
+		if (meshArea > 0.0f) {
+			meshCentroid /= meshArea;
+		}
+
+		// Clusters far out along their own normal are likely occluders, draw them first
+		std::vector<float> sortKeys(clusterCount, 0.0f);
+		for (size_t c = 0; c < clusterCount; c++) {
+			float length = glm::length(clusterNormals[c]);
+			if (length > 0.0f) {
+				sortKeys[c] = glm::dot(clusterCentroids[c] - meshCentroid, clusterNormals[c] / length);
+			}
+		}
+
+		std::vector<size_t> order(clusterCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+		std::vector<GLuint> sorted;
+		sorted.reserve(indices.size());
+		for (size_t c : order) {
+			sorted.insert(sorted.end(), indices.begin() + 3 * clusterStarts[c], indices.begin() + 3 * clusterStarts[c + 1]);
+		}
+		indices.swap(sorted);
+	}
+
+	void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+
+		std::vector<GLuint> remap(vertices.size(), UINT_MAX);
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertices.size());
+
+		for (GLuint& index : indices) {
+			if (remap[index] == UINT_MAX) {
+				remap[index] = (GLuint)reordered.size();
+				reordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+
+		// Vertices no face refers to are dropped
+		vertices.swap(reordered);
+	}
+}
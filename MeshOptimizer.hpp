@@ -0,0 +1,48 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+	// Post-transform vertex cache efficiency of an index buffer
+	struct VertexCacheStats {
+		// Average cache misses per triangle (0.5 is ideal on large meshes, 3 is worst)
+		float acmr;
+		// Average shader invocations per referenced vertex (1 is ideal)
+		float atvr;
+	};
+
+	// Load-time triangle and vertex reordering, following "Fast Triangle Reordering for
+	// Vertex Locality and Reduced Overdraw" (Sander, Nehab, Barczak 2007)
+	class MeshOptimizer {
+
+	public:
+		// FIFO post-transform cache size the reordering targets and the statistics simulate
+		static const int CACHE_SIZE = 16;
+
+		// Runs all passes: vertex cache order, overdraw cluster order, then vertex fetch order
+		static void Optimize(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+		// Vertex cache and overdraw order only, for index lists that share an already ordered vertex buffer
+		static void OptimizeTriangleOrder(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+		static VertexCacheStats AnalyzeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount);
+
+	private:
+		// Tipsify; fills the triangle positions where the fan had to restart outside the cache
+		static std::vector<GLuint> OptimizeVertexCache(const std::vector<GLuint>& indices, size_t vertexCount,
+													   std::vector<size_t>& hardBoundaries);
+
+		// Splits the Tipsify output into clusters and sorts them so outward-facing ones draw first
+		static void OptimizeOverdraw(std::vector<GLuint>& indices, const std::vector<Vertex>& vertices,
+									 const std::vector<size_t>& hardBoundaries);
+
+		// Renumbers vertices in order of first use so fetches walk the vertex buffer sequentially
+		static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+	};
+}
+
+#endif /* MeshOptimizer_hpp */
@@ -0,0 +1,329 @@
+#include "MeshSimplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <unordered_map>
+
+namespace gps {
+
+	namespace {
+
+		// A level must keep at most this share of the previous level's triangles to be worth a draw range
+		const float MAX_LOD_RATIO = 0.8f;
+		const int MAX_PASSES = 32;
+		// Collapses may turn a surviving triangle's normal by at most ~75 degrees
+		const float MIN_NORMAL_COSINE = 0.25f;
+
+		// Symmetric 4x4 plane quadric, weighted by triangle area
+		struct Quadric {
+			double a00, a01, a02, a03;
+			double a11, a12, a13;
+			double a22, a23;
+			double a33;
+			double weight;
+
+			static Quadric FromPlane(double a, double b, double c, double d, double w) {
+
+				Quadric q;
+				q.a00 = w * a * a; q.a01 = w * a * b; q.a02 = w * a * c; q.a03 = w * a * d;
+				q.a11 = w * b * b; q.a12 = w * b * c; q.a13 = w * b * d;
+				q.a22 = w * c * c; q.a23 = w * c * d;
+				q.a33 = w * d * d;
+				q.weight = w;
+				return q;
+			}
+
+			void Add(const Quadric& other) {
+
+				a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+				a11 += other.a11; a12 += other.a12; a13 += other.a13;
+				a22 += other.a22; a23 += other.a23;
+				a33 += other.a33;
+				weight += other.weight;
+			}
+
+			// Mean squared distance of a point to the accumulated planes
+			double Error(const glm::vec3& p) const {
+
+				double x = p.x, y = p.y, z = p.z;
+				double error = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+							 + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+							 + a22 * z * z + 2 * a23 * z
+							 + a33;
+				return weight > 0.0 ? std::fabs(error) / weight : 0.0;
+			}
+		};
+
+		struct Collapse {
+			double cost;
+			GLuint from;
+			GLuint to;
+		};
+
+		struct PositionKey {
+			uint32_t bits[3];
+
+			bool operator==(const PositionKey& other) const {
+
+				return std::memcmp(bits, other.bits, sizeof(bits)) == 0;
+			}
+		};
+
+		struct PositionKeyHash {
+			size_t operator()(const PositionKey& key) const {
+
+				uint64_t hash = 0x9E3779B97F4A7C15ull;
+				for (uint32_t word : key.bits) {
+					hash ^= word;
+					hash *= 0xFF51AFD7ED558CCDull;
+					hash ^= hash >> 32;
+				}
+				return (size_t)hash;
+			}
+		};
+
+		// Locks the vertices a collapse would tear open: attribute seams, open borders and non-manifold edges
+		std::vector<bool> FindLockedVertices(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices) {
+
+			// Vertices sharing a position differ only in normal or texture coordinates
+			std::unordered_map<PositionKey, GLuint, PositionKeyHash> positionIds;
+			std::vector<GLuint> positionOf(vertices.size());
+			std::vector<unsigned> wedgeCount;
+
+			for (size_t v = 0; v < vertices.size(); v++) {
+
+				PositionKey key;
+				std::memcpy(key.bits, &vertices[v].Position, sizeof(key.bits));
+
+				auto inserted = positionIds.emplace(key, (GLuint)wedgeCount.size());
+				if (inserted.second) {
+					wedgeCount.push_back(0);
+				}
+				positionOf[v] = inserted.first->second;
+				wedgeCount[positionOf[v]]++;
+			}
+
+			// Every interior edge is shared by exactly two triangles once seams are stitched by position
+			std::unordered_map<uint64_t, unsigned> edgeUse;
+			for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+				for (int e = 0; e < 3; e++) {
+					GLuint a = positionOf[indices[i + e]];
+					GLuint b = positionOf[indices[i + (e + 1) % 3]];
+					edgeUse[((uint64_t)std::min(a, b) << 32) | std::max(a, b)]++;
+				}
+			}
+
+			std::vector<bool> lockedPosition(wedgeCount.size(), false);
+			for (const auto& edge : edgeUse) {
+				if (edge.second != 2) {
+					lockedPosition[(GLuint)(edge.first >> 32)] = true;
+					lockedPosition[(GLuint)(edge.first & 0xFFFFFFFFu)] = true;
+				}
+			}
+
+			std::vector<bool> locked(vertices.size());
+			for (size_t v = 0; v < vertices.size(); v++) {
+				locked[v] = wedgeCount[positionOf[v]] > 1 || lockedPosition[positionOf[v]];
+			}
+			return locked;
+		}
+
+		// Vertex -> triangle lists in compressed rows
+		void BuildAdjacency(const std::vector<GLuint>& indices, size_t vertexCount,
+							std::vector<unsigned>& offsets, std::vector<unsigned>& triangles) {
+
+			offsets.assign(vertexCount + 1, 0);
+			for (GLuint index : indices) {
+				offsets[index + 1]++;
+			}
+			std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+
+			triangles.resize(indices.size());
+			std::vector<unsigned> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++) {
+				triangles[fill[indices[i]]++] = (unsigned)(i / 3);
+			}
+		}
+
+		// Rejects collapses that would flip or sharply turn a surviving triangle, counts the triangles that vanish
+		bool CheckCollapse(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+						   const std::vector<unsigned>& offsets, const std::vector<unsigned>& triangles,
+						   GLuint from, GLuint to, size_t* removed) {
+
+			*removed = 0;
+			for (unsigned k = offsets[from]; k < offsets[from + 1]; k++) {
+
+				const GLuint* corners = &indices[3 * triangles[k]];
+				if (corners[0] == to || corners[1] == to || corners[2] == to) {
+					(*removed)++;
+					continue;
+				}
+
+				glm::vec3 before[3];
+				glm::vec3 after[3];
+				for (int c = 0; c < 3; c++) {
+					before[c] = vertices[corners[c]].Position;
+					after[c] = corners[c] == from ? vertices[to].Position : before[c];
+				}
+
+				glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+				glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+				// Also refuses steep turns so a triangle cannot flip over several passes
+				if (glm::dot(normalBefore, normalAfter) <= MIN_NORMAL_COSINE * glm::length(normalBefore) * glm::length(normalAfter)) {
+					return false;
+				}
+			}
+			return true;
+		}
+	}
+
+	std::vector<MeshLod> MeshSimplifier::BuildLods(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+
+		std::vector<MeshLod> lods;
+		lods.push_back({ 0, (GLsizei)indices.size(), 0.0f });
+
+		std::vector<GLuint> full = indices;
+
+		for (int level = 1; level < MAX_LODS; level++) {
+
+			// Every level starts from the full mesh so its error is measured against the original surface
+			size_t target = ((full.size() / 3) >> level) * 3;
+			float error;
+			std::vector<GLuint> simplified = Simplify(vertices, full, target, &error);
+
+			if (simplified.empty() || (float)simplified.size() > (float)lods.back().indexCount * MAX_LOD_RATIO) {
+				break;
+			}
+
+			lods.push_back({ (GLuint)indices.size(), (GLsizei)simplified.size(), error });
+			indices.insert(indices.end(), simplified.begin(), simplified.end());
+		}
+
+		return lods;
+	}
+
+	std::vector<GLuint> MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+												 size_t targetIndexCount, float* error) {
+
+		*error = 0.0f;
+		std::vector<GLuint> result = indices;
+		size_t vertexCount = vertices.size();
+
+		std::vector<bool> locked = FindLockedVertices(vertices, indices);
+
+		std::vector<Quadric> quadrics(vertexCount, Quadric::FromPlane(0.0, 0.0, 0.0, 0.0, 0.0));
+		for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+
+			const glm::vec3& p0 = vertices[indices[i + 0]].Position;
+			const glm::vec3& p1 = vertices[indices[i + 1]].Position;
+			const glm::vec3& p2 = vertices[indices[i + 2]].Position;
+
+			glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+			float length = glm::length(normal);
+			if (length == 0.0f) {
+				continue;
+			}
+			normal /= length;
+
+			Quadric plane = Quadric::FromPlane(normal.x, normal.y, normal.z, -glm::dot(normal, p0), 0.5 * length);
+			for (int c = 0; c < 3; c++) {
+				quadrics[indices[i + c]].Add(plane);
+			}
+		}
+
+		std::vector<Collapse> collapses;
+		std::vector<unsigned> offsets;
+		std::vector<unsigned> triangles;
+		std::vector<GLuint> remap(vertexCount);
+		std::vector<bool> touched(vertexCount);
+		double maxError = 0.0;
+
+		for (int pass = 0; pass < MAX_PASSES && result.size() > targetIndexCount; pass++) {
+
+			size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+
+			// Each edge may collapse either way, onto the endpoint that stays
+			collapses.clear();
+			for (size_t i = 0; i < result.size(); i += 3) {
+				for (int e = 0; e < 3; e++) {
+
+					GLuint a = result[i + e];
+					GLuint b = result[i + (e + 1) % 3];
+
+					Quadric merged = quadrics[a];
+					merged.Add(quadrics[b]);
+
+					if (!locked[a]) {
+						collapses.push_back({ merged.Error(vertices[b].Position), a, b });
+					}
+					if (!locked[b]) {
+						collapses.push_back({ merged.Error(vertices[a].Position), b, a });
+					}
+				}
+			}
+
+			if (collapses.empty()) {
+				break;
+			}
+
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+			BuildAdjacency(result, vertexCount, offsets, triangles);
+			std::iota(remap.begin(), remap.end(), 0);
+			std::fill(touched.begin(), touched.end(), false);
+
+			// Cheapest collapses first; a collapse freezes its neighbourhood until the next pass
+			size_t removed = 0;
+			for (const Collapse& collapse : collapses) {
+
+				if (removed >= trianglesToRemove) {
+					break;
+				}
+				if (touched[collapse.from] || touched[collapse.to]) {
+					continue;
+				}
+
+				size_t collapseRemoved;
+				if (!CheckCollapse(vertices, result, offsets, triangles, collapse.from, collapse.to, &collapseRemoved)) {
+					continue;
+				}
+
+				for (unsigned k = offsets[collapse.from]; k < offsets[collapse.from + 1]; k++) {
+					for (int c = 0; c < 3; c++) {
+						touched[result[3 * triangles[k] + c]] = true;
+					}
+				}
+
+				remap[collapse.from] = collapse.to;
+				quadrics[collapse.to].Add(quadrics[collapse.from]);
+				maxError = std::max(maxError, collapse.cost);
+				removed += collapseRemoved;
+			}
+
+			if (removed == 0) {
+				break;
+			}
+
+			// Apply the collapses and drop the triangles that degenerated
+			size_t write = 0;
+			for (size_t i = 0; i < result.size(); i += 3) {
+
+				GLuint a = remap[result[i + 0]];
+				GLuint b = remap[result[i + 1]];
+				GLuint c = remap[result[i + 2]];
+				if (a == b || b == c || a == c) {
+					continue;
+				}
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+			result.resize(write);
+		}
+
+		*error = (float)std::sqrt(maxError);
+		return result;
+	}
+}
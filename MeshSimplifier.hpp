@@ -0,0 +1,29 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+	// Quadric error edge collapse ("Surface Simplification Using Quadric Error Metrics",
+	// Garland and Heckbert 1997). Vertices only ever collapse onto existing vertices, so every
+	// level of detail indexes the same vertex buffer.
+	class MeshSimplifier {
+
+	public:
+		static const int MAX_LODS = 4;
+
+		// Appends coarser levels to indices, which must hold only the full level, and returns
+		// the level table (full level first). Stops early once a level no longer pays off.
+		static std::vector<MeshLod> BuildLods(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+		// Collapses edges until at most targetIndexCount indices remain or nothing more can be
+		// collapsed. error receives the largest distance a collapse moved the surface by.
+		static std::vector<GLuint> Simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+											size_t targetIndexCount, float* error);
+	};
+}
+
+#endif /* MeshSimplifier_hpp */
@@ -0,0 +1,275 @@
+#include "MipGenerator.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+	#define MIP_GENERATOR_X86 1
+	#include <immintrin.h>
+#else
+	#define MIP_GENERATOR_X86 0
+#endif
+
+namespace gps {
+
+	namespace {
+
+		// Linear values are rounded to this many steps before the sRGB lookup, fine enough that the
+		// steep start of the curve stays below a quarter of an 8-bit step
+		const int ENCODE_STEPS = 16384;
+
+		struct Tables {
+			// [channel * 256 + byte] -> linear value; alpha is always linear
+			float srgbDecode[4 * 256];
+			float linearDecode[4 * 256];
+			unsigned char srgbEncode[ENCODE_STEPS];
+
+			Tables() {
+
+				for (int value = 0; value < 256; value++) {
+
+					float normalized = value / 255.0f;
+					float linear = normalized <= 0.04045f ? normalized / 12.92f : std::pow((normalized + 0.055f) / 1.055f, 2.4f);
+					for (int channel = 0; channel < 4; channel++) {
+						srgbDecode[channel * 256 + value] = channel < 3 ? linear : normalized;
+						linearDecode[channel * 256 + value] = normalized;
+					}
+				}
+
+				for (int step = 0; step < ENCODE_STEPS; step++) {
+
+					float linear = step / (float)(ENCODE_STEPS - 1);
+					float encoded = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+					srgbEncode[step] = (unsigned char)std::clamp((int)(encoded * 255.0f + 0.5f), 0, 255);
+				}
+			}
+		};
+
+		const Tables& GetTables() {
+
+			static const Tables tables;
+			return tables;
+		}
+
+		// Averages 2x2 texel footprints of two source rows into linear RGBA floats. The source row
+		// holds at least 2 * outWidth texels; table maps each channel's bytes to linear values.
+		// Every kernel sums a footprint as (top left + bottom left) + (top right + bottom right), the
+		// order the AVX2 lanes fall in, so all of them produce the same bytes.
+		using FilterRowFunction = void (*)(const unsigned char* top, const unsigned char* bottom,
+										   const float* table, float* out, int outWidth);
+
+		void FilterRowScalar(const unsigned char* top, const unsigned char* bottom,
+							 const float* table, float* out, int outWidth) {
+
+			for (int x = 0; x < outWidth; x++) {
+				for (int k = 0; k < 4; k++) {
+					const float* channel = table + k * 256;
+					out[x * 4 + k] = ((channel[top[x * 8 + k]] + channel[bottom[x * 8 + k]]) +
+									  (channel[top[x * 8 + 4 + k]] + channel[bottom[x * 8 + 4 + k]])) * 0.25f;
+				}
+			}
+		}
+
+#if MIP_GENERATOR_X86
+		inline __m128 DecodeTexel(const unsigned char* texel, const float* table) {
+
+			return _mm_setr_ps(table[texel[0]], table[256 + texel[1]], table[512 + texel[2]], table[768 + texel[3]]);
+		}
+
+		void FilterRowSse2(const unsigned char* top, const unsigned char* bottom,
+						   const float* table, float* out, int outWidth) {
+
+			const __m128 quarter = _mm_set1_ps(0.25f);
+
+			for (int x = 0; x < outWidth; x++) {
+				__m128 sum = _mm_add_ps(_mm_add_ps(DecodeTexel(top + x * 8, table), DecodeTexel(bottom + x * 8, table)),
+										_mm_add_ps(DecodeTexel(top + x * 8 + 4, table), DecodeTexel(bottom + x * 8 + 4, table)));
+				_mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, quarter));
+			}
+		}
+
+		// Two texels' channels looked up with one gather
+		__attribute__((target("avx2")))
+		inline __m256 DecodeTexelPair(const unsigned char* texels, const float* table) {
+
+			const __m256i channelOffsets = _mm256_setr_epi32(0, 256, 512, 768, 0, 256, 512, 768);
+			__m256i indices = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(texels)));
+			return _mm256_i32gather_ps(table, _mm256_add_epi32(indices, channelOffsets), 4);
+		}
+
+		__attribute__((target("avx2")))
+		void FilterRowAvx2(const unsigned char* top, const unsigned char* bottom,
+						   const float* table, float* out, int outWidth) {
+
+			const __m256 quarter = _mm256_set1_ps(0.25f);
+
+			int x = 0;
+			for (; x + 2 <= outWidth; x += 2) {
+
+				// Source texels 2x .. 2x + 3, two per register
+				__m256 first = _mm256_add_ps(DecodeTexelPair(top + x * 8, table), DecodeTexelPair(bottom + x * 8, table));
+				__m256 second = _mm256_add_ps(DecodeTexelPair(top + x * 8 + 8, table), DecodeTexelPair(bottom + x * 8 + 8, table));
+				// Left and right column of both footprints
+				__m256 left = _mm256_permute2f128_ps(first, second, 0x20);
+				__m256 right = _mm256_permute2f128_ps(first, second, 0x31);
+				_mm256_storeu_ps(out + x * 4, _mm256_mul_ps(_mm256_add_ps(left, right), quarter));
+			}
+			if (x < outWidth) {
+				FilterRowScalar(top + x * 8, bottom + x * 8, table, out + x * 4, outWidth - x);
+			}
+		}
+#endif
+
+		struct Kernel {
+			FilterRowFunction filterRow;
+			const char* name;
+		};
+
+		const Kernel& GetKernel() {
+
+			static const Kernel kernel = [] {
+#if MIP_GENERATOR_X86
+				__builtin_cpu_init();
+				if (__builtin_cpu_supports("avx2")) {
+					return Kernel{ FilterRowAvx2, "AVX2" };
+				}
+				return Kernel{ FilterRowSse2, "SSE2" };
+#else
+				return Kernel{ FilterRowScalar, "scalar" };
+#endif
+			}();
+			return kernel;
+		}
+
+		void EncodeRow(const float* linear, unsigned char* out, int width, bool srgb) {
+
+			const Tables& tables = GetTables();
+
+			for (int i = 0; i < width * 4; i++) {
+				float value = std::clamp(linear[i], 0.0f, 1.0f);
+				if (srgb && (i & 3) != 3) {
+					out[i] = tables.srgbEncode[(int)(value * (ENCODE_STEPS - 1) + 0.5f)];
+				} else {
+					out[i] = (unsigned char)(value * 255.0f + 0.5f);
+				}
+			}
+		}
+	}
+
+	int MipGenerator::LevelCount(int width, int height) {
+
+		int levelCount = 1;
+		while (width > 1 || height > 1) {
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+			levelCount++;
+		}
+		return levelCount;
+	}
+
+	size_t MipGenerator::ChainBytes(int width, int height, int levelCount) {
+
+		size_t bytes = 0;
+		for (int level = 0; level < levelCount; level++) {
+			bytes += (size_t)width * height * 4;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		return bytes;
+	}
+
+	int MipGenerator::Generate(std::vector<unsigned char>& chain, int width, int height, bool srgb) {
+
+		int levelCount = LevelCount(width, height);
+		chain.resize(ChainBytes(width, height, levelCount));
+
+		size_t offset = 0;
+		for (int level = 1; level < levelCount; level++) {
+
+			size_t next = offset + (size_t)width * height * 4;
+			Downsample(chain.data() + offset, width, height, chain.data() + next, srgb);
+			offset = next;
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		return levelCount;
+	}
+
+	void MipGenerator::Downsample(const unsigned char* pixels, int width, int height, unsigned char* out, bool srgb) {
+
+		const Tables& tables = GetTables();
+		const float* table = srgb ? tables.srgbDecode : tables.linearDecode;
+		FilterRowFunction filterRow = GetKernel().filterRow;
+
+		int outWidth = std::max(1, width / 2);
+		int outHeight = std::max(1, height / 2);
+		std::vector<float> row((size_t)outWidth * 4);
+
+		for (int y = 0; y < outHeight; y++) {
+
+			// A single row or column is filtered against itself
+			const unsigned char* top = pixels + (size_t)std::min(2 * y, height - 1) * width * 4;
+			const unsigned char* bottom = pixels + (size_t)std::min(2 * y + 1, height - 1) * width * 4;
+
+			if (width == 1) {
+				for (int k = 0; k < 4; k++) {
+					row[k] = (table[k * 256 + top[k]] + table[k * 256 + bottom[k]]) * 0.5f;
+				}
+			} else {
+				filterRow(top, bottom, table, row.data(), outWidth);
+			}
+			EncodeRow(row.data(), out + (size_t)y * outWidth * 4, outWidth, srgb);
+		}
+	}
+
+	void MipGenerator::Resize(const unsigned char* pixels, int width, int height, unsigned char* out,
+							  int outWidth, int outHeight, bool srgb) {
+
+		const Tables& tables = GetTables();
+		const float* table = srgb ? tables.srgbDecode : tables.linearDecode;
+
+		// Calls visit(texel, weight) for the source texels under [start, end), edge texels weighted by their overlap
+		auto forSpan = [](float start, float end, auto visit) {
+			for (int i = (int)start; (float)i < end; i++) {
+				visit(i, std::min(end, i + 1.0f) - std::max(start, (float)i));
+			}
+		};
+
+		float scaleX = (float)width / outWidth;
+		float scaleY = (float)height / outHeight;
+		std::vector<float> column((size_t)width * 4);
+		std::vector<float> row((size_t)outWidth * 4);
+
+		for (int y = 0; y < outHeight; y++) {
+
+			// The source rows under this output row, summed in linear space
+			std::fill(column.begin(), column.end(), 0.0f);
+			forSpan(y * scaleY, (y + 1) * scaleY, [&](int sourceY, float weight) {
+				const unsigned char* source = pixels + (size_t)std::min(sourceY, height - 1) * width * 4;
+				for (int i = 0; i < width * 4; i++) {
+					column[i] += table[(i & 3) * 256 + source[i]] * weight;
+				}
+			});
+
+			float area = scaleX * scaleY;
+			for (int x = 0; x < outWidth; x++) {
+				float sum[4] = {};
+				forSpan(x * scaleX, (x + 1) * scaleX, [&](int sourceX, float weight) {
+					const float* texel = column.data() + (size_t)std::min(sourceX, width - 1) * 4;
+					for (int k = 0; k < 4; k++) {
+						sum[k] += texel[k] * weight;
+					}
+				});
+				for (int k = 0; k < 4; k++) {
+					row[x * 4 + k] = sum[k] / area;
+				}
+			}
+			EncodeRow(row.data(), out + (size_t)y * outWidth * 4, outWidth, srgb);
+		}
+	}
+
+	const char* MipGenerator::GetKernelName() {
+
+		return GetKernel().name;
+	}
+}
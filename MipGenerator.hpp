@@ -0,0 +1,38 @@
+#ifndef MipGenerator_hpp
+#define MipGenerator_hpp
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+	// CPU mipmap generation for RGBA8 images, used by the texture loader workers and the BCn encoder.
+	// Each level is a 2x2 box filter of the one above; sRGB colour is filtered in linear space.
+	// The filter runs AVX2 or SSE2 kernels when the CPU has them, and portable scalar code otherwise.
+	class MipGenerator {
+
+	public:
+		// Levels down to 1x1
+		static int LevelCount(int width, int height);
+
+		// Size of the first levelCount levels of an RGBA8 chain
+		static size_t ChainBytes(int width, int height, int levelCount);
+
+		// Extends a buffer holding level 0 into the full chain, levels back to back largest first.
+		// Returns the level count.
+		static int Generate(std::vector<unsigned char>& chain, int width, int height, bool srgb);
+
+		// Writes the half-size level (max(1, width / 2) x max(1, height / 2)) of an RGBA8 image
+		static void Downsample(const unsigned char* pixels, int width, int height, unsigned char* out, bool srgb);
+
+		// Resamples an RGBA8 image to any smaller size: every output texel is the average of the source area
+		// it covers, partly covered texels weighted by the part covered, sRGB colour averaged in linear space
+		static void Resize(const unsigned char* pixels, int width, int height, unsigned char* out,
+						   int outWidth, int outHeight, bool srgb);
+
+		// Name of the filter kernel the CPU runs, for logs
+		static const char* GetKernelName();
+	};
+}
+
+#endif /* MipGenerator_hpp */
@@ -1,23 +1,603 @@
 #include "Model3D.hpp"
+#include "AssetPack.hpp"
+#include "ClusterBuilder.hpp"
+#include "GLState.hpp"
+#include "MeshOptimizer.hpp"
+#include "MeshSimplifier.hpp"
+#include "ObjParser.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <unordered_map>
 
 namespace gps {
 
+	namespace {
+
+		// Hashes the raw bits of a vertex so identical (position, normal, texcoord) tuples can be welded
+		struct VertexHash {
+			size_t operator()(const gps::Vertex& vertex) const {
+
+				uint32_t words[sizeof(gps::Vertex) / sizeof(uint32_t)];
+				std::memcpy(words, &vertex, sizeof(words));
+
+				uint64_t hash = 0x9E3779B97F4A7C15ull;
+				for (uint32_t word : words) {
+					hash ^= word;
+					hash *= 0xFF51AFD7ED558CCDull;
+					hash ^= hash >> 32;
+				}
+				return (size_t)hash;
+			}
+		};
+
+		struct VertexEqual {
+			bool operator()(const gps::Vertex& a, const gps::Vertex& b) const {
+
+				return std::memcmp(&a, &b, sizeof(gps::Vertex)) == 0;
+			}
+		};
+
+		void PrintWeldStats(size_t mesh, size_t faceVertices, size_t uniqueVertices) {
+
+			if (uniqueVertices > 0) {
+				std::cout << "  mesh " << mesh << ": " << faceVertices << " face vertices -> " << uniqueVertices
+						  << " unique (" << (float)faceVertices / (float)uniqueVertices << "x reduction)" << std::endl;
+			}
+		}
+
+		void PrintWeldStats(size_t faceVertices, size_t uniqueVertices) {
+
+			if (uniqueVertices > 0) {
+				std::cout << "# of vertices  : " << uniqueVertices << " (welded from " << faceVertices << ", "
+						  << (float)faceVertices / (float)uniqueVertices << "x reduction)" << std::endl;
+			}
+		}
+
+		void PrintVertexCacheStats(size_t mesh, const VertexCacheStats& before, const VertexCacheStats& after) {
+
+			std::cout << "  mesh " << mesh << ": ACMR " << before.acmr << " -> " << after.acmr
+					  << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+		}
+
+		// Draw calls per pass the model used to take, one per shape whatever materials its faces had, against
+		// the meshes it is drawn with now
+		void PrintDrawCalls(size_t shapeCount, size_t mixedShapes, size_t meshCount, bool merged) {
+
+			std::cout << "Draw calls     : " << shapeCount << " (one per shape";
+			if (mixedShapes > 0) {
+				std::cout << ", " << mixedShapes << " of them mixing materials";
+			}
+			std::cout << ") -> " << meshCount << (merged ? " (one per material, spread-out ones per cell)" : " (one per shape and material)") << std::endl;
+		}
+
+		void PrintLodStats(size_t mesh, const std::vector<gps::MeshLod>& lods) {
+
+			std::cout << "  mesh " << mesh << ": LOD triangles";
+			for (const gps::MeshLod& lod : lods) {
+				std::cout << " " << lod.indexCount / 3;
+				if (lod.error > 0.0f) {
+					std::cout << " (error " << lod.error << ")";
+				}
+			}
+			std::cout << std::endl;
+		}
+
+		// Reads a memory field (in kB) from /proc/self/status, 0 where unavailable
+		size_t ReadProcessMemoryKB(const char* field) {
+
+#if defined(__linux__)
+			std::ifstream status("/proc/self/status");
+			std::string line;
+			size_t length = std::strlen(field);
+
+			while (std::getline(status, line)) {
+				if (line.compare(0, length, field) == 0 && line.size() > length && line[length] == ':') {
+					return (size_t)std::strtoull(line.c_str() + length + 1, nullptr, 10);
+				}
+			}
+#endif
+			return 0;
+		}
+
+		// Resets the peak resident set size (VmHWM) so each load gets its own peak
+		void ResetPeakMemory() {
+
+#if defined(__linux__)
+			std::ofstream clearRefs("/proc/self/clear_refs");
+			clearRefs << "5";
+#endif
+		}
+
+		// Merged meshes are confined to cells of a grid with this many cells along the model's diagonal. A mesh
+		// spread over a whole scene has a bounding sphere the camera is nearly always inside, which defeats level
+		// of detail, texture streaming and front-to-back sorting.
+		const float MERGE_GRID_CELLS = 8.0f;
+
+		// Welds the face corners of a shape into one part per material. Without merging the parts are handed out
+		// as meshes when the shape ends; with merging they are kept and joined into one mesh per material once the
+		// whole model is read, in the order the materials were first used.
+		struct MaterialMeshes {
+
+			struct Bucket {
+				int materialId;
+				std::vector<gps::Vertex> vertices;
+				std::vector<GLuint> indices;
+				std::unordered_map<gps::Vertex, GLuint, VertexHash, VertexEqual> uniqueVertices;
+				glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+				glm::vec3 boundsMax = glm::vec3(-std::numeric_limits<float>::max());
+			};
+
+			struct KeyHash {
+				size_t operator()(const std::pair<int, glm::ivec3>& key) const {
+
+					uint64_t hash = (uint32_t)key.first;
+					for (int i = 0; i < 3; i++) {
+						hash = (hash ^ (uint32_t)key.second[i]) * 0x100000001B3ull;
+					}
+					return (size_t)(hash ^ (hash >> 29));
+				}
+			};
+
+			// Parts of the current shape
+			std::vector<Bucket> buckets;
+			std::unordered_map<int, size_t> bucketIndices;
+			// Consecutive faces mostly share a material
+			size_t lastBucket = 0;
+			// Parts of finished shapes waiting to be merged
+			std::vector<Bucket> parts;
+
+			Bucket& Get(int materialId) {
+
+				if (lastBucket < buckets.size() && buckets[lastBucket].materialId == materialId) {
+					return buckets[lastBucket];
+				}
+				auto found = bucketIndices.emplace(materialId, buckets.size());
+				if (found.second) {
+					buckets.push_back(Bucket{ materialId });
+				}
+				lastBucket = found.first->second;
+				return buckets[lastBucket];
+			}
+
+			static void AddCorner(Bucket& bucket, const gps::Vertex& vertex) {
+
+				auto welded = bucket.uniqueVertices.emplace(vertex, (GLuint)bucket.vertices.size());
+				if (welded.second) {
+					bucket.vertices.push_back(vertex);
+					bucket.boundsMin = glm::min(bucket.boundsMin, vertex.Position);
+					bucket.boundsMax = glm::max(bucket.boundsMax, vertex.Position);
+				}
+				bucket.indices.push_back(welded.first->second);
+			}
+
+			// Ends the current shape: hands its parts to onMesh(vertices, indices, materialId), the vectors may be
+			// moved from, or keeps them for Merge
+			template <typename OnMesh>
+			void FinishShape(bool merge, OnMesh&& onMesh) {
+
+				for (Bucket& bucket : buckets) {
+					if (bucket.indices.empty()) {
+						continue;
+					}
+					if (merge) {
+						bucket.uniqueVertices = {};
+						parts.push_back(std::move(bucket));
+					} else {
+						onMesh(bucket.vertices, bucket.indices, bucket.materialId);
+					}
+				}
+				buckets.clear();
+				bucketIndices.clear();
+				lastBucket = 0;
+			}
+
+			// Joins the kept parts into one mesh per material and hands them to onMesh. A material whose parts
+			// spread over more than one grid cell is split by the cell of each part's centre. Parts are never cut,
+			// so merging never gives more meshes than keeping the shapes apart, and adds no seams.
+			template <typename OnMesh>
+			void Merge(OnMesh&& onMesh) {
+
+				glm::vec3 modelMin = glm::vec3(std::numeric_limits<float>::max());
+				glm::vec3 modelMax = glm::vec3(-std::numeric_limits<float>::max());
+				std::unordered_map<int, std::pair<glm::vec3, glm::vec3>> materialBounds;
+				for (const Bucket& part : parts) {
+					modelMin = glm::min(modelMin, part.boundsMin);
+					modelMax = glm::max(modelMax, part.boundsMax);
+					auto found = materialBounds.emplace(part.materialId, std::make_pair(part.boundsMin, part.boundsMax));
+					found.first->second.first = glm::min(found.first->second.first, part.boundsMin);
+					found.first->second.second = glm::max(found.first->second.second, part.boundsMax);
+				}
+				float cellSize = glm::length(modelMax - modelMin) / MERGE_GRID_CELLS;
+
+				std::vector<Bucket> merged;
+				std::unordered_map<std::pair<int, glm::ivec3>, size_t, KeyHash> mergedIndices;
+				for (Bucket& part : parts) {
+
+					glm::ivec3 cell(0);
+					const std::pair<glm::vec3, glm::vec3>& bounds = materialBounds[part.materialId];
+					if (glm::length(bounds.second - bounds.first) > cellSize) {
+						cell = glm::ivec3(glm::floor((0.5f * (part.boundsMin + part.boundsMax) - modelMin) / cellSize));
+					}
+
+					auto found = mergedIndices.emplace(std::make_pair(part.materialId, cell), merged.size());
+					if (found.second) {
+						merged.push_back(std::move(part));
+						continue;
+					}
+					Bucket& mesh = merged[found.first->second];
+					GLuint base = (GLuint)mesh.vertices.size();
+					mesh.vertices.insert(mesh.vertices.end(), part.vertices.begin(), part.vertices.end());
+					for (GLuint index : part.indices) {
+						mesh.indices.push_back(base + index);
+					}
+					part = Bucket{};
+				}
+				parts.clear();
+
+				for (Bucket& mesh : merged) {
+					onMesh(mesh.vertices, mesh.indices, mesh.materialId);
+				}
+			}
+		};
+
+		// Receives tinyobj's streaming callbacks and welds every face corner into the mesh of its
+		// material right away. Only the raw v/vn/vt arrays live for the whole file.
+		struct StreamingObjBuilder {
+
+			std::vector<float> positions;
+			std::vector<float> normals;
+			std::vector<float> texcoords;
+			std::vector<tinyobj::material_t> materials;
+			int currentMaterial = -1;
+
+			// Parts of the current shape, one per material, and with merging those of the finished shapes
+			MaterialMeshes materialMeshes;
+			bool mergeMaterials = true;
+
+			// Shapes (groups and objects with faces) read so far, and those whose faces use several materials
+			size_t shapeCount = 0;
+			size_t mixedShapes = 0;
+			bool shapeHasFaces = false;
+			int shapeMaterial = -1;
+			bool shapeMixed = false;
+
+			glm::vec3 boundsMin = glm::vec3(std::numeric_limits<float>::max());
+			glm::vec3 boundsMax = glm::vec3(std::numeric_limits<float>::min());
+
+			// Receives each finished mesh, the vectors may be moved from
+			std::function<void(std::vector<gps::Vertex>&, std::vector<GLuint>&, int)> onMesh;
+
+			tinyobj::callback_t GetCallbacks() {
+
+				tinyobj::callback_t callbacks;
+				callbacks.vertex_cb = [](void* user, float x, float y, float z, float) {
+					static_cast<StreamingObjBuilder*>(user)->positions.insert(static_cast<StreamingObjBuilder*>(user)->positions.end(), { x, y, z });
+				};
+				callbacks.normal_cb = [](void* user, float x, float y, float z) {
+					static_cast<StreamingObjBuilder*>(user)->normals.insert(static_cast<StreamingObjBuilder*>(user)->normals.end(), { x, y, z });
+				};
+				callbacks.texcoord_cb = [](void* user, float x, float y, float) {
+					static_cast<StreamingObjBuilder*>(user)->texcoords.insert(static_cast<StreamingObjBuilder*>(user)->texcoords.end(), { x, y });
+				};
+				callbacks.index_cb = [](void* user, tinyobj::index_t* corners, int count) {
+					static_cast<StreamingObjBuilder*>(user)->AddFace(corners, count);
+				};
+				callbacks.usemtl_cb = [](void* user, const char*, int materialId) {
+					static_cast<StreamingObjBuilder*>(user)->currentMaterial = materialId;
+				};
+				callbacks.mtllib_cb = [](void* user, const tinyobj::material_t* materials, int count) {
+					static_cast<StreamingObjBuilder*>(user)->materials.assign(materials, materials + count);
+				};
+				callbacks.group_cb = [](void* user, const char**, int) {
+					static_cast<StreamingObjBuilder*>(user)->FinishShape();
+				};
+				callbacks.object_cb = [](void* user, const char*) {
+					static_cast<StreamingObjBuilder*>(user)->FinishShape();
+				};
+				return callbacks;
+			}
+
+			// Fan-triangulates a face, corners hold raw .obj indices (1-based, negative = relative, 0 = none)
+			void AddFace(const tinyobj::index_t* corners, int count) {
+
+				if (!shapeHasFaces) {
+					shapeHasFaces = true;
+					shapeMaterial = currentMaterial;
+				} else if (currentMaterial != shapeMaterial) {
+					shapeMixed = true;
+				}
+
+				MaterialMeshes::Bucket& bucket = materialMeshes.Get(currentMaterial);
+				for (int k = 2; k < count; k++) {
+					AddCorner(bucket, corners[0]);
+					AddCorner(bucket, corners[k - 1]);
+					AddCorner(bucket, corners[k]);
+				}
+			}
+
+			void AddCorner(MaterialMeshes::Bucket& bucket, const tinyobj::index_t& corner) {
+
+				int v = FixIndex(corner.vertex_index, positions.size() / 3);
+				int vn = FixIndex(corner.normal_index, normals.size() / 3);
+				int vt = FixIndex(corner.texcoord_index, texcoords.size() / 2);
+
+				gps::Vertex currentVertex;
+				currentVertex.Position = glm::vec3(positions[3 * v + 0], positions[3 * v + 1], positions[3 * v + 2]);
+				currentVertex.Normal = vn >= 0 ? glm::vec3(normals[3 * vn + 0], normals[3 * vn + 1], normals[3 * vn + 2]) : glm::vec3(0.0f);
+				currentVertex.TexCoords = vt >= 0 ? glm::vec2(texcoords[2 * vt + 0], texcoords[2 * vt + 1]) : glm::vec2(0.0f);
+
+				//	Compute AABB bounds
+				boundsMin = glm::min(boundsMin, currentVertex.Position);
+				boundsMax = glm::max(boundsMax, currentVertex.Position);
+
+				MaterialMeshes::AddCorner(bucket, currentVertex);
+			}
+
+			void FinishShape() {
+
+				if (shapeHasFaces) {
+					shapeCount++;
+					mixedShapes += shapeMixed ? 1 : 0;
+				}
+				shapeHasFaces = false;
+				shapeMixed = false;
+
+				if (onMesh) {
+					materialMeshes.FinishShape(mergeMaterials, onMesh);
+				}
+			}
+
+			// Hands out the merged meshes once the whole file is read
+			void FinishMeshes() {
+
+				if (onMesh) {
+					materialMeshes.Merge(onMesh);
+				}
+			}
+
+			static int FixIndex(int index, size_t count) {
+
+				if (index > 0) return index - 1;
+				if (index == 0) return -1;
+				return (int)count + index;
+			}
+		};
+	}
+
+	ModelLoadOptions Model3D::loadOptions;
+	DrawStats Model3D::drawStats;
+	MemoryStats Model3D::memoryStats;
+
 	void Model3D::LoadModel(std::string fileName) {
 
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadMeshes(fileName, basePath);
+		AcquireTextures();
+		UploadMeshes();
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)	{
 
-		ReadOBJ(fileName, basePath);
+		LoadMeshes(fileName, basePath);
+		AcquireTextures();
+		UploadMeshes();
+	}
+
+	// Loads the model from its baked mesh cache, parsing the .obj file only when the cache is stale
+	void Model3D::LoadMeshes(std::string fileName, std::string basePath) {
+
+		if (loadOptions.verifyObjParser) {
+			ObjParser::Verify(fileName, basePath);
+		}
+		else if (ReadCache(fileName, basePath)) {
+			return;
+		}
+
+		// VmHWM is process-wide: while earlier models' textures decode on the worker pool their images count too,
+		// so the peak is only the loader's own when no texture was pending. Nothing is uploaded (and freed) until
+		// the next TextureRegistry::Update, so the pending count holds for the whole parse.
+		size_t pendingTextures = TextureRegistry::Get().GetLoader().GetPendingCount();
+		size_t baselineKB = ReadProcessMemoryKB("VmRSS");
+		ResetPeakMemory();
+
+		if (loadOptions.objLoader == ObjLoader::Streaming) {
+			ReadOBJStreaming(fileName, basePath);
+		} else {
+			ReadOBJ(fileName, basePath);
+		}
+
+		size_t peakKB = ReadProcessMemoryKB("VmHWM");
+		if (peakKB > baselineKB) {
+
+			size_t geometryBytes = 0;
+			for (const gps::Mesh& mesh : meshes) {
+				geometryBytes += mesh.vertices.size() * sizeof(gps::Vertex) + mesh.indices.size() * sizeof(GLuint);
+			}
+			if (pendingTextures == 0) {
+				std::cout << "Peak memory    : " << (peakKB - baselineKB) / 1024.0f << " MB above baseline";
+			} else {
+				std::cout << "Process peak   : " << (peakKB - baselineKB) / 1024.0f << " MB above baseline, including "
+						  << pendingTextures << " textures decoding meanwhile";
+			}
+			std::cout << " (final geometry " << geometryBytes / (1024.0f * 1024.0f) << " MB)" << std::endl;
+		}
+
+		if (!MeshCache::Write(fileName, basePath, GetCacheFlags(), meshes, aabb)) {
+			std::cerr << "WARNING: could not write mesh cache for " << fileName << std::endl;
+		}
+	}
+
+	// Builds the meshes straight from a valid mesh cache, returns false if there is none
+	bool Model3D::ReadCache(std::string fileName, std::string basePath) {
+
+		cache = std::make_unique<MeshCache>();
+		if (!cache->Open(fileName, basePath, GetCacheFlags())) {
+			cache.reset();
+			return false;
+		}
+
+        std::cout << "Loading : " << fileName << " (mesh cache)" << std::endl;
+
+		meshes.reserve(cache->GetMeshCount());
+
+		for (size_t m = 0; m < cache->GetMeshCount(); m++) {
+
+			const CachedMesh& cached = cache->GetMesh(m);
+
+			// The mapped vertex and index arrays go straight to glBufferSubData, the cache stays open until then
+			meshes.push_back(gps::Mesh(cached.vertices, cached.vertexCount, cached.indices, cached.indexType, cached.indexCount, cached.textures,
+									   cached.lods, cached.clusters));
+		}
+
+		this->aabb = cache->GetBoundingBox();
+		return true;
+	}
+
+	// Uploads the meshes into the shared buffers and groups them by the arrays they bind
+	void Model3D::UploadMeshes() {
+
+		buffers.Upload(meshes, loadOptions.vertexFormat);
+		CountMemory(buffers);
+		cache.reset();
+
+		for (size_t m = 0; m < meshes.size(); m++) {
+
+			auto group = std::find_if(meshGroups.begin(), meshGroups.end(), [&](const std::vector<size_t>& g) {
+				for (size_t unit = 0; unit < SAMPLED_TEXTURE_COUNT; unit++) {
+					if (meshes[g[0]].getSampledArray(unit) != meshes[m].getSampledArray(unit)) {
+						return false;
+					}
+				}
+				return true;
+			});
+			if (group == meshGroups.end()) {
+				group = meshGroups.insert(meshGroups.end(), std::vector<size_t>());
+			}
+			group->push_back(m);
+		}
+		std::cout << "Batched draws  : " << meshes.size() << " meshes -> " << meshGroups.size()
+				  << " draws per pass (one per set of texture arrays), 1 per depth pass" << std::endl;
+	}
+
+	// Draw each mesh from the model at full detail, one call per set of meshes binding the same arrays
+	void Model3D::Draw(gps::Shader& shaderProgram) {
+
+		DrawRanges ranges;
+		DrawStats stats;
+		for (const std::vector<size_t>& group : meshGroups) {
+
+			ranges.clear();
+			for (size_t m : group) {
+				meshes[m].CollectRanges(0, nullptr, stats, ranges);
+			}
+			meshes[group[0]].BindTextures(shaderProgram);
+			buffers.Draw(shaderProgram, ranges);
+		}
 	}
 
-	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram) {
+	void Model3D::Queue(RenderQueue& queue, RenderPass pass, uint32_t program, uint32_t object, const DrawView& drawView) {
+
+		// Depth passes bind no textures, so the whole model is one draw there and only sorts by distance
+		bool depthPass = pass == RenderPass::Shadow;
+
+		DrawPacket packet;
+		packet.buffers = &buffers;
+		packet.program = program;
+		packet.object = object;
+		packet.firstPart = queue.GetPartCount();
+		float nearest = std::numeric_limits<float>::max();
+
+		for (const std::vector<size_t>& group : meshGroups) {
+
+			for (size_t m : group) {
+
+				const gps::Mesh& mesh = meshes[m];
+				size_t level = SelectLod(mesh, drawView);
+				drawStats.fullTriangles += mesh.getLod(0).indexCount / 3;
+
+				// (z + w) in clip space grows with distance for perspective and orthographic passes alike
+				BoundingBox bounds = mesh.getBounds();
+				glm::vec4 center = drawView.modelClip * glm::vec4((bounds.min + bounds.max) * 0.5f, 1.0f);
+				nearest = std::min(nearest, center.z + center.w);
+
+				// Texture streaming sizes the resident mip levels from the same projection
+				if (!depthPass) {
+					float projectedSize = ProjectedSize(mesh, drawView);
+					for (const gps::Texture& texture : mesh.textures) {
+						TextureRegistry::Get().RequestDetail(texture.id, projectedSize);
+					}
+				}
 
-		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+				queue.AddPart(mesh, level);
+			}
+
+			// A set of meshes is drawn at the depth of its nearest one
+			if (!depthPass) {
+				packet.partCount = queue.GetPartCount() - packet.firstPart;
+				queue.Push(RenderQueue::MakeKey(pass, program, queue.MaterialId(meshes[group[0]]), nearest), packet);
+				packet.firstPart = queue.GetPartCount();
+				nearest = std::numeric_limits<float>::max();
+			}
+		}
+
+		if (depthPass && !meshGroups.empty()) {
+			packet.partCount = queue.GetPartCount() - packet.firstPart;
+			queue.Push(RenderQueue::MakeKey(pass, program, 0, nearest), packet);
+		}
+	}
+
+	// Pixels the diameter of a mesh's bounding sphere covers on screen, at the sphere's nearest point
+	float Model3D::ProjectedSize(const gps::Mesh& mesh, const DrawView& drawView) {
+
+		// The view is rigid, so the model-view scale is the model's own
+		float scale = std::max(glm::length(glm::vec3(drawView.modelView[0])),
+							   std::max(glm::length(glm::vec3(drawView.modelView[1])), glm::length(glm::vec3(drawView.modelView[2]))));
+
+		BoundingBox bounds = mesh.getBounds();
+		glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+		float diameter = glm::length(bounds.max - bounds.min) * scale;
+
+		// Meshes the camera is inside cover the whole screen
+		float distance = -(drawView.modelView * glm::vec4(center, 1.0f)).z - diameter * 0.5f;
+		if (distance <= 0.0f) {
+			return std::numeric_limits<float>::max();
+		}
+		return diameter / distance * drawView.pixelsPerUnit;
+	}
+
+	// Coarsest level whose simplification error projects to at most maxPixelError pixels
+	size_t Model3D::SelectLod(const gps::Mesh& mesh, const DrawView& drawView) {
+
+		BoundingBox bounds = mesh.getBounds();
+		float diameter = glm::length(bounds.max - bounds.min);
+		float projectedSize = ProjectedSize(mesh, drawView);
+
+		// Meshes the camera is inside stay at full detail
+		size_t level = 0;
+		if (projectedSize < std::numeric_limits<float>::max() && diameter > 0.0f) {
+
+			float pixelsPerModelUnit = projectedSize / diameter;
+
+			while (level + 1 < mesh.getLodCount() && mesh.getLod(level + 1).error * pixelsPerModelUnit <= drawView.maxPixelError) {
+				level++;
+			}
+		}
+		return level;
+	}
+
+	// Adds a model's uploaded buffers to memoryStats
+	void Model3D::CountMemory(const gps::MeshBuffers& buffers) {
+
+		memoryStats.indexBufferBytes += buffers.getIndexBufferSize();
+		if (buffers.getIndexType() == GL_UNSIGNED_SHORT) {
+			// Two bytes per index, as much as the buffer itself now takes
+			memoryStats.indexBytesSaved += buffers.getIndexBufferSize();
+		}
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
@@ -30,7 +610,19 @@ namespace gps {
 		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret;
+		if (loadOptions.objLoader == ObjLoader::Parallel) {
+			ret = ObjParser::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str());
+		} else {
+			AssetView asset;
+			if (AssetPack::Get().Find(fileName, &asset)) {
+				AssetStream objStream(asset);
+				AssetMaterialReader materialReader(basePath);
+				ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, &objStream, &materialReader, GL_TRUE);
+			} else {
+				ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+			}
+		}
 
 		if (!err.empty()) {
 
@@ -54,21 +646,43 @@ namespace gps {
 			  maxY = std::numeric_limits<float>::min(),
 			  maxZ = std::numeric_limits<float>::min();
 
+		size_t totalFaceVertices = 0;
+		size_t totalUniqueVertices = 0;
+		size_t mixedShapes = 0;
+
+		// Every face goes to the mesh of its own material, finished meshes take that material's textures
+		MaterialMeshes materialMeshes;
+		auto addMesh = [&](std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices, int materialId) {
+
+			PrintWeldStats(meshes.size(), indices.size(), vertices.size());
+			totalFaceVertices += indices.size();
+			totalUniqueVertices += vertices.size();
+
+			// Only try to read materials if the .mtl file is present
+			std::vector<gps::Texture> textures;
+			if (materialId >= 0 && materialId < (int)materials.size()) {
+				textures = LoadMaterialTextures(materials[materialId], basePath);
+			}
+
+			AddMesh(std::move(vertices), std::move(indices), std::move(textures));
+		};
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			const std::vector<int>& materialIds = shapes[s].mesh.material_ids;
+			if (std::adjacent_find(materialIds.begin(), materialIds.end(), std::not_equal_to<int>()) != materialIds.end()) {
+				mixedShapes++;
+			}
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
 			for (size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
 
 				int fv = shapes[s].mesh.num_face_vertices[f];
+				materialId = f < materialIds.size() ? materialIds[f] : -1;
 
-				//gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				//textures.push_back(currentTexture);
+				MaterialMeshes::Bucket& bucket = materialMeshes.Get(materialId);
 
 				// Loop over vertices in the face.
 				for (size_t v = 0; v < fv; v++) {
@@ -107,168 +721,228 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
-					vertices.push_back(currentVertex);
-
-					indices.push_back((GLuint)(index_offset + v));
+					MaterialMeshes::AddCorner(bucket, currentVertex);
 				}
 
 				index_offset += fv;
 			}
 
-			// get material id
-			// Only try to read materials if the .mtl file is present
-			size_t a = shapes[s].mesh.material_ids.size();
+			// Without merging every shape keeps its own meshes, one per material it uses
+			materialMeshes.FinishShape(loadOptions.mergeMaterials, addMesh);
+		}
+		materialMeshes.Merge(addMesh);
+		PrintWeldStats(totalFaceVertices, totalUniqueVertices);
+		PrintDrawCalls(shapes.size(), mixedShapes, meshes.size(), loadOptions.mergeMaterials);
+
+		//	Save bounding box data
+		this->aabb.min = glm::vec3(minX, minY, minZ);
+		this->aabb.max = glm::vec3(maxX, maxY, maxZ);
+	}
 
-			if (a > 0 && materials.size()>0) {
+	// Builds the meshes while tinyobj streams the records in, without materializing its shapes
+	void Model3D::ReadOBJStreaming(std::string fileName, std::string basePath) {
 
-				materialId = shapes[s].mesh.material_ids[0];
-				if (materialId != -1) {
+        std::cout << "Loading : " << fileName << " (streaming)" << std::endl;
 
-					gps::Material currentMaterial;
-					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
-					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
-					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
+		AssetView asset;
+		std::unique_ptr<std::istream> objFile;
+		if (AssetPack::Get().Find(fileName, &asset)) {
+			objFile = std::make_unique<AssetStream>(asset);
+		} else {
+			objFile = std::make_unique<std::ifstream>(fileName);
+		}
+		if (!*objFile) {
 
-					//ambient texture
-					std::string ambientTexturePath = materials[materialId].ambient_texname;
+			std::cerr << "Cannot open file [" << fileName << "]" << std::endl;
+			exit(1);
+		}
 
-					if (!ambientTexturePath.empty()) {
+		size_t totalFaceVertices = 0;
+		size_t totalUniqueVertices = 0;
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
-					}
+		StreamingObjBuilder builder;
+		builder.mergeMaterials = loadOptions.mergeMaterials;
+		builder.onMesh = [&](std::vector<gps::Vertex>& vertices, std::vector<GLuint>& indices, int materialId) {
 
-					//diffuse texture
-					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
+			std::vector<gps::Texture> textures;
+			if (materialId >= 0 && materialId < (int)builder.materials.size()) {
+				textures = LoadMaterialTextures(builder.materials[materialId], basePath);
+			}
 
-					if (!diffuseTexturePath.empty()) {
+			PrintWeldStats(meshes.size(), indices.size(), vertices.size());
+			totalFaceVertices += indices.size();
+			totalUniqueVertices += vertices.size();
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
-					}
+			AddMesh(std::move(vertices), std::move(indices), std::move(textures));
+		};
 
-					//specular texture
-					std::string specularTexturePath = materials[materialId].specular_texname;
+		AssetMaterialReader materialReader(basePath);
+		std::string err;
+		bool ret = tinyobj::LoadObjWithCallback(*objFile, builder.GetCallbacks(), &builder, &materialReader, &err);
+		builder.FinishShape();
+		builder.FinishMeshes();
 
-					if (!specularTexturePath.empty()) {
+		if (!err.empty()) {
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
-					}
-				}
-			}
+			// `err` may contain warning message.
+			std::cerr << err << std::endl;
+		}
+
+		if (!ret) {
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+			exit(1);
 		}
-		//	Save bounding box data
-		this->aabb.min = glm::vec3(minX, minY, minZ);
-		this->aabb.max = glm::vec3(maxX, maxY, maxZ);
+
+		std::cout << "# of shapes    : " << builder.shapeCount << std::endl;
+		std::cout << "# of materials : " << builder.materials.size() << std::endl;
+		PrintWeldStats(totalFaceVertices, totalUniqueVertices);
+		PrintDrawCalls(builder.shapeCount, builder.mixedShapes, meshes.size(), loadOptions.mergeMaterials);
+
+		this->aabb.min = builder.boundsMin;
+		this->aabb.max = builder.boundsMax;
 	}
 
-	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+	// Runs the optional optimization and simplification passes on a finished mesh
+	void Model3D::AddMesh(std::vector<gps::Vertex>&& vertices, std::vector<GLuint>&& indices, std::vector<gps::Texture>&& textures) {
+
+		if (loadOptions.optimizeMeshes) {
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
+			VertexCacheStats before = MeshOptimizer::AnalyzeVertexCache(indices, vertices.size());
+			MeshOptimizer::Optimize(vertices, indices);
+			VertexCacheStats after = MeshOptimizer::AnalyzeVertexCache(indices, vertices.size());
+			PrintVertexCacheStats(meshes.size(), before, after);
+		}
+
+		std::vector<gps::MeshLod> lods = { { 0, (GLsizei)indices.size(), 0.0f } };
+		if (loadOptions.generateLods) {
 
-				if (loadedTextures[i].path == path)	{
+			lods = MeshSimplifier::BuildLods(vertices, indices);
 
-					//already loaded texture
-					return loadedTextures[i];
+			if (loadOptions.optimizeMeshes) {
+				for (size_t level = 1; level < lods.size(); level++) {
+
+					auto first = indices.begin() + lods[level].indexOffset;
+					std::vector<GLuint> levelIndices(first, first + lods[level].indexCount);
+					MeshOptimizer::OptimizeTriangleOrder(vertices, levelIndices);
+					std::copy(levelIndices.begin(), levelIndices.end(), first);
 				}
 			}
 
+			PrintLodStats(meshes.size(), lods);
+		}
+
+		std::vector<gps::MeshCluster> clusters;
+		if (loadOptions.buildClusters) {
+			for (gps::MeshLod& lod : lods) {
+
+				lod.clusterOffset = (GLuint)clusters.size();
+				ClusterBuilder::Build(vertices, indices, lod.indexOffset, lod.indexCount, clusters);
+				lod.clusterCount = (GLuint)clusters.size() - lod.clusterOffset;
+			}
+			std::cout << "  mesh " << meshes.size() << ": " << clusters.size() << " clusters" << std::endl;
+		}
+
+		meshes.push_back(gps::Mesh(std::move(vertices), std::move(indices), std::move(textures), std::move(lods), std::move(clusters)));
+	}
+
+	// Processing flags the mesh cache has to match for the current load options
+	uint32_t Model3D::GetCacheFlags() {
+
+		uint32_t flags = 0;
+		if (loadOptions.optimizeMeshes) flags |= MESH_CACHE_OPTIMIZED;
+		if (loadOptions.generateLods) flags |= MESH_CACHE_LODS;
+		if (loadOptions.buildClusters) flags |= MESH_CACHE_CLUSTERS;
+		if (loadOptions.mergeMaterials) flags |= MESH_CACHE_MERGED;
+		return flags;
+	}
+
+	// Looks up the ambient, diffuse and specular maps of a material
+	std::vector<gps::Texture> Model3D::LoadMaterialTextures(const tinyobj::material_t& material, std::string basePath) {
+
+		std::vector<gps::Texture> textures;
+
+		//ambient texture
+		if (!material.ambient_texname.empty()) {
+
+			textures.push_back(LoadTexture(basePath + material.ambient_texname, "ambientTexture"));
+		}
+
+		//diffuse texture
+		if (!material.diffuse_texname.empty()) {
+
+			textures.push_back(LoadTexture(basePath + material.diffuse_texname, "diffuseTexture"));
+		}
+
+		//specular texture
+		if (!material.specular_texname.empty()) {
+
+			textures.push_back(LoadTexture(basePath + material.specular_texname, "specularTexture"));
+		}
+
+		return textures;
+	}
+
+	// Describes a texture associated with the object - by its name and type; AcquireTextures loads it
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = 0;
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
-			loadedTextures.push_back(currentTexture);
-
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	// Loads the images of every mesh into array textures, one per role, size and format, and points
+	// each mesh texture at its layer
+	void Model3D::AcquireTextures() {
 
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		// Specular maps hold intensities, not colour, and keep their linear values
+		auto roleOf = [](const gps::Texture& texture) {
+			return texture.type == "specularTexture" ? TextureRole::Data : TextureRole::Color;
+		};
 
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+		for (TextureRole role : { TextureRole::Color, TextureRole::Data }) {
+
+			std::vector<std::string> fileNames;
+			std::unordered_map<std::string, size_t> indices;
+			for (const gps::Mesh& mesh : meshes) {
+				for (const gps::Texture& texture : mesh.textures) {
+					if (roleOf(texture) == role && indices.emplace(texture.path, fileNames.size()).second) {
+						fileNames.push_back(texture.path);
+					}
+				}
+			}
+			if (fileNames.empty()) {
+				continue;
+			}
+
+			// Shared with every other model using the same images; new arrays stream in behind a placeholder
+			std::vector<TextureLayer> layers = TextureRegistry::Get().AcquireLayers(fileNames, role);
+			for (gps::Mesh& mesh : meshes) {
+				for (gps::Texture& texture : mesh.textures) {
+					if (roleOf(texture) == role) {
+						const TextureLayer& layer = layers[indices.at(texture.path)];
+						texture.id = layer.texture;
+						texture.layer = layer.layer;
+					}
+				}
+			}
+			for (const TextureLayer& layer : layers) {
+				if (std::find(loadedArrays.begin(), loadedArrays.end(), layer.texture) == loadedArrays.end()) {
+					loadedArrays.push_back(layer.texture);
+				}
+			}
 		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
-		}
-
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
-
-		for (int row = 0; row < half_height; row++) {
-
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
-
-			for (int col = 0; col < width_in_bytes; col++) {
-
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
-
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
-
-		return textureID;
 	}
 
 	Model3D::~Model3D() {
 
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
+        for (size_t i = 0; i < loadedArrays.size(); i++) {
 
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            TextureRegistry::Get().Release(loadedArrays.at(i));
         }
 
-        for (size_t i = 0; i < meshes.size(); i++) {
-
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
-        }
+        buffers.Delete();
 	}
 }
@@ -2,50 +2,142 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "MeshCache.hpp"
+#include "RenderQueue.hpp"
+#include "TextureRegistry.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
 #include <iostream>
+#include <memory>
 #include <string>
 #include <vector>
 
 namespace gps {
 
-	struct BoundingBox {
-		glm::vec3 min;
-		glm::vec3 max;
+	// Parser that turns .obj text into tinyobj structures
+	enum class ObjLoader {
+		TinyObj,
+		Parallel,
+		// Builds the meshes from tinyobj's callback API as records are read, lowest peak memory
+		Streaming
+	};
+
+	// Load-time settings shared by all models, filled from the command line in main.cpp
+	struct ModelLoadOptions {
+		ObjLoader objLoader = ObjLoader::Parallel;
+		// Parse every model with both parsers and report differences (bypasses the mesh cache)
+		bool verifyObjParser = false;
+		// Reorder triangles and vertices for the post-transform cache, overdraw and vertex fetch
+		bool optimizeMeshes = true;
+		// GPU vertex layout, packed trades some precision for half the vertex bandwidth
+		VertexFormat vertexFormat = VertexFormat::Float;
+		// Build simplified levels of detail for every mesh
+		bool generateLods = true;
+		// Split every level into clusters of up to 64 vertices / 124 triangles for CPU culling
+		bool buildClusters = true;
+		// Build one mesh per material from all shapes using it, instead of one per shape
+		bool mergeMaterials = true;
+	};
+
+	// Camera and pass parameters Model3D::Queue picks levels of detail and culls clusters with
+	struct DrawView {
+		// Camera transform, levels are always chosen from the camera
+		glm::mat4 modelView;
+		// Viewport height / (2 tan(fovy / 2)), the pixels one unit covers at distance 1
+		float pixelsPerUnit;
+		// Largest simplification error allowed on screen, in pixels
+		float maxPixelError = 1.0f;
+		// Model-to-clip transform of the pass being drawn, clusters are culled against it
+		glm::mat4 modelClip;
+		bool cullClusters = true;
+	};
+
+	// GPU memory held by every model loaded so far
+	struct MemoryStats {
+		size_t indexBufferBytes = 0;
+		// Bytes 16-bit index buffers save over 32-bit ones
+		size_t indexBytesSaved = 0;
 	};
 
     class Model3D {
 
     public:
+        static ModelLoadOptions loadOptions;
+
+        static DrawStats drawStats;
+
+        static MemoryStats memoryStats;
+
         ~Model3D();
 
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		void Draw(gps::Shader& shaderProgram);
+
+		// Queues every mesh at the coarsest level whose error stays below a pixel on screen, one packet per set
+		// of meshes binding the same arrays (one for the whole model in depth passes), drawn with the object's
+		// state (its cluster view included) from queue.AddObject
+		void Queue(RenderQueue& queue, RenderPass pass, uint32_t program, uint32_t object, const DrawView& drawView);
 
     	BoundingBox GetBoundingBox() const { return aabb; }
 
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		// GPU buffers all meshes live in
+		gps::MeshBuffers buffers;
+		// Indices of the meshes binding the same texture arrays, each set drawn with one call
+		std::vector<std::vector<size_t>> meshGroups;
+		// Mesh cache the meshes upload from, closed once they are
+		std::unique_ptr<MeshCache> cache;
+		// Every array texture reference taken from the registry, released on destruction
+        std::vector<GLuint> loadedArrays;
     	//	Bounding box
     	BoundingBox aabb;
 
+		// Loads the model from its baked mesh cache, parsing the .obj file only when the cache is stale
+		void LoadMeshes(std::string fileName, std::string basePath);
+
+		// Loads the images of every mesh into array textures, one per role, size and format, and points
+		// each mesh texture at its layer
+		void AcquireTextures();
+
+		// Uploads the meshes into the shared buffers and groups them by the arrays they bind
+		void UploadMeshes();
+
+		// Builds the meshes straight from a valid mesh cache, returns false if there is none
+		bool ReadCache(std::string fileName, std::string basePath);
+
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
 
-		// Retrieves a texture associated with the object - by its name and type
-		gps::Texture LoadTexture(std::string path, std::string type);
+		// Same result as ReadOBJ, but builds the meshes while the file is being read
+		void ReadOBJStreaming(std::string fileName, std::string basePath);
+
+		// Adds a model's uploaded buffers to memoryStats
+		static void CountMemory(const gps::MeshBuffers& buffers);
+
+		// Runs the optional optimization and simplification passes on a finished mesh
+		void AddMesh(std::vector<gps::Vertex>&& vertices, std::vector<GLuint>&& indices, std::vector<gps::Texture>&& textures);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Processing flags the mesh cache has to match for the current load options
+		static uint32_t GetCacheFlags();
+
+		// Pixels the diameter of a mesh's bounding sphere covers on screen, at the sphere's nearest point
+		static float ProjectedSize(const gps::Mesh& mesh, const DrawView& drawView);
+
+		// Coarsest level whose simplification error projects to at most maxPixelError pixels
+		static size_t SelectLod(const gps::Mesh& mesh, const DrawView& drawView);
+
+		// Looks up the ambient, diffuse and specular maps of a material
+		std::vector<gps::Texture> LoadMaterialTextures(const tinyobj::material_t& material, std::string basePath);
+
+		// Describes a texture associated with the object - by its name and type; AcquireTextures loads it
+		gps::Texture LoadTexture(std::string path, std::string type);
     };
 }
 
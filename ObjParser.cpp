@@ -0,0 +1,573 @@
+#include "ObjParser.hpp"
+#include "AssetPack.hpp"
+#include "MappedFile.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <thread>
+
+namespace gps {
+
+	namespace {
+
+		// Chunks smaller than this are not worth a thread of their own
+		const size_t MIN_CHUNK_SIZE = 1 << 20;
+
+		enum class CommandType { UseMaterial, MaterialLibrary, Group, Object };
+
+		// A state-changing line (usemtl, mtllib, g, o), replayed in file order during the merge
+		struct Command {
+			CommandType type;
+			// Faces and triangle corners parsed in the chunk before this line
+			size_t faceCount;
+			size_t cornerCount;
+			std::string name;
+		};
+
+		// Everything parsed from one line-aligned slice of the file
+		struct Chunk {
+			const char* begin;
+			const char* end;
+
+			std::vector<float> vertices;
+			std::vector<float> normals;
+			std::vector<float> texcoords;
+
+			// Fan-triangulated faces, three corners per triangle
+			std::vector<tinyobj::index_t> corners;
+			size_t faceCount = 0;
+
+			// Corners holding negative (relative) indices, resolved against chunk-local counts
+			// and shifted by the element counts of the preceding chunks once those are known
+			std::vector<size_t> relativeVertices;
+			std::vector<size_t> relativeNormals;
+			std::vector<size_t> relativeTexcoords;
+
+			std::vector<Command> commands;
+		};
+
+		inline bool IsSpace(char c) {
+
+			return c == ' ' || c == '\t';
+		}
+
+		inline const char* SkipSpaces(const char* p, const char* end) {
+
+			while (p < end && IsSpace(*p)) p++;
+			return p;
+		}
+
+		inline const char* TokenEnd(const char* p, const char* end) {
+
+			while (p < end && !IsSpace(*p) && *p != '\r') p++;
+			return p;
+		}
+
+		// Same rules as tinyobj's parseFloat: unparsable or missing values become 0
+		inline const char* ParseFloat(const char* p, const char* end, float* value) {
+
+			p = SkipSpaces(p, end);
+			const char* tokenEnd = TokenEnd(p, end);
+			const char* first = (p < tokenEnd && *p == '+') ? p + 1 : p;
+
+			*value = 0.0f;
+			std::from_chars(first, tokenEnd, *value);
+			return tokenEnd;
+		}
+
+		// Behaves like atoi: optional sign, digits, 0 when there are none
+		inline const char* ParseInt(const char* p, const char* end, int* value) {
+
+			const char* first = (p < end && *p == '+') ? p + 1 : p;
+
+			*value = 0;
+			std::from_chars_result result = std::from_chars(first, end, *value);
+			return result.ptr == first ? p : result.ptr;
+		}
+
+		inline const char* SkipToSeparator(const char* p, const char* end) {
+
+			while (p < end && *p != '/' && !IsSpace(*p) && *p != '\r') p++;
+			return p;
+		}
+
+		// Zero-based index, or a negative value flagged as relative (see tinyobj's fixIndex)
+		inline int FixIndex(int index, int count, bool* relative) {
+
+			*relative = index < 0;
+			if (index > 0) return index - 1;
+			if (index == 0) return 0;
+			return count + index;
+		}
+
+		// One face corner: i, i/j, i//k or i/j/k
+		struct Corner {
+			tinyobj::index_t index;
+			bool relativeVertex;
+			bool relativeNormal;
+			bool relativeTexcoord;
+		};
+
+		const char* ParseCorner(const char* p, const char* end, const Chunk& chunk, Corner* corner) {
+
+			int value;
+			corner->index.vertex_index = -1;
+			corner->index.normal_index = -1;
+			corner->index.texcoord_index = -1;
+			corner->relativeNormal = false;
+			corner->relativeTexcoord = false;
+
+			p = SkipToSeparator(ParseInt(p, end, &value), end);
+			corner->index.vertex_index = FixIndex(value, (int)(chunk.vertices.size() / 3), &corner->relativeVertex);
+			if (p >= end || *p != '/') {
+				return p;
+			}
+			p++;
+
+			if (p < end && *p == '/') {
+				p = SkipToSeparator(ParseInt(p + 1, end, &value), end);
+				corner->index.normal_index = FixIndex(value, (int)(chunk.normals.size() / 3), &corner->relativeNormal);
+				return p;
+			}
+
+			p = SkipToSeparator(ParseInt(p, end, &value), end);
+			corner->index.texcoord_index = FixIndex(value, (int)(chunk.texcoords.size() / 2), &corner->relativeTexcoord);
+			if (p >= end || *p != '/') {
+				return p;
+			}
+
+			p = SkipToSeparator(ParseInt(p + 1, end, &value), end);
+			corner->index.normal_index = FixIndex(value, (int)(chunk.normals.size() / 3), &corner->relativeNormal);
+			return p;
+		}
+
+		void EmitCorner(Chunk& chunk, const Corner& corner) {
+
+			size_t position = chunk.corners.size();
+			chunk.corners.push_back(corner.index);
+
+			if (corner.relativeVertex) chunk.relativeVertices.push_back(position);
+			if (corner.relativeNormal) chunk.relativeNormals.push_back(position);
+			if (corner.relativeTexcoord) chunk.relativeTexcoords.push_back(position);
+		}
+
+		void ParseFace(const char* p, const char* end, Chunk& chunk, std::vector<Corner>& face) {
+
+			face.clear();
+			p = SkipSpaces(p, end);
+
+			while (p < end && *p != '\r') {
+				Corner corner;
+				p = ParseCorner(p, end, chunk, &corner);
+				face.push_back(corner);
+				while (p < end && (IsSpace(*p) || *p == '\r')) p++;
+			}
+
+			// Polygon -> triangle fan, as tinyobj does with triangulation enabled
+			for (size_t k = 2; k < face.size(); k++) {
+				EmitCorner(chunk, face[0]);
+				EmitCorner(chunk, face[k - 1]);
+				EmitCorner(chunk, face[k]);
+			}
+			chunk.faceCount++;
+		}
+
+		void AddCommand(Chunk& chunk, CommandType type, const char* p, const char* end) {
+
+			p = SkipSpaces(p, end);
+			Command command;
+			command.type = type;
+			command.faceCount = chunk.faceCount;
+			command.cornerCount = chunk.corners.size();
+			command.name.assign(p, TokenEnd(p, end));
+			chunk.commands.push_back(std::move(command));
+		}
+
+		void ParseLine(const char* p, const char* end, Chunk& chunk, std::vector<Corner>& face) {
+
+			p = SkipSpaces(p, end);
+			if (p >= end || *p == '#') {
+				return;
+			}
+
+			size_t length = (size_t)(end - p);
+			float x, y, z;
+
+			if (length > 1 && p[0] == 'v' && IsSpace(p[1])) {
+				p = ParseFloat(p + 2, end, &x);
+				p = ParseFloat(p, end, &y);
+				ParseFloat(p, end, &z);
+				chunk.vertices.insert(chunk.vertices.end(), { x, y, z });
+			}
+			else if (length > 2 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2])) {
+				p = ParseFloat(p + 3, end, &x);
+				p = ParseFloat(p, end, &y);
+				ParseFloat(p, end, &z);
+				chunk.normals.insert(chunk.normals.end(), { x, y, z });
+			}
+			else if (length > 2 && p[0] == 'v' && p[1] == 't' && IsSpace(p[2])) {
+				p = ParseFloat(p + 3, end, &x);
+				ParseFloat(p, end, &y);
+				chunk.texcoords.insert(chunk.texcoords.end(), { x, y });
+			}
+			else if (length > 1 && p[0] == 'f' && IsSpace(p[1])) {
+				ParseFace(p + 2, end, chunk, face);
+			}
+			else if (length > 6 && std::strncmp(p, "usemtl", 6) == 0 && IsSpace(p[6])) {
+				AddCommand(chunk, CommandType::UseMaterial, p + 7, end);
+			}
+			else if (length > 6 && std::strncmp(p, "mtllib", 6) == 0 && IsSpace(p[6])) {
+				AddCommand(chunk, CommandType::MaterialLibrary, p + 7, end);
+			}
+			else if (length > 1 && p[0] == 'g' && IsSpace(p[1])) {
+				AddCommand(chunk, CommandType::Group, p + 2, end);
+			}
+			else if (length > 1 && p[0] == 'o' && IsSpace(p[1])) {
+				AddCommand(chunk, CommandType::Object, p + 2, end);
+			}
+			// Anything else (s, l, t, ...) is ignored
+		}
+
+		void ParseChunk(Chunk* chunk) {
+
+			std::vector<Corner> face;
+			const char* p = chunk->begin;
+
+			while (p < chunk->end) {
+				const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', (size_t)(chunk->end - p)));
+				if (!lineEnd) {
+					lineEnd = chunk->end;
+				}
+
+				const char* contentEnd = lineEnd;
+				if (contentEnd > p && contentEnd[-1] == '\r') {
+					contentEnd--;
+				}
+
+				ParseLine(p, contentEnd, *chunk, face);
+				p = lineEnd + 1;
+			}
+		}
+
+		// Replays the tinyobj LoadObj state machine over the parsed chunks in file order
+		class ShapeBuilder {
+
+		public:
+			ShapeBuilder(std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+						 std::string* err, const std::string& basePath)
+				: shapes(shapes), materials(materials), err(err), materialReader(basePath) {
+			}
+
+			void AddFaces(const Chunk& chunk, size_t faceBegin, size_t faceEnd, size_t cornerBegin, size_t cornerEnd) {
+
+				groupFaceCount += faceEnd - faceBegin;
+				if (cornerEnd > cornerBegin) {
+					groupRanges.push_back({ &chunk, cornerBegin, cornerEnd });
+				}
+			}
+
+			bool Execute(const Command& command) {
+
+				switch (command.type) {
+				case CommandType::UseMaterial: {
+					auto found = materialMap.find(command.name);
+					int newMaterial = found != materialMap.end() ? found->second : -1;
+					if (newMaterial != material) {
+						ExportGroup();
+						material = newMaterial;
+					}
+					break;
+				}
+				case CommandType::MaterialLibrary: {
+					std::string errMtl;
+					bool ok = materialReader(command.name, materials, &materialMap, &errMtl);
+					if (err) {
+						(*err) += errMtl;
+					}
+					if (!ok) {
+						return false;
+					}
+					break;
+				}
+				case CommandType::Group:
+				case CommandType::Object:
+					if (ExportGroup()) {
+						shapes->push_back(std::move(shape));
+					}
+					shape = tinyobj::shape_t();
+					name = command.name;
+					break;
+				}
+				return true;
+			}
+
+			void Finish() {
+
+				bool exported = ExportGroup();
+				if (exported || !shape.mesh.indices.empty()) {
+					shapes->push_back(std::move(shape));
+				}
+			}
+
+		private:
+			struct Range {
+				const Chunk* chunk;
+				size_t begin;
+				size_t end;
+			};
+
+			std::vector<tinyobj::shape_t>* shapes;
+			std::vector<tinyobj::material_t>* materials;
+			std::string* err;
+			AssetMaterialReader materialReader;
+
+			std::map<std::string, int> materialMap;
+			int material = -1;
+			std::string name;
+			tinyobj::shape_t shape;
+
+			// Pending faces, the equivalent of tinyobj's faceGroup
+			std::vector<Range> groupRanges;
+			size_t groupFaceCount = 0;
+
+			bool ExportGroup() {
+
+				if (groupFaceCount == 0) {
+					return false;
+				}
+
+				for (const Range& range : groupRanges) {
+					const tinyobj::index_t* first = range.chunk->corners.data() + range.begin;
+					shape.mesh.indices.insert(shape.mesh.indices.end(), first, first + (range.end - range.begin));
+
+					size_t triangles = (range.end - range.begin) / 3;
+					shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(), triangles, (unsigned char)3);
+					shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), triangles, material);
+				}
+				shape.name = name;
+
+				groupRanges.clear();
+				groupFaceCount = 0;
+				return true;
+			}
+		};
+
+		void AppendAttribute(std::vector<float>& target, const std::vector<float>& source) {
+
+			target.insert(target.end(), source.begin(), source.end());
+		}
+
+		void ShiftRelative(std::vector<tinyobj::index_t>& corners, const std::vector<size_t>& positions,
+						   int tinyobj::index_t::* member, int base) {
+
+			for (size_t position : positions) {
+				corners[position].*member += base;
+			}
+		}
+
+		// Compares two float arrays, tolerating the last-bit differences of tinyobj's own float parser
+		size_t CountFloatMismatches(const std::vector<float>& a, const std::vector<float>& b, float* maxDifference) {
+
+			size_t mismatches = 0;
+			for (size_t i = 0; i < a.size() && i < b.size(); i++) {
+				float difference = std::fabs(a[i] - b[i]);
+				*maxDifference = std::max(*maxDifference, difference);
+				if (difference > 1e-6f * std::max(1.0f, std::fabs(a[i]))) {
+					mismatches++;
+				}
+			}
+			return mismatches + (a.size() > b.size() ? a.size() - b.size() : b.size() - a.size());
+		}
+
+		bool SameIndex(const tinyobj::index_t& a, const tinyobj::index_t& b) {
+
+			return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+		}
+	}
+
+	bool ObjParser::LoadObj(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+							std::vector<tinyobj::material_t>* materials, std::string* err,
+							const char* fileName, const char* mtlBasePath) {
+
+		attrib->vertices.clear();
+		attrib->normals.clear();
+		attrib->texcoords.clear();
+		shapes->clear();
+
+		// Straight from the asset pack when it holds the file
+		MappedFile file;
+		AssetView asset;
+		if (!AssetPack::Get().Find(fileName, &asset)) {
+			if (!file.Open(fileName)) {
+				if (err) {
+					(*err) = std::string("Cannot open file [") + fileName + "]\n";
+				}
+				return false;
+			}
+			asset = { file.GetData(), file.GetSize(), 0 };
+		}
+
+		const char* data = reinterpret_cast<const char*>(asset.data);
+		const char* dataEnd = data + asset.size;
+
+		// Split the file into line-aligned chunks, one per core
+		size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+		threadCount = std::max((size_t)1, std::min(threadCount, asset.size / MIN_CHUNK_SIZE));
+
+		std::vector<Chunk> chunks(threadCount);
+		const char* chunkBegin = data;
+		for (size_t c = 0; c < threadCount; c++) {
+			const char* chunkEnd = (c + 1 == threadCount) ? dataEnd : data + asset.size * (c + 1) / threadCount;
+			if (chunkEnd < chunkBegin) {
+				chunkEnd = chunkBegin;
+			}
+			const char* newline = static_cast<const char*>(std::memchr(chunkEnd, '\n', (size_t)(dataEnd - chunkEnd)));
+			chunkEnd = newline ? newline + 1 : dataEnd;
+
+			chunks[c].begin = chunkBegin;
+			chunks[c].end = chunkEnd;
+			chunkBegin = chunkEnd;
+		}
+
+		std::vector<std::thread> workers;
+		for (size_t c = 1; c < threadCount; c++) {
+			workers.emplace_back(ParseChunk, &chunks[c]);
+		}
+		ParseChunk(&chunks[0]);
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+
+		// Merge the attribute arrays and rebase relative indices
+		size_t vertexFloats = 0, normalFloats = 0, texcoordFloats = 0;
+		for (const Chunk& chunk : chunks) {
+			vertexFloats += chunk.vertices.size();
+			normalFloats += chunk.normals.size();
+			texcoordFloats += chunk.texcoords.size();
+		}
+		attrib->vertices.reserve(vertexFloats);
+		attrib->normals.reserve(normalFloats);
+		attrib->texcoords.reserve(texcoordFloats);
+
+		for (Chunk& chunk : chunks) {
+			ShiftRelative(chunk.corners, chunk.relativeVertices, &tinyobj::index_t::vertex_index, (int)(attrib->vertices.size() / 3));
+			ShiftRelative(chunk.corners, chunk.relativeNormals, &tinyobj::index_t::normal_index, (int)(attrib->normals.size() / 3));
+			ShiftRelative(chunk.corners, chunk.relativeTexcoords, &tinyobj::index_t::texcoord_index, (int)(attrib->texcoords.size() / 2));
+
+			AppendAttribute(attrib->vertices, chunk.vertices);
+			AppendAttribute(attrib->normals, chunk.normals);
+			AppendAttribute(attrib->texcoords, chunk.texcoords);
+		}
+
+		// Assemble shapes in file order
+		ShapeBuilder builder(shapes, materials, err, mtlBasePath ? mtlBasePath : "");
+
+		for (const Chunk& chunk : chunks) {
+
+			size_t face = 0, corner = 0;
+			for (const Command& command : chunk.commands) {
+				builder.AddFaces(chunk, face, command.faceCount, corner, command.cornerCount);
+				face = command.faceCount;
+				corner = command.cornerCount;
+
+				if (!builder.Execute(command)) {
+					return false;
+				}
+			}
+			builder.AddFaces(chunk, face, chunk.faceCount, corner, chunk.corners.size());
+		}
+		builder.Finish();
+
+		return true;
+	}
+
+	bool ObjParser::Verify(const std::string& fileName, const std::string& basePath) {
+
+		tinyobj::attrib_t expectedAttrib, actualAttrib;
+		std::vector<tinyobj::shape_t> expectedShapes, actualShapes;
+		std::vector<tinyobj::material_t> expectedMaterials, actualMaterials;
+		std::string expectedErr, actualErr;
+
+		auto start = std::chrono::steady_clock::now();
+		bool expectedOk = tinyobj::LoadObj(&expectedAttrib, &expectedShapes, &expectedMaterials, &expectedErr,
+										   fileName.c_str(), basePath.c_str(), true);
+		auto middle = std::chrono::steady_clock::now();
+		bool actualOk = LoadObj(&actualAttrib, &actualShapes, &actualMaterials, &actualErr,
+								fileName.c_str(), basePath.c_str());
+		auto end = std::chrono::steady_clock::now();
+
+		std::cout << "OBJ parser check : " << fileName << std::endl;
+		std::cout << "  tinyobj  " << std::chrono::duration<double, std::milli>(middle - start).count() << " ms" << std::endl;
+		std::cout << "  parallel " << std::chrono::duration<double, std::milli>(end - middle).count() << " ms" << std::endl;
+
+		if (expectedOk != actualOk) {
+			std::cout << "  MISMATCH: load result differs" << std::endl;
+			return false;
+		}
+
+		bool match = true;
+		float maxDifference = 0.0f;
+		size_t floatMismatches = CountFloatMismatches(expectedAttrib.vertices, actualAttrib.vertices, &maxDifference) +
+								 CountFloatMismatches(expectedAttrib.normals, actualAttrib.normals, &maxDifference) +
+								 CountFloatMismatches(expectedAttrib.texcoords, actualAttrib.texcoords, &maxDifference);
+		if (floatMismatches > 0) {
+			std::cout << "  MISMATCH: " << floatMismatches << " attribute values differ" << std::endl;
+			match = false;
+		}
+
+		if (expectedShapes.size() != actualShapes.size()) {
+			std::cout << "  MISMATCH: " << expectedShapes.size() << " shapes expected, got " << actualShapes.size() << std::endl;
+			match = false;
+		}
+
+		for (size_t s = 0; s < expectedShapes.size() && s < actualShapes.size(); s++) {
+			const tinyobj::mesh_t& expected = expectedShapes[s].mesh;
+			const tinyobj::mesh_t& actual = actualShapes[s].mesh;
+
+			bool same = expectedShapes[s].name == actualShapes[s].name &&
+						expected.indices.size() == actual.indices.size() &&
+						expected.num_face_vertices == actual.num_face_vertices &&
+						expected.material_ids == actual.material_ids;
+			for (size_t i = 0; same && i < expected.indices.size(); i++) {
+				same = SameIndex(expected.indices[i], actual.indices[i]);
+			}
+
+			if (!same) {
+				std::cout << "  MISMATCH: shape " << s << " (" << expectedShapes[s].name << ")" << std::endl;
+				match = false;
+			}
+		}
+
+		if (expectedMaterials.size() != actualMaterials.size()) {
+			std::cout << "  MISMATCH: " << expectedMaterials.size() << " materials expected, got " << actualMaterials.size() << std::endl;
+			match = false;
+		}
+
+		if (match) {
+			std::cout << "  OK: " << actualShapes.size() << " shapes, max attribute difference " << maxDifference << std::endl;
+		}
+		return match;
+	}
+
+	AssetMaterialReader::AssetMaterialReader(const std::string& basePath)
+		: basePath(basePath), fileReader(basePath) {
+	}
+
+	bool AssetMaterialReader::operator()(const std::string& matId, std::vector<tinyobj::material_t>* materials,
+										 std::map<std::string, int>* matMap, std::string* err) {
+
+		AssetView asset;
+		if (!AssetPack::Get().Find(basePath + matId, &asset)) {
+			return fileReader(matId, materials, matMap, err);
+		}
+
+		AssetStream stream(asset);
+		tinyobj::LoadMtl(matMap, materials, &stream);
+		return true;
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "tiny_obj_loader.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+	// Multi-threaded replacement for tinyobj::LoadObj. The .obj file is memory-mapped,
+	// split into line-aligned chunks and the chunks are parsed in parallel; the results are
+	// merged into the same attrib_t/shape_t structures tinyobj produces (triangulated).
+	class ObjParser {
+
+	public:
+		static bool LoadObj(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes,
+							std::vector<tinyobj::material_t>* materials, std::string* err,
+							const char* fileName, const char* mtlBasePath);
+
+		// Parses the file with both tinyobj and the parallel parser and reports any difference
+		static bool Verify(const std::string& fileName, const std::string& basePath);
+	};
+
+	// Reads .mtl files from the asset pack, falling back to the filesystem
+	class AssetMaterialReader : public tinyobj::MaterialReader {
+
+	public:
+		explicit AssetMaterialReader(const std::string& basePath);
+
+		bool operator()(const std::string& matId, std::vector<tinyobj::material_t>* materials,
+						std::map<std::string, int>* matMap, std::string* err) override;
+
+	private:
+		std::string basePath;
+		tinyobj::MaterialFileReader fileReader;
+	};
+}
+
+#endif /* ObjParser_hpp */
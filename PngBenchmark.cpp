@@ -0,0 +1,125 @@
+#include "MappedFile.hpp"
+#include "PngDecoder.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+	const int RUNS = 5;
+
+	double NowMs() {
+
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
+// Decode throughput of PngDecoder against stb_image on every PNG below the directories (models and skybox
+// by default), decoding to flipped RGBA like the texture loader does. Each file is decoded RUNS times by
+// both, the fastest run counts, and the outputs are compared byte for byte.
+int main(int argc, const char * argv[]) {
+
+	std::vector<std::string> directories(argv + 1, argv + argc);
+	if (directories.empty()) {
+		directories = { "models", "skybox" };
+	}
+
+	std::vector<std::string> files;
+	for (const std::string& directory : directories) {
+		std::error_code ec;
+		for (auto it = std::filesystem::recursive_directory_iterator(directory, ec);
+			 !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+			if (it->is_regular_file() && it->path().extension() == ".png") {
+				files.push_back(it->path().string());
+			}
+		}
+	}
+	std::sort(files.begin(), files.end());
+
+	stbi_set_flip_vertically_on_load_thread(1);
+
+	double stbTotal = 0.0;
+	double decoderTotal = 0.0;
+	size_t pixelBytes = 0;
+	size_t fileBytes = 0;
+	size_t fallbackCount = 0;
+	bool mismatch = false;
+
+	for (const std::string& fileName : files) {
+
+		gps::MappedFile file;
+		if (!file.Open(fileName)) {
+			continue;
+		}
+
+		double stbBest = 1e30;
+		double decoderBest = 1e30;
+		std::vector<unsigned char> reference;
+		std::vector<unsigned char> pixels;
+		bool decoded = true;
+		int width = 0, height = 0, channels;
+
+		for (int run = 0; run < RUNS; run++) {
+
+			double start = NowMs();
+			unsigned char* stbPixels = stbi_load_from_memory(file.GetData(), (int)file.GetSize(), &width, &height, &channels, 4);
+			stbBest = std::min(stbBest, NowMs() - start);
+			if (!stbPixels) {
+				break;
+			}
+			if (run == 0) {
+				reference.assign(stbPixels, stbPixels + (size_t)width * height * 4);
+			}
+			stbi_image_free(stbPixels);
+
+			start = NowMs();
+			decoded = gps::PngDecoder::Decode(file.GetData(), file.GetSize(), pixels, &width, &height, &channels, 4, true);
+			decoderBest = std::min(decoderBest, NowMs() - start);
+			if (!decoded) {
+				break;
+			}
+		}
+
+		if (reference.empty()) {
+			std::cerr << "ERROR: stb_image cannot decode " << fileName << std::endl;
+			continue;
+		}
+		if (!decoded) {
+			// Left to stb_image by the loader, e.g. 16-bit or interlaced images
+			std::cout << fileName << ": not handled, stb_image fallback" << std::endl;
+			fallbackCount++;
+			continue;
+		}
+
+		bool same = pixels == reference;
+		mismatch |= !same;
+		stbTotal += stbBest;
+		decoderTotal += decoderBest;
+		pixelBytes += reference.size();
+		fileBytes += file.GetSize();
+
+		std::cout << fileName << " (" << width << "x" << height << ", " << file.GetSize() / 1024 << " KB): stb_image "
+				  << stbBest << " ms, PngDecoder " << decoderBest << " ms, " << stbBest / decoderBest << "x"
+				  << (same ? "" : "  OUTPUT DIFFERS") << std::endl;
+	}
+
+	if (stbTotal > 0.0 && decoderTotal > 0.0) {
+		double megabytes = pixelBytes / (1024.0 * 1024.0);
+		std::cout << "Total: " << files.size() - fallbackCount << " PNGs, " << fileBytes / (1024.0 * 1024.0) << " MB compressed, "
+				  << megabytes << " MB decoded" << std::endl;
+		std::cout << "stb_image  : " << stbTotal << " ms, " << megabytes / (stbTotal / 1000.0) << " MB/s" << std::endl;
+		std::cout << "PngDecoder : " << decoderTotal << " ms, " << megabytes / (decoderTotal / 1000.0) << " MB/s ("
+				  << stbTotal / decoderTotal << "x)" << std::endl;
+	}
+	if (mismatch) {
+		std::cerr << "ERROR: PngDecoder output differs from stb_image" << std::endl;
+	}
+	return mismatch ? 1 : 0;
+}
@@ -0,0 +1,777 @@
+#include "PngDecoder.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__)
+	#define PNG_DECODER_SSE2 1
+	#include <emmintrin.h>
+#else
+	#define PNG_DECODER_SSE2 0
+#endif
+
+// The bit reader loads eight input bytes at a time as one little-endian word
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	#define PNG_DECODER_WIDE_REFILL 1
+#else
+	#define PNG_DECODER_WIDE_REFILL 0
+#endif
+
+namespace gps {
+
+	namespace {
+
+		const unsigned char PNG_SIGNATURE[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+		// Same limit as stb_image
+		const uint32_t MAX_DIMENSION = 1 << 24;
+		const uint64_t MAX_PIXEL_BYTES = (uint64_t)1 << 31;
+
+		// ---- Inflate (RFC 1951) ----
+
+		// Codes up to this length decode with one table lookup, longer ones (rare) walk the canonical code
+		const int FAST_BITS = 10;
+
+		const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+										   67, 83, 99, 115, 131, 163, 195, 227, 258 };
+		const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+		const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+											 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+		const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+											 11, 11, 12, 12, 13, 13 };
+		const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+		// LSB-first bit buffer over the compressed stream
+		struct BitReader {
+			const unsigned char* next;
+			const unsigned char* end;
+			uint64_t bits = 0;
+			int count = 0;
+			// Zero bytes fed past the end, a valid stream never consumes them
+			int overrun = 0;
+
+			BitReader(const unsigned char* data, size_t size) : next(data), end(data + size) {}
+
+			// Tops the buffer up to at least 56 bits
+			void Refill() {
+
+#if PNG_DECODER_WIDE_REFILL
+				if (end - next >= 8) {
+					uint64_t word;
+					std::memcpy(&word, next, sizeof(word));
+					bits |= word << count;
+					next += (63 - count) >> 3;
+					count |= 56;
+					return;
+				}
+#endif
+				while (count <= 56) {
+					if (next < end) {
+						bits |= (uint64_t)*next++ << count;
+					} else {
+						overrun++;
+					}
+					count += 8;
+				}
+			}
+
+			uint32_t Take(int length) {
+
+				uint32_t value = (uint32_t)(bits & (((uint64_t)1 << length) - 1));
+				bits >>= length;
+				count -= length;
+				return value;
+			}
+
+			bool Overran() const { return overrun * 8 > count; }
+		};
+
+		struct HuffmanTable {
+			// Next FAST_BITS bits -> symbol << 4 | code length, 0 for codes longer than FAST_BITS
+			uint16_t fast[1 << FAST_BITS];
+			uint16_t counts[16];
+			// Symbols ordered by code
+			uint16_t symbols[288];
+
+			bool Build(const uint8_t* lengths, int symbolCount) {
+
+				std::memset(fast, 0, sizeof(fast));
+				std::memset(counts, 0, sizeof(counts));
+				for (int s = 0; s < symbolCount; s++) {
+					counts[lengths[s]]++;
+				}
+				counts[0] = 0;
+
+				// Over-subscribed codes are invalid, incomplete ones are allowed
+				int left = 1;
+				for (int length = 1; length < 16; length++) {
+					left = (left << 1) - counts[length];
+					if (left < 0) {
+						return false;
+					}
+				}
+
+				uint16_t offsets[16] = {};
+				for (int length = 1; length < 15; length++) {
+					offsets[length + 1] = (uint16_t)(offsets[length] + counts[length]);
+				}
+				for (int s = 0; s < symbolCount; s++) {
+					if (lengths[s]) {
+						symbols[offsets[lengths[s]]++] = (uint16_t)s;
+					}
+				}
+
+				// Codes are stored MSB-first in the stream but read LSB-first, so the table is indexed by reversed codes
+				int code = 0;
+				int index = 0;
+				for (int length = 1; length <= FAST_BITS; length++) {
+					for (int i = 0; i < counts[length]; i++, code++, index++) {
+
+						int reversed = 0;
+						for (int bit = 0; bit < length; bit++) {
+							reversed |= (code >> bit & 1) << (length - 1 - bit);
+						}
+						uint16_t entry = (uint16_t)(symbols[index] << 4 | length);
+						for (int slot = reversed; slot < (1 << FAST_BITS); slot += 1 << length) {
+							fast[slot] = entry;
+						}
+					}
+					code <<= 1;
+				}
+				return true;
+			}
+
+			// Needs 15 bits in the buffer, returns -1 for an unassigned code
+			int Decode(BitReader& in) const {
+
+				uint16_t entry = fast[in.bits & ((1 << FAST_BITS) - 1)];
+				if (entry) {
+					in.bits >>= entry & 15;
+					in.count -= entry & 15;
+					return entry >> 4;
+				}
+
+				int code = 0;
+				int first = 0;
+				int index = 0;
+				uint64_t bits = in.bits;
+				for (int length = 1; length < 16; length++) {
+
+					code |= (int)(bits & 1);
+					bits >>= 1;
+					int count = counts[length];
+					if (code - first < count) {
+						in.bits >>= length;
+						in.count -= length;
+						return symbols[index + code - first];
+					}
+					index += count;
+					first = (first + count) << 1;
+					code <<= 1;
+				}
+				return -1;
+			}
+		};
+
+		bool BuildFixedTables(HuffmanTable& literals, HuffmanTable& distances) {
+
+			uint8_t lengths[288];
+			std::memset(lengths, 8, 144);
+			std::memset(lengths + 144, 9, 112);
+			std::memset(lengths + 256, 7, 24);
+			std::memset(lengths + 280, 8, 8);
+			if (!literals.Build(lengths, 288)) {
+				return false;
+			}
+			std::memset(lengths, 5, 30);
+			return distances.Build(lengths, 30);
+		}
+
+		bool ReadDynamicTables(BitReader& in, HuffmanTable& literals, HuffmanTable& distances) {
+
+			in.Refill();
+			int literalCount = (int)in.Take(5) + 257;
+			int distanceCount = (int)in.Take(5) + 1;
+			int codeLengthCount = (int)in.Take(4) + 4;
+			if (literalCount > 286 || distanceCount > 30) {
+				return false;
+			}
+
+			uint8_t codeLengthLengths[19] = {};
+			for (int i = 0; i < codeLengthCount; i++) {
+				in.Refill();
+				codeLengthLengths[CODE_LENGTH_ORDER[i]] = (uint8_t)in.Take(3);
+			}
+			HuffmanTable codeLengths;
+			if (!codeLengths.Build(codeLengthLengths, 19)) {
+				return false;
+			}
+
+			uint8_t lengths[286 + 30];
+			int total = literalCount + distanceCount;
+			for (int i = 0; i < total; ) {
+
+				in.Refill();
+				int symbol = codeLengths.Decode(in);
+				if (symbol < 0) {
+					return false;
+				}
+				if (symbol < 16) {
+					lengths[i++] = (uint8_t)symbol;
+					continue;
+				}
+
+				int repeat;
+				uint8_t value = 0;
+				if (symbol == 16) {
+					if (i == 0) {
+						return false;
+					}
+					value = lengths[i - 1];
+					repeat = 3 + (int)in.Take(2);
+				} else if (symbol == 17) {
+					repeat = 3 + (int)in.Take(3);
+				} else {
+					repeat = 11 + (int)in.Take(7);
+				}
+				if (i + repeat > total) {
+					return false;
+				}
+				std::memset(lengths + i, value, repeat);
+				i += repeat;
+			}
+
+			return literals.Build(lengths, literalCount) && distances.Build(lengths + literalCount, distanceCount);
+		}
+
+		// Inflates a zlib stream into exactly outSize bytes. out has 8 bytes of slack past outSize so
+		// matches can be copied a word at a time.
+		bool Inflate(const unsigned char* data, size_t size, unsigned char* out, size_t outSize) {
+
+			// zlib header: deflate method, no preset dictionary. The trailing Adler-32 is not checked,
+			// like stb_image does not.
+			if (size < 2 || (data[0] & 15) != 8 || (data[0] * 256 + data[1]) % 31 != 0 || (data[1] & 32)) {
+				return false;
+			}
+
+			BitReader in(data + 2, size - 2);
+			unsigned char* p = out;
+			unsigned char* outEnd = out + outSize;
+
+			static HuffmanTable fixedLiterals;
+			static HuffmanTable fixedDistances;
+			static const bool fixedBuilt = BuildFixedTables(fixedLiterals, fixedDistances);
+			HuffmanTable dynamicLiterals;
+			HuffmanTable dynamicDistances;
+
+			bool final;
+			do {
+				in.Refill();
+				final = in.Take(1) != 0;
+				uint32_t type = in.Take(2);
+
+				if (type == 0) {
+
+					// Stored block: byte aligned, the buffered whole bytes are handed back to the input
+					in.Take(in.count & 7);
+					int buffered = in.count / 8 - in.overrun;
+					if (buffered < 0) {
+						return false;
+					}
+					in.next -= buffered;
+					in.bits = 0;
+					in.count = 0;
+					in.overrun = 0;
+
+					if (in.end - in.next < 4) {
+						return false;
+					}
+					size_t length = in.next[0] | in.next[1] << 8;
+					size_t complement = in.next[2] | in.next[3] << 8;
+					in.next += 4;
+					if ((length ^ 0xFFFF) != complement || length > (size_t)(in.end - in.next) || length > (size_t)(outEnd - p)) {
+						return false;
+					}
+					std::memcpy(p, in.next, length);
+					in.next += length;
+					p += length;
+					continue;
+				}
+
+				const HuffmanTable* literals = &fixedLiterals;
+				const HuffmanTable* distances = &fixedDistances;
+				if (type == 2) {
+					if (!ReadDynamicTables(in, dynamicLiterals, dynamicDistances)) {
+						return false;
+					}
+					literals = &dynamicLiterals;
+					distances = &dynamicDistances;
+				} else if (type != 1 || !fixedBuilt) {
+					return false;
+				}
+
+				while (true) {
+
+					// 56 bits cover a literal/length code, its extra bits, a distance code and its extra bits
+					in.Refill();
+					int symbol = literals->Decode(in);
+
+					if (symbol < 256) {
+						if (symbol < 0 || p == outEnd) {
+							return false;
+						}
+						*p++ = (unsigned char)symbol;
+						continue;
+					}
+					if (symbol == 256) {
+						break;
+					}
+
+					symbol -= 257;
+					if (symbol >= 29) {
+						return false;
+					}
+					size_t length = LENGTH_BASE[symbol] + in.Take(LENGTH_EXTRA[symbol]);
+
+					int distanceSymbol = distances->Decode(in);
+					if (distanceSymbol < 0 || distanceSymbol >= 30) {
+						return false;
+					}
+					size_t distance = DISTANCE_BASE[distanceSymbol] + in.Take(DISTANCE_EXTRA[distanceSymbol]);
+
+					if (distance > (size_t)(p - out) || length > (size_t)(outEnd - p)) {
+						return false;
+					}
+
+					const unsigned char* from = p - distance;
+					if (distance >= 8) {
+						// Each word only reads bytes written before it, the overshoot lands in the slack
+						for (size_t i = 0; i < length; i += 8) {
+							std::memcpy(p + i, from + i, 8);
+						}
+					} else if (distance == 1) {
+						std::memset(p, *from, length);
+					} else {
+						// Short repeats (a pixel or two back): lay down the pattern until a whole number of
+						// repeats spans a word, then continue a word at a time from that far back
+						size_t period = distance;
+						while (period < 8) {
+							period += distance;
+						}
+						size_t i = 0;
+						for (; i < period && i < length; i++) {
+							p[i] = from[i];
+						}
+						for (; i < length; i += 8) {
+							std::memcpy(p + i, p + i - period, 8);
+						}
+					}
+					p += length;
+				}
+
+				if (in.Overran()) {
+					return false;
+				}
+			} while (!final);
+
+			return p == outEnd;
+		}
+
+		// ---- Row filters (PNG spec 9) ----
+
+		// Branch-free: on photographic rows the comparisons are close to random
+		inline unsigned char Paeth(int a, int b, int c) {
+
+			int pa = std::abs(b - c);
+			int pb = std::abs(a - c);
+			int pc = std::abs(a + b - 2 * c);
+			int bc = pb <= pc ? b : c;
+			return (unsigned char)(pa <= pb && pa <= pc ? a : bc);
+		}
+
+		void UnfilterUp(unsigned char* row, const unsigned char* prior, size_t stride) {
+
+			size_t i = 0;
+#if PNG_DECODER_SSE2
+			for (; i + 16 <= stride; i += 16) {
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), _mm_add_epi8(x, b));
+			}
+#endif
+			for (; i < stride; i++) {
+				row[i] = (unsigned char)(row[i] + prior[i]);
+			}
+		}
+
+		void UnfilterScalar(int filter, unsigned char* row, const unsigned char* prior, size_t stride, int bpp) {
+
+			switch (filter) {
+			case 1:
+				for (size_t i = bpp; i < stride; i++) {
+					row[i] = (unsigned char)(row[i] + row[i - bpp]);
+				}
+				break;
+			case 3:
+				for (size_t i = 0; i < stride; i++) {
+					int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+					row[i] = (unsigned char)(row[i] + ((a + prior[i]) >> 1));
+				}
+				break;
+			case 4:
+				for (size_t i = 0; i < stride; i++) {
+					int a = i >= (size_t)bpp ? row[i - bpp] : 0;
+					int c = i >= (size_t)bpp ? prior[i - bpp] : 0;
+					row[i] = (unsigned char)(row[i] + Paeth(a, prior[i], c));
+				}
+				break;
+			}
+		}
+
+#if PNG_DECODER_SSE2
+		// Sub, Average and Paeth depend on the pixel to the left, so they run one pixel per register
+		// with all of its channels in parallel
+		template <int BPP>
+		inline __m128i LoadPixel(const unsigned char* pixel) {
+
+			uint32_t value = 0;
+			std::memcpy(&value, pixel, BPP);
+			return _mm_cvtsi32_si128((int)value);
+		}
+
+		template <int BPP>
+		inline void StorePixel(unsigned char* pixel, __m128i value) {
+
+			uint32_t packed = (uint32_t)_mm_cvtsi128_si32(value);
+			std::memcpy(pixel, &packed, BPP);
+		}
+
+		inline __m128i AbsoluteI16(__m128i x) {
+
+			__m128i negative = _mm_cmplt_epi16(x, _mm_setzero_si128());
+			return _mm_sub_epi16(_mm_xor_si128(x, negative), negative);
+		}
+
+		inline __m128i Select(__m128i condition, __m128i then, __m128i otherwise) {
+
+			return _mm_or_si128(_mm_and_si128(condition, then), _mm_andnot_si128(condition, otherwise));
+		}
+
+		// Runs reconstruct(filtered pixel, pixel above) over a row. Four pixels are loaded and stored
+		// at once: 3-byte loads and stores for every pixel cost more than the filter arithmetic.
+		// Only the low BPP bytes of each register are meaningful.
+		template <int BPP, typename Reconstruct>
+		inline void UnfilterPixels(unsigned char* row, const unsigned char* prior, size_t stride, Reconstruct reconstruct) {
+
+			const __m128i mask = _mm_cvtsi32_si128(BPP == 4 ? -1 : 0xffffff);
+
+			size_t i = 0;
+			for (; i + 16 <= stride; i += 4 * BPP) {
+
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i));
+
+				__m128i p0 = _mm_and_si128(reconstruct(x, b), mask);
+				__m128i p1 = _mm_and_si128(reconstruct(_mm_srli_si128(x, BPP), _mm_srli_si128(b, BPP)), mask);
+				__m128i p2 = _mm_and_si128(reconstruct(_mm_srli_si128(x, 2 * BPP), _mm_srli_si128(b, 2 * BPP)), mask);
+				__m128i p3 = _mm_and_si128(reconstruct(_mm_srli_si128(x, 3 * BPP), _mm_srli_si128(b, 3 * BPP)), mask);
+				__m128i out = _mm_or_si128(_mm_or_si128(p0, _mm_slli_si128(p1, BPP)),
+										   _mm_or_si128(_mm_slli_si128(p2, 2 * BPP), _mm_slli_si128(p3, 3 * BPP)));
+
+				if (BPP == 4) {
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), out);
+				} else {
+					_mm_storel_epi64(reinterpret_cast<__m128i*>(row + i), out);
+					uint32_t last = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(out, 8));
+					std::memcpy(row + i + 8, &last, 4);
+				}
+			}
+			for (; i < stride; i += BPP) {
+				StorePixel<BPP>(row + i, reconstruct(LoadPixel<BPP>(row + i), LoadPixel<BPP>(prior + i)));
+			}
+		}
+
+		template <int BPP>
+		void UnfilterSse2(int filter, unsigned char* row, const unsigned char* prior, size_t stride) {
+
+			const __m128i zero = _mm_setzero_si128();
+			__m128i a = zero;
+
+			if (filter == 1) {
+
+				UnfilterPixels<BPP>(row, prior, stride, [&](__m128i x, __m128i) {
+					a = _mm_add_epi8(a, x);
+					return a;
+				});
+			} else if (filter == 3) {
+
+				// Floor of the average: _mm_avg_epu8 rounds up, odd sums lose the extra one
+				const __m128i one = _mm_set1_epi8(1);
+				UnfilterPixels<BPP>(row, prior, stride, [&](__m128i x, __m128i b) {
+					__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+					a = _mm_add_epi8(x, average);
+					return a;
+				});
+			} else if (filter == 4) {
+
+				// Predictor arithmetic in 16-bit lanes, a and c are kept widened
+				__m128i c = zero;
+				UnfilterPixels<BPP>(row, prior, stride, [&](__m128i x, __m128i up) {
+					__m128i b = _mm_unpacklo_epi8(up, zero);
+
+					__m128i pa = _mm_sub_epi16(b, c);
+					__m128i pb = _mm_sub_epi16(a, c);
+					__m128i pc = AbsoluteI16(_mm_add_epi16(pa, pb));
+					pa = AbsoluteI16(pa);
+					pb = AbsoluteI16(pb);
+					__m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+					__m128i predictor = Select(_mm_cmpeq_epi16(smallest, pa), a,
+											   Select(_mm_cmpeq_epi16(smallest, pb), b, c));
+					x = _mm_add_epi8(x, _mm_packus_epi16(predictor, predictor));
+					a = _mm_unpacklo_epi8(x, zero);
+					c = b;
+					return x;
+				});
+			}
+		}
+#endif
+
+		bool Unfilter(int filter, unsigned char* row, const unsigned char* prior, size_t stride, int bpp) {
+
+			if (filter > 4) {
+				return false;
+			}
+			if (filter == 0) {
+				return true;
+			}
+			if (filter == 2) {
+				UnfilterUp(row, prior, stride);
+				return true;
+			}
+#if PNG_DECODER_SSE2
+			if (bpp == 4) {
+				UnfilterSse2<4>(filter, row, prior, stride);
+				return true;
+			}
+			if (bpp == 3) {
+				UnfilterSse2<3>(filter, row, prior, stride);
+				return true;
+			}
+#endif
+			UnfilterScalar(filter, row, prior, stride, bpp);
+			return true;
+		}
+
+		// ---- Output ----
+
+		// Converts one unfiltered row to 3 or 4 channels
+		void ExpandRow(const unsigned char* source, unsigned char* out, int width, int colorType, int outChannels,
+					   const unsigned char* palette) {
+
+			switch (colorType) {
+			case 0:
+				for (int x = 0; x < width; x++, out += outChannels) {
+					out[0] = out[1] = out[2] = source[x];
+					if (outChannels == 4) {
+						out[3] = 255;
+					}
+				}
+				break;
+			case 2:
+				if (outChannels == 3) {
+					std::memcpy(out, source, (size_t)width * 3);
+					break;
+				}
+				for (int x = 0; x < width; x++, out += 4, source += 3) {
+					out[0] = source[0];
+					out[1] = source[1];
+					out[2] = source[2];
+					out[3] = 255;
+				}
+				break;
+			case 3:
+				for (int x = 0; x < width; x++, out += outChannels) {
+					std::memcpy(out, palette + source[x] * 4, outChannels);
+				}
+				break;
+			case 4:
+				for (int x = 0; x < width; x++, out += outChannels, source += 2) {
+					out[0] = out[1] = out[2] = source[0];
+					if (outChannels == 4) {
+						out[3] = source[1];
+					}
+				}
+				break;
+			default:
+				if (outChannels == 4) {
+					std::memcpy(out, source, (size_t)width * 4);
+					break;
+				}
+				for (int x = 0; x < width; x++, out += 3, source += 4) {
+					out[0] = source[0];
+					out[1] = source[1];
+					out[2] = source[2];
+				}
+				break;
+			}
+		}
+
+		uint32_t ReadBigEndian(const unsigned char* bytes) {
+
+			return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+		}
+	}
+
+	bool PngDecoder::IsPng(const unsigned char* data, size_t size) {
+
+		return size >= sizeof(PNG_SIGNATURE) && std::memcmp(data, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)) == 0;
+	}
+
+	bool PngDecoder::Decode(const unsigned char* data, size_t size, std::vector<unsigned char>& pixels,
+							int* width, int* height, int* channels, int desiredChannels, bool flip) {
+
+		if (!IsPng(data, size)) {
+			return false;
+		}
+
+		uint32_t imageWidth = 0;
+		uint32_t imageHeight = 0;
+		int colorType = -1;
+		// RGBA entries, opaque black past the end of the palette
+		unsigned char palette[256 * 4];
+		for (int i = 0; i < 256; i++) {
+			palette[i * 4] = palette[i * 4 + 1] = palette[i * 4 + 2] = 0;
+			palette[i * 4 + 3] = 255;
+		}
+		bool paletteAlpha = false;
+
+		// Image data, split across any number of IDAT chunks
+		const unsigned char* compressed = nullptr;
+		size_t compressedSize = 0;
+		std::vector<unsigned char> joined;
+
+		size_t position = sizeof(PNG_SIGNATURE);
+		bool first = true;
+		while (true) {
+
+			if (size - position < 12) {
+				return false;
+			}
+			uint32_t length = ReadBigEndian(data + position);
+			const unsigned char* type = data + position + 4;
+			const unsigned char* chunk = data + position + 8;
+			if (length > size - position - 12) {
+				return false;
+			}
+			position += 12 + (size_t)length;
+
+			if (first != (std::memcmp(type, "IHDR", 4) == 0)) {
+				return false;
+			}
+			first = false;
+
+			if (std::memcmp(type, "IHDR", 4) == 0) {
+
+				if (length != 13) {
+					return false;
+				}
+				imageWidth = ReadBigEndian(chunk);
+				imageHeight = ReadBigEndian(chunk + 4);
+				int depth = chunk[8];
+				colorType = chunk[9];
+				// Compression and filter method 0, no interlacing, 8 bits per channel
+				if (depth != 8 || chunk[10] != 0 || chunk[11] != 0 || chunk[12] != 0 ||
+					(colorType != 0 && colorType != 2 && colorType != 3 && colorType != 4 && colorType != 6)) {
+					return false;
+				}
+				if (imageWidth == 0 || imageHeight == 0 || imageWidth > MAX_DIMENSION || imageHeight > MAX_DIMENSION ||
+					(uint64_t)imageWidth * imageHeight * 4 > MAX_PIXEL_BYTES) {
+					return false;
+				}
+			} else if (std::memcmp(type, "PLTE", 4) == 0) {
+
+				if (length % 3 != 0 || length > 256 * 3) {
+					return false;
+				}
+				for (uint32_t i = 0; i < length / 3; i++) {
+					std::memcpy(palette + i * 4, chunk + i * 3, 3);
+				}
+			} else if (std::memcmp(type, "tRNS", 4) == 0) {
+
+				// Colour-keyed transparency of grey and RGB images is left to stb_image
+				if (colorType != 3 || length > 256) {
+					return false;
+				}
+				for (uint32_t i = 0; i < length; i++) {
+					palette[i * 4 + 3] = chunk[i];
+				}
+				paletteAlpha = true;
+			} else if (std::memcmp(type, "IDAT", 4) == 0) {
+
+				if (!compressed) {
+					compressed = chunk;
+					compressedSize = length;
+				} else {
+					if (joined.empty()) {
+						joined.assign(compressed, compressed + compressedSize);
+					}
+					joined.insert(joined.end(), chunk, chunk + length);
+				}
+			} else if (std::memcmp(type, "IEND", 4) == 0) {
+				break;
+			} else if (!(type[0] & 32)) {
+				// Unknown critical chunk
+				return false;
+			}
+		}
+
+		if (!compressed) {
+			return false;
+		}
+		if (!joined.empty()) {
+			compressed = joined.data();
+			compressedSize = joined.size();
+		}
+
+		int sourceChannels = colorType == 6 ? 4 : colorType == 2 ? 3 : colorType == 4 ? 2 : 1;
+		int imageChannels = colorType == 3 ? (paletteAlpha ? 4 : 3) : sourceChannels;
+		int outChannels = desiredChannels ? desiredChannels : imageChannels;
+		if (outChannels != 3 && outChannels != 4) {
+			return false;
+		}
+
+		// Every row is a filter type byte followed by the filtered bytes
+		size_t stride = (size_t)imageWidth * sourceChannels;
+		size_t rawSize = (size_t)imageHeight * (stride + 1);
+		std::vector<unsigned char> raw(rawSize + 8);
+		if (!Inflate(compressed, compressedSize, raw.data(), rawSize)) {
+			return false;
+		}
+		joined = std::vector<unsigned char>();
+
+		pixels.resize((size_t)imageWidth * imageHeight * outChannels);
+		size_t outStride = (size_t)imageWidth * outChannels;
+
+		// Rows are unfiltered in place, each against the one above it, and written out in the same pass
+		std::vector<unsigned char> zeroRow(stride, 0);
+		const unsigned char* prior = zeroRow.data();
+		for (uint32_t y = 0; y < imageHeight; y++) {
+
+			unsigned char* row = raw.data() + y * (stride + 1);
+			if (!Unfilter(row[0], row + 1, prior, stride, sourceChannels)) {
+				return false;
+			}
+
+			uint32_t outRow = flip ? imageHeight - 1 - y : y;
+			ExpandRow(row + 1, pixels.data() + outRow * outStride, (int)imageWidth, colorType, outChannels, palette);
+			prior = row + 1;
+		}
+
+		*width = (int)imageWidth;
+		*height = (int)imageHeight;
+		*channels = imageChannels;
+		return true;
+	}
+}
@@ -0,0 +1,26 @@
+#ifndef PngDecoder_hpp
+#define PngDecoder_hpp
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+	// PNG decoding for the texture loaders, faster than stb_image on the images this project ships:
+	// inflate runs on a 64-bit bit buffer with table lookups for whole codes, the row filters are
+	// undone with SSE2 where available, and rows are written flipped and expanded in the same pass.
+	// Handles non-interlaced 8-bit images of every colour type; anything else is left to stb_image.
+	class PngDecoder {
+
+	public:
+		static bool IsPng(const unsigned char* data, size_t size);
+
+		// Decodes to 3 or 4 channels (desiredChannels 0 keeps the image's own count when it is 3 or 4),
+		// the first row at the bottom when flip is set. Returns false when the file is corrupt or uses
+		// a feature this decoder leaves to stb_image.
+		static bool Decode(const unsigned char* data, size_t size, std::vector<unsigned char>& pixels,
+						   int* width, int* height, int* channels, int desiredChannels, bool flip);
+	};
+}
+
+#endif /* PngDecoder_hpp */
@@ -0,0 +1,152 @@
+#include "RenderQueue.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace gps {
+
+	uint64_t RenderQueue::MakeKey(RenderPass pass, uint32_t program, uint32_t material, float depth) {
+
+		// The bits of a non-negative float order like the float itself
+		uint32_t depthBits;
+		depth = std::max(depth, 0.0f);
+		std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+		return ((uint64_t)pass << 62) |
+			   ((uint64_t)(program & (MAX_PROGRAMS - 1)) << 56) |
+			   ((uint64_t)(material & (MAX_MATERIALS - 1)) << 32) |
+			   depthBits;
+	}
+
+	uint32_t RenderQueue::AddProgram(gps::Shader& shader, GLint modelLoc, GLint normalMatrixLoc) {
+
+		programs.push_back(Program{ &shader, modelLoc, normalMatrixLoc });
+		return (uint32_t)programs.size() - 1;
+	}
+
+	uint32_t RenderQueue::MaterialId(const gps::Mesh& mesh) {
+
+		// FNV-1a over the GL ids of the array textures the mesh binds, in binding order; meshes sampling other
+		// layers of the same arrays bind the same textures and share the id
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t unit = 0; unit < SAMPLED_TEXTURE_COUNT; unit++) {
+			hash = (hash ^ mesh.getSampledArray(unit)) * 1099511628211ull;
+		}
+
+		auto found = materials.find(hash);
+		if (found != materials.end()) {
+			return found->second;
+		}
+		// Ids past the key's range share the last one, which only costs sorting quality
+		uint32_t id = std::min((uint32_t)materials.size() + 1, MAX_MATERIALS - 1);
+		materials.emplace(hash, id);
+		return id;
+	}
+
+	uint32_t RenderQueue::AddObject(const DrawObject& object) {
+
+		objects.push_back(object);
+		return (uint32_t)objects.size() - 1;
+	}
+
+	void RenderQueue::Push(uint64_t key, const DrawPacket& packet) {
+
+		entries.push_back(SortEntry{ key, (uint32_t)packets.size() });
+		packets.push_back(packet);
+	}
+
+	// Least significant digit first, 8 bits per pass; passes where every key has the same digit
+	// are skipped, which with few programs and materials is most of the upper ones
+	void RenderQueue::Sort() {
+
+		sortScratch.resize(entries.size());
+
+		for (int shift = 0; shift < 64; shift += 8) {
+
+			size_t counts[256] = {};
+			for (const SortEntry& entry : entries) {
+				counts[(entry.key >> shift) & 0xFF]++;
+			}
+			if (entries.empty() || counts[(entries[0].key >> shift) & 0xFF] == entries.size()) {
+				continue;
+			}
+
+			size_t offset = 0;
+			for (size_t& count : counts) {
+				size_t digitCount = count;
+				count = offset;
+				offset += digitCount;
+			}
+
+			// Stable, so the order of the lower digits is kept
+			for (const SortEntry& entry : entries) {
+				sortScratch[counts[(entry.key >> shift) & 0xFF]++] = entry;
+			}
+			entries.swap(sortScratch);
+		}
+	}
+
+	void RenderQueue::Submit(RenderPass pass, DrawStats& stats) {
+
+		uint64_t passStart = (uint64_t)pass << 62;
+		auto begin = std::lower_bound(entries.begin(), entries.end(), passStart,
+									  [](const SortEntry& entry, uint64_t key) { return entry.key < key; });
+
+		uint32_t currentProgram = UINT32_MAX;
+		uint32_t currentObject = UINT32_MAX;
+
+		for (auto entry = begin; entry != entries.end() && (entry->key >> 62) == (uint64_t)pass; ++entry) {
+
+			const DrawPacket& packet = packets[entry->packet];
+			if (packet.buffers == nullptr) {
+				if (packet.draw != nullptr) {
+					packet.draw();
+				}
+				// The callback may have changed the program
+				currentProgram = UINT32_MAX;
+				continue;
+			}
+
+			Program& program = programs[packet.program];
+			if (packet.program != currentProgram) {
+				program.shader->useShaderProgram();
+				currentProgram = packet.program;
+				currentObject = UINT32_MAX;
+			}
+
+			const DrawObject& object = objects[packet.object];
+			if (packet.object != currentObject) {
+				program.shader->setMat4(program.modelLoc, object.modelMatrix);
+				program.shader->setMat3(program.normalMatrixLoc, object.normalMatrix);
+				currentObject = packet.object;
+			}
+
+			const ClusterView* clusterView = object.cullClusters ? &object.clusterView : nullptr;
+			ranges.clear();
+			for (uint32_t p = packet.firstPart; p < packet.firstPart + packet.partCount; p++) {
+				parts[p].mesh->CollectRanges(parts[p].level, clusterView, stats, ranges);
+			}
+			if (ranges.empty()) {
+				continue;
+			}
+
+			stats.drawCalls++;
+			if (pass == RenderPass::Shadow) {
+				// Positions only, no textures
+				packet.buffers->DrawDepth(*program.shader, ranges);
+			} else {
+				parts[packet.firstPart].mesh->BindTextures(*program.shader);
+				packet.buffers->Draw(*program.shader, ranges);
+			}
+		}
+	}
+
+	void RenderQueue::Clear() {
+
+		objects.clear();
+		packets.clear();
+		parts.clear();
+		entries.clear();
+	}
+
+}
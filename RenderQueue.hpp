@@ -0,0 +1,116 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+	// Passes of a frame, in the order they are drawn
+	enum class RenderPass : uint8_t {
+		Shadow = 0,
+		Opaque = 1,
+		Sky = 2,
+		Overlay = 3
+	};
+
+	// Per-object state the packets of one object share within a pass
+	struct DrawObject {
+		glm::mat4 modelMatrix;
+		// Not read by programs without a normal matrix uniform
+		glm::mat3 normalMatrix;
+		// The pass's view of the object, clusters are culled against it
+		ClusterView clusterView;
+		bool cullClusters = true;
+	};
+
+	// Mesh and level of detail a packet draws
+	struct DrawPart {
+		const gps::Mesh* mesh;
+		size_t level;
+	};
+
+	struct DrawPacket {
+		// Buffers the parts live in, null for packets drawn by their callback
+		const gps::MeshBuffers* buffers = nullptr;
+		// Range of the queue's parts drawn together in one call, all binding the same arrays
+		uint32_t firstPart = 0;
+		uint32_t partCount = 0;
+		uint32_t program = 0;
+		uint32_t object = 0;
+		// Draws the packet when it has no buffers, sets its own state
+		void (*draw)() = nullptr;
+	};
+
+	// Draws of a frame collected from every pass and submitted in the order of 64-bit sort keys:
+	// pass (2 bits), program (6), material (24) and depth (32). Within a pass, draws using the same
+	// program and the same texture arrays end up next to each other, nearest first, so state changes
+	// are grouped and early-Z rejects most hidden fragments before the lighting runs.
+	class RenderQueue {
+
+	public:
+		static const uint32_t MAX_PROGRAMS = 1 << 6;
+		static const uint32_t MAX_MATERIALS = 1 << 24;
+
+		// Sort key of a draw; depth grows with distance and must not be negative
+		static uint64_t MakeKey(RenderPass pass, uint32_t program, uint32_t material, float depth);
+
+		// Registers a program packets can refer to by the returned id, with the uniforms set per object
+		// (-1 for ones it does not have)
+		uint32_t AddProgram(gps::Shader& shader, GLint modelLoc, GLint normalMatrixLoc);
+
+		// Small id of the set of array textures a mesh binds, stable across frames
+		uint32_t MaterialId(const gps::Mesh& mesh);
+
+		uint32_t AddObject(const DrawObject& object);
+
+		// Adds a part for the next packet, whose firstPart is the part count before its first one
+		void AddPart(const gps::Mesh& mesh, size_t level) { parts.push_back(DrawPart{ &mesh, level }); }
+
+		uint32_t GetPartCount() const { return (uint32_t)parts.size(); }
+
+		void Push(uint64_t key, const DrawPacket& packet);
+
+		// Orders the packets by key with a radix sort, call once every packet of the frame is in
+		void Sort();
+
+		// Draws the sorted packets of one pass, counting the submitted work into stats
+		void Submit(RenderPass pass, DrawStats& stats);
+
+		// Drops the packets, parts and objects of the frame, keeping programs and materials
+		void Clear();
+
+		size_t GetPacketCount() const { return packets.size(); }
+
+	private:
+		struct Program {
+			gps::Shader* shader;
+			GLint modelLoc;
+			GLint normalMatrixLoc;
+		};
+
+		struct SortEntry {
+			uint64_t key;
+			uint32_t packet;
+		};
+
+		std::vector<Program> programs;
+		// Material ids by a hash of the bound texture ids they stand for
+		std::unordered_map<uint64_t, uint32_t> materials;
+		std::vector<DrawObject> objects;
+		std::vector<DrawPacket> packets;
+		std::vector<DrawPart> parts;
+		// Index ranges of the packet being submitted, kept to avoid allocating every frame
+		DrawRanges ranges;
+		std::vector<SortEntry> entries;
+		// Second buffer the radix sort ping-pongs with, kept to avoid allocating every frame
+		std::vector<SortEntry> sortScratch;
+	};
+
+}
+
+#endif /* RenderQueue_hpp */
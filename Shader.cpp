@@ -7,8 +7,18 @@
 //
 
 #include "Shader.hpp"
+#include "GLState.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
 
 namespace gps {
+
+    UniformStats Shader::uniformStats;
+
     std::string Shader::readShaderFile(std::string fileName) {
 
         std::ifstream shaderFile;
@@ -89,11 +99,122 @@ namespace gps {
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+
+        reflectUniforms();
     }
     
     void Shader::useShaderProgram() {
 
-        glUseProgram(this->shaderProgram);
+        GLState::Get().UseProgram(this->shaderProgram);
+    }
+
+    void Shader::reflectUniforms() {
+
+        uniformLocations.clear();
+        uniformValues.clear();
+
+        GLint uniformCount = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+        std::vector<GLchar> nameBuffer(std::max(maxNameLength, 1));
+
+        for (GLint i = 0; i < uniformCount; i++) {
+
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(this->shaderProgram, (GLuint)i, (GLsizei)nameBuffer.size(), &length, &size, &type, nameBuffer.data());
+
+            std::string name(nameBuffer.data(), length);
+            GLint location = glGetUniformLocation(this->shaderProgram, name.c_str());
+            // Members of uniform blocks have no location
+            if (location < 0) {
+                continue;
+            }
+
+            // Arrays are reported by their first element, "name[0]"
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+
+                std::string base = name.substr(0, name.size() - 3);
+                uniformLocations[base] = location;
+
+                for (GLint element = 0; element < size; element++) {
+
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = glGetUniformLocation(this->shaderProgram, elementName.c_str());
+                }
+            } else {
+                uniformLocations[name] = location;
+            }
+        }
+    }
+
+    GLint Shader::getUniformLocation(std::string_view name) const {
+
+        auto found = uniformLocations.find(name);
+        return found != uniformLocations.end() ? found->second : -1;
+    }
+
+    bool Shader::bindUniformBlock(const GLchar* blockName, GLuint bindingPoint) {
+
+        GLuint blockIndex = glGetUniformBlockIndex(this->shaderProgram, blockName);
+        if (blockIndex == GL_INVALID_INDEX) {
+            return false;
+        }
+
+        glUniformBlockBinding(this->shaderProgram, blockIndex, bindingPoint);
+        return true;
+    }
+
+    bool Shader::storeValue(GLint location, const void* value, size_t size) {
+
+        UniformValue& stored = uniformValues[location];
+        if (stored.size == size && std::memcmp(stored.bytes, value, size) == 0) {
+            uniformStats.skipped++;
+            return false;
+        }
+
+        std::memcpy(stored.bytes, value, size);
+        stored.size = size;
+        uniformStats.issued++;
+        return true;
+    }
+
+    void Shader::setInt(GLint location, GLint value) {
+
+        if (location >= 0 && storeValue(location, &value, sizeof(value))) {
+            glUniform1i(location, value);
+        }
+    }
+
+    void Shader::setFloat(GLint location, GLfloat value) {
+
+        if (location >= 0 && storeValue(location, &value, sizeof(value))) {
+            glUniform1f(location, value);
+        }
+    }
+
+    void Shader::setVec3(GLint location, const glm::vec3& value) {
+
+        if (location >= 0 && storeValue(location, glm::value_ptr(value), sizeof(value))) {
+            glUniform3fv(location, 1, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setMat3(GLint location, const glm::mat3& value) {
+
+        if (location >= 0 && storeValue(location, glm::value_ptr(value), sizeof(value))) {
+            glUniformMatrix3fv(location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setMat4(GLint location, const glm::mat4& value) {
+
+        if (location >= 0 && storeValue(location, glm::value_ptr(value), sizeof(value))) {
+            glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+        }
     }
 
 }
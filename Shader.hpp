@@ -17,24 +17,82 @@
     #include <GL/glew.h>
 #endif
 
+#include <glm/glm.hpp>
+
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 
 
 namespace gps {
+
+    // Uniform uploads made through the setters of every shader, reset by whoever prints them
+    struct UniformStats {
+        // glUniform* calls issued
+        size_t issued = 0;
+        // Calls skipped because the uniform already held the value
+        size_t skipped = 0;
+    };
     
     class Shader {
 
     public:
         GLuint shaderProgram;
+        static UniformStats uniformStats;
+
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
         void useShaderProgram();
+
+        // Location of an active uniform from the table built at link time, -1 if the program has none by that
+        // name. Elements of array uniforms are listed as "name[i]" as well as the array as "name".
+        GLint getUniformLocation(std::string_view name) const;
+
+        // Points a uniform block of the program at a binding point, where a UniformBuffer supplies it;
+        // false if the program has no active block by that name
+        bool bindUniformBlock(const GLchar* blockName, GLuint bindingPoint);
+
+        // Set a uniform of this program, which must be in use. The GL call is skipped when the location
+        // already holds the value; location -1 is ignored, like glUniform* does.
+        void setInt(GLint location, GLint value);
+        void setFloat(GLint location, GLfloat value);
+        void setVec3(GLint location, const glm::vec3& value);
+        void setMat3(GLint location, const glm::mat3& value);
+        void setMat4(GLint location, const glm::mat4& value);
+
+        void setInt(std::string_view name, GLint value) { setInt(getUniformLocation(name), value); }
+        void setFloat(std::string_view name, GLfloat value) { setFloat(getUniformLocation(name), value); }
+        void setVec3(std::string_view name, const glm::vec3& value) { setVec3(getUniformLocation(name), value); }
+        void setMat3(std::string_view name, const glm::mat3& value) { setMat3(getUniformLocation(name), value); }
+        void setMat4(std::string_view name, const glm::mat4& value) { setMat4(getUniformLocation(name), value); }
     
     private:
+        // Lets the location table be searched with a string_view without building a std::string
+        struct NameHash {
+            using is_transparent = void;
+            size_t operator()(std::string_view name) const { return std::hash<std::string_view>()(name); }
+        };
+
+        // Last value set at a location, as raw bytes (a mat4 at most)
+        struct UniformValue {
+            GLuint bytes[16];
+            size_t size = 0;
+        };
+
+        std::unordered_map<std::string, GLint, NameHash, std::equal_to<>> uniformLocations;
+        std::unordered_map<GLint, UniformValue> uniformValues;
+
         std::string readShaderFile(std::string fileName);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
+
+        // Fills the location table with the active uniforms of the linked program
+        void reflectUniforms();
+
+        // Records value as the one held at location; false when it was already, so the upload can be skipped
+        bool storeValue(GLint location, const void* value, size_t size);
     };
     
 }
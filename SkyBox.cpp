@@ -7,6 +7,7 @@
 //
 
 #include "SkyBox.hpp"
+#include "GLState.hpp"
 
 namespace gps {
     
@@ -21,60 +22,88 @@ namespace gps {
         InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(gps::Shader& shader)
     {
+        GLState& state = GLState::Get();
         shader.useShaderProgram();
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+        // The sky is drawn at the far plane, where the cleared depth is
+        state.SetDepthFunc(GL_LEQUAL);
         
-        glDepthFunc(GL_LEQUAL);
-        
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+        state.BindVertexArray(skyboxVAO);
+        shader.setInt("skybox", 0);
+        state.BindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        
-        glDepthFunc(GL_LESS);
     }
     
     GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
     {
         GLuint textureID;
         glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
         
         int width,height, n;
-        unsigned char* image;
+        std::vector<unsigned char> image;
         int force_channels = 3;
         
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
+        GLState::Get().BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
+        textureBytes = 0;
+        bool compressed = LoadCompressedFaces(skyBoxFaces);
+        for(GLuint i = 0; !compressed && i < skyBoxFaces.size(); i++)
         {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
+            // Flipped like every other image the demo loads
+            if (!TextureLoader::LoadImage(skyBoxFaces[i], image, &width, &height, &n, force_channels, true)) {
                 fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
                 return false;
             }
             glTexImage2D(
                          GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
+                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.data()
                          );
+            // Drivers pad RGB8 to four bytes per texel
+            textureBytes += MipGenerator::ChainBytes(width, height, 1);
+        }
+        if (!compressed) {
+            uncompressedBytes = textureBytes;
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
         
         return textureID;
     }
     
+    // Uploads the faces' .dds files when every face has one, all of the same size and format
+    bool SkyBox::LoadCompressedFaces(const std::vector<const GLchar*>& skyBoxFaces)
+    {
+        if (!TextureLoader::SupportsBlockCompression(false)) {
+            return false;
+        }
+        
+        std::vector<CompressedImage> images(skyBoxFaces.size());
+        for (size_t i = 0; i < skyBoxFaces.size(); i++) {
+            if (!BlockCompression::LoadCompressed(skyBoxFaces[i], &images[i]) ||
+                images[i].format != images[0].format || images[i].width != images[0].width || images[i].height != images[0].height) {
+                return false;
+            }
+        }
+        
+        const CompressedImage& first = images[0];
+        GLenum internalFormat = first.format == BlockFormat::BC3 ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        GLsizei levelBytes = (GLsizei)BlockCompression::LevelBytes(first.format, first.width, first.height);
+        for (size_t i = 0; i < images.size(); i++) {
+            glCompressedTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)i, 0, internalFormat,
+                                   first.width, first.height, 0, levelBytes, images[i].data);
+        }
+        // Sampled without mipmaps, the smaller levels are not uploaded
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+        
+        textureBytes = images.size() * levelBytes;
+        uncompressedBytes = images.size() * MipGenerator::ChainBytes(first.width, first.height, 1);
+        return true;
+    }
+    
     void SkyBox::InitSkyBox()
     {
         GLfloat skyboxVertices[] = {
@@ -124,14 +153,14 @@ namespace gps {
         glGenVertexArrays(1, &(this->skyboxVAO));
         glGenBuffers(1, &skyboxVBO);
         
-        glBindVertexArray(skyboxVAO);
+        GLState::Get().BindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
         
         glEnableVertexAttribArray(0);
         glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
         
-        glBindVertexArray(0);
+        GLState::Get().BindVertexArray(0);
     }
     
     GLuint SkyBox::GetTextureId()
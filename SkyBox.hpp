@@ -11,6 +11,9 @@
 
 
 #include "Shader.hpp"
+#include "TextureLoader.hpp"
+#include "BlockCompression.hpp"
+#include "MipGenerator.hpp"
 #include "stb_image.h"
 
 #include <glm/glm.hpp>
@@ -25,13 +28,20 @@ namespace gps {
     public:
         SkyBox();
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        // View and projection come from the FrameData uniform block
+        void Draw(gps::Shader& shader);
         GLuint GetTextureId();
+        // GPU memory of the cubemap, and what it would take uncompressed
+        size_t GetTextureBytes() { return textureBytes; }
+        size_t GetUncompressedBytes() { return uncompressedBytes; }
     private:
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
+        size_t textureBytes = 0;
+        size_t uncompressedBytes = 0;
         GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        bool LoadCompressedFaces(const std::vector<const GLchar*>& cubeMapFaces);
         void InitSkyBox();
     };
 }
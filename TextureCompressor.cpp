@@ -0,0 +1,133 @@
+#include "BlockCompression.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+	bool IsImage(const std::filesystem::path& path) {
+
+		std::string extension = path.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+		return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp";
+	}
+
+	std::filesystem::path Normalize(const std::filesystem::path& path) {
+
+		std::error_code ec;
+		std::filesystem::path absolute = std::filesystem::absolute(path, ec);
+		return (ec ? path : absolute).lexically_normal();
+	}
+
+	// Images the materials below the directories use as specular maps, which the demo samples as linear
+	// data; the last word of a map_Ks line is the file, relative to the .mtl, after any options
+	std::set<std::filesystem::path> FindDataImages(int argc, const char* argv[]) {
+
+		std::set<std::filesystem::path> dataImages;
+		for (int a = 1; a < argc; a++) {
+
+			std::error_code ec;
+			for (auto it = std::filesystem::recursive_directory_iterator(argv[a], ec);
+				 !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+
+				if (!it->is_regular_file() || it->path().extension() != ".mtl") {
+					continue;
+				}
+
+				std::ifstream mtl(it->path());
+				std::string line;
+				while (std::getline(mtl, line)) {
+
+					std::istringstream words(line);
+					std::string keyword, word, fileName;
+					if (!(words >> keyword) || keyword != "map_Ks") {
+						continue;
+					}
+					while (words >> word) {
+						fileName = word;
+					}
+					if (!fileName.empty()) {
+						dataImages.insert(Normalize(it->path().parent_path() / fileName));
+					}
+				}
+			}
+		}
+		return dataImages;
+	}
+
+	// The .dds is rebuilt when the image was modified after it, when an older version of the tool wrote it, or
+	// when it was filtered in the other colour space
+	bool IsUpToDate(const std::filesystem::path& image, bool srgb) {
+
+		std::error_code ec;
+		auto compressedTime = std::filesystem::last_write_time(gps::BlockCompression::CompressedPath(image.string()), ec);
+		if (ec || compressedTime < std::filesystem::last_write_time(image, ec) || ec) {
+			return false;
+		}
+
+		gps::CompressedImage compressed;
+		return gps::BlockCompression::LoadCompressed(image.string(), &compressed) &&
+			   compressed.bakeVersion == gps::BlockCompression::BAKE_VERSION && compressed.srgb == srgb;
+	}
+}
+
+// Writes a block-compressed "<image>.dds" with a full mipmap chain next to every image below the directories, e.g.
+//   texture_compressor models skybox
+// Specular maps named by the .mtl files below the directories are filtered as linear data, every other image as sRGB colour
+int main(int argc, const char * argv[]) {
+
+	if (argc < 2) {
+		std::cerr << "Usage: " << argv[0] << " <directory>..." << std::endl;
+		return 1;
+	}
+
+	size_t compressedCount = 0;
+	size_t upToDateCount = 0;
+	size_t uncompressedTotal = 0;
+	size_t compressedTotal = 0;
+	bool failed = false;
+
+	std::set<std::filesystem::path> dataImages = FindDataImages(argc, argv);
+
+	for (int a = 1; a < argc; a++) {
+
+		std::error_code ec;
+		for (auto it = std::filesystem::recursive_directory_iterator(argv[a], ec);
+			 !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+
+			if (!it->is_regular_file() || !IsImage(it->path())) {
+				continue;
+			}
+			bool srgb = dataImages.count(Normalize(it->path())) == 0;
+			if (IsUpToDate(it->path(), srgb)) {
+				upToDateCount++;
+				continue;
+			}
+
+			size_t uncompressedBytes, compressedBytes;
+			if (!gps::BlockCompression::CompressFile(it->path().string(), srgb, &uncompressedBytes, &compressedBytes)) {
+				failed = true;
+				continue;
+			}
+			compressedCount++;
+			uncompressedTotal += uncompressedBytes;
+			compressedTotal += compressedBytes;
+		}
+		if (ec) {
+			std::cerr << "ERROR: cannot read directory " << argv[a] << ": " << ec.message() << std::endl;
+			return 1;
+		}
+	}
+
+	std::cout << "Compressed " << compressedCount << " images (" << upToDateCount << " up to date), "
+			  << uncompressedTotal / (1024.0 * 1024.0) << " MB of RGBA8 mipmaps -> "
+			  << compressedTotal / (1024.0 * 1024.0) << " MB" << std::endl;
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,829 @@
+#include "TextureLoader.hpp"
+#include "AssetPack.hpp"
+#include "GLState.hpp"
+#include "PngDecoder.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+	namespace {
+
+		double NowMs() {
+
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		// Channels a decoded image is uploaded with: colour has no sRGB one or two channel formats in core GL,
+		// so grey becomes RGB and grey with alpha stays RGBA
+		int UploadChannels(TextureRole role, int channels) {
+
+			if (role == TextureRole::Color) {
+				return channels == 1 || channels == 3 ? 3 : 4;
+			}
+			return channels;
+		}
+
+		// Shrinks RGBA pixels in place to their first channels, two channels keep grey and alpha
+		void PackChannels(std::vector<unsigned char>& pixels, int channels) {
+
+			size_t count = pixels.size() / 4;
+			unsigned char* out = pixels.data();
+			const unsigned char* in = pixels.data();
+
+			switch (channels) {
+			case 1:
+				for (size_t i = 0; i < count; i++, in += 4) {
+					*out++ = in[0];
+				}
+				break;
+			case 2:
+				for (size_t i = 0; i < count; i++, in += 4, out += 2) {
+					out[0] = in[0];
+					out[1] = in[3];
+				}
+				break;
+			case 3:
+				for (size_t i = 0; i < count; i++, in += 4, out += 3) {
+					out[0] = in[0];
+					out[1] = in[1];
+					out[2] = in[2];
+				}
+				break;
+			default:
+				return;
+			}
+			pixels.resize(count * channels);
+		}
+
+		bool IsPowerOfTwo(int n) {
+
+			return (n & (n - 1)) == 0;
+		}
+
+		bool IsCompressed(GLenum internalFormat) {
+
+			switch (internalFormat) {
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+			case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+				return true;
+			default:
+				return false;
+			}
+		}
+
+		// Channels per texel of an uncompressed internal format
+		int FormatChannels(GLenum internalFormat) {
+
+			switch (internalFormat) {
+			case GL_R8: return 1;
+			case GL_RG8: return 2;
+			case GL_RGB8:
+			case GL_SRGB8: return 3;
+			default: return 4;
+			}
+		}
+
+		GLenum PixelFormat(int channels) {
+
+			static const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+			return formats[channels - 1];
+		}
+
+		GLenum CompressedFormat(BlockFormat format, TextureRole role) {
+
+			bool alpha = format == BlockFormat::BC3;
+			if (role == TextureRole::Color) {
+				return alpha ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_SRGB_S3TC_DXT1_EXT;
+			}
+			return alpha ? GL_COMPRESSED_RGBA_S3TC_DXT5_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		}
+
+		// Bytes of one level of one layer, rows tightly packed
+		size_t LevelBytes(GLenum internalFormat, int width, int height) {
+
+			switch (internalFormat) {
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+			case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+				return BlockCompression::LevelBytes(BlockFormat::BC1, width, height);
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+				return BlockCompression::LevelBytes(BlockFormat::BC3, width, height);
+			default:
+				return (size_t)width * height * FormatChannels(internalFormat);
+			}
+		}
+
+		// Mid grey texels of the format, or compressed blocks of them, filling size bytes
+		std::vector<unsigned char> GreyData(GLenum internalFormat, size_t size) {
+
+			static const unsigned char grey[4][4] = { { 128 }, { 128, 255 }, { 128, 128, 128 }, { 128, 128, 128, 255 } };
+			// 565 grey in both BC1 endpoints and every index 0, BC3 puts an opaque alpha block in front
+			static const unsigned char bc1[8] = { 0x10, 0x84, 0x10, 0x84, 0, 0, 0, 0 };
+			static const unsigned char bc3[16] = { 255, 255, 0, 0, 0, 0, 0, 0, 0x10, 0x84, 0x10, 0x84, 0, 0, 0, 0 };
+
+			const unsigned char* unit;
+			size_t unitSize;
+			if (!IsCompressed(internalFormat)) {
+				unitSize = FormatChannels(internalFormat);
+				unit = grey[unitSize - 1];
+			} else if (LevelBytes(internalFormat, 4, 4) == sizeof(bc1)) {
+				unit = bc1;
+				unitSize = sizeof(bc1);
+			} else {
+				unit = bc3;
+				unitSize = sizeof(bc3);
+			}
+
+			std::vector<unsigned char> data(size);
+			for (size_t i = 0; i < size; i++) {
+				data[i] = unit[i % unitSize];
+			}
+			return data;
+		}
+	}
+
+	TextureLoader::~TextureLoader() {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		jobReady.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+	}
+
+	TextureLoader::TextureLayout TextureLoader::GetLayout(const std::string& fileName, TextureRole role) const {
+
+		TextureLayout layout;
+
+		// The precomputed chain only fits an array when its size is a power of two, and its mipmaps only
+		// suit the role when they were filtered in the colour space the role samples in
+		CompressedImage compressed;
+		if (SupportsBlockCompression(true) && BlockCompression::LoadCompressed(fileName, &compressed)) {
+			FitMaxSize(compressed);
+			if (compressed.srgb != (role == TextureRole::Color)) {
+				fprintf(stderr, "WARNING: %s was baked as %s, rerun texture_compressor\n", BlockCompression::CompressedPath(fileName).c_str(),
+						compressed.srgb ? "sRGB colour" : "linear data");
+			} else if (IsPowerOfTwo(compressed.width) && IsPowerOfTwo(compressed.height)) {
+				layout.internalFormat = CompressedFormat(compressed.format, role);
+				layout.width = compressed.width;
+				layout.height = compressed.height;
+				layout.levelCount = compressed.levelCount;
+				return layout;
+			}
+		}
+
+		int channels;
+		if (!ReadImageInfo(fileName, &layout.width, &layout.height, &channels)) {
+			layout.width = 1;
+			layout.height = 1;
+			channels = 3;
+		}
+
+		// The same halvings as FitMaxSize, then down to powers of two so images of similar size share an array
+		while (maxTextureSize > 0 && std::max(layout.width, layout.height) > maxTextureSize) {
+			layout.width = std::max(1, layout.width / 2);
+			layout.height = std::max(1, layout.height / 2);
+		}
+		while (!IsPowerOfTwo(layout.width)) {
+			layout.width &= layout.width - 1;
+		}
+		while (!IsPowerOfTwo(layout.height)) {
+			layout.height &= layout.height - 1;
+		}
+
+		layout.internalFormat = ChooseFormat(role, UploadChannels(role, channels));
+		layout.levelCount = MipGenerator::LevelCount(layout.width, layout.height);
+		return layout;
+	}
+
+	GLuint TextureLoader::Request(const std::vector<std::string>& fileNames, TextureRole role, const TextureLayout& layout) {
+
+		if (workers.empty()) {
+			StartWorkers();
+		}
+		if (requestedCount == 0) {
+			firstRequestTime = NowMs();
+			compressedCount = 0;
+			downscaledCount = 0;
+			resampledCount = 0;
+			requestedArrayCount = 0;
+		}
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+		GLState::Get().BindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+
+		// Mid grey in the smallest level until the images arrive, a single level is a complete mipmap chain
+		int lastLevel = layout.levelCount - 1;
+		int width = std::max(1, layout.width >> lastLevel);
+		int height = std::max(1, layout.height >> lastLevel);
+		GLsizei layerCount = (GLsizei)fileNames.size();
+		std::vector<unsigned char> placeholder = GreyData(layout.internalFormat, LevelBytes(layout.internalFormat, width, height) * layerCount);
+
+		if (IsCompressed(layout.internalFormat)) {
+			glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, lastLevel, layout.internalFormat, width, height, layerCount, 0,
+								   (GLsizei)placeholder.size(), placeholder.data());
+		} else {
+			int channels = FormatChannels(layout.internalFormat);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, lastLevel, layout.internalFormat, width, height, layerCount, 0,
+						 PixelFormat(channels), GL_UNSIGNED_BYTE, placeholder.data());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+			// Sampled like the RGBA expansion they replace: grey in every colour channel
+			if (channels <= 2) {
+				const GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, channels == 2 ? GL_GREEN : GL_ONE };
+				glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+			}
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, lastLevel);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, lastLevel);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		TextureArray& array = arrays[texture];
+		array.fileNames = fileNames;
+		array.role = role;
+		array.layout = layout;
+		array.storageBase = lastLevel;
+		QueueLayers(texture, array, ResolveBaseLevel(-1, layout.width, layout.height, layout.levelCount));
+
+		requestedCount += fileNames.size();
+		requestedArrayCount++;
+		return texture;
+	}
+
+	void TextureLoader::RequestLevels(GLuint texture, int baseLevel) {
+
+		auto found = arrays.find(texture);
+		if (found != arrays.end()) {
+			QueueLayers(texture, found->second, std::min(baseLevel, found->second.layout.levelCount - 1));
+		}
+	}
+
+	void TextureLoader::Evict(GLuint texture, int baseLevel) {
+
+		auto found = arrays.find(texture);
+		if (found == arrays.end() || !found->second.uploaded) {
+			return;
+		}
+		TextureArray& array = found->second;
+		TextureMemory& memory = array.memory;
+		baseLevel = std::min(baseLevel, memory.levelCount - 1);
+		if (baseLevel <= memory.baseLevel) {
+			return;
+		}
+
+		GLState::Get().BindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, baseLevel);
+		// A 0x0x0 image releases a level's storage, levels below the base do not affect completeness
+		for (int level = array.storageBase; level < baseLevel; level++) {
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_R8, 0, 0, 0, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+		}
+
+		array.storageBase = baseLevel;
+		memory.baseLevel = baseLevel;
+		memory.bytes = ChainBytes(memory, baseLevel);
+		memory.uncompressedBytes = ChainBytes(GL_RGBA8, memory.width, memory.height, baseLevel, memory.levelCount) * memory.layerCount;
+	}
+
+	void TextureLoader::Update() {
+
+		Process(uploadBudgetMs, false);
+	}
+
+	void TextureLoader::Finish() {
+
+		while (!requests.empty()) {
+			Process(-1.0, true);
+		}
+	}
+
+	void TextureLoader::Cancel(GLuint texture) {
+
+		requests.erase(texture);
+		arrays.erase(texture);
+	}
+
+	size_t TextureLoader::GetTextureBytes(GLuint texture) const {
+
+		TextureMemory memory;
+		return GetTextureMemory(texture, &memory) ? memory.bytes : 0;
+	}
+
+	size_t TextureLoader::GetUncompressedBytes(GLuint texture) const {
+
+		TextureMemory memory;
+		return GetTextureMemory(texture, &memory) ? memory.uncompressedBytes : 0;
+	}
+
+	bool TextureLoader::GetTextureMemory(GLuint texture, TextureMemory* memory) const {
+
+		auto found = arrays.find(texture);
+		if (found == arrays.end() || !found->second.uploaded) {
+			return false;
+		}
+		*memory = found->second.memory;
+		return true;
+	}
+
+	const char* TextureLoader::GetFormatName(GLenum internalFormat) {
+
+		switch (internalFormat) {
+		case GL_R8: return "R8";
+		case GL_RG8: return "RG8";
+		case GL_RGB8: return "RGB8";
+		case GL_RGBA8: return "RGBA8";
+		case GL_SRGB8: return "SRGB8";
+		case GL_SRGB8_ALPHA8: return "SRGB8_ALPHA8";
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: return "BC1";
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: return "BC3";
+		case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT: return "BC1 sRGB";
+		case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT: return "BC3 sRGB";
+		default: return "unknown";
+		}
+	}
+
+	size_t TextureLoader::ChainBytes(GLenum internalFormat, int width, int height, int firstLevel, int levelCount) {
+
+		size_t bytes = 0;
+		for (int level = firstLevel; level < levelCount; level++) {
+			int levelWidth = std::max(1, width >> level);
+			int levelHeight = std::max(1, height >> level);
+			switch (internalFormat) {
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+			case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+				bytes += BlockCompression::LevelBytes(BlockFormat::BC1, levelWidth, levelHeight);
+				break;
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+				bytes += BlockCompression::LevelBytes(BlockFormat::BC3, levelWidth, levelHeight);
+				break;
+			case GL_R8:
+				bytes += (size_t)levelWidth * levelHeight;
+				break;
+			case GL_RG8:
+				bytes += (size_t)levelWidth * levelHeight * 2;
+				break;
+			default:
+				// RGB8 is padded to four bytes per texel
+				bytes += (size_t)levelWidth * levelHeight * 4;
+				break;
+			}
+		}
+		return bytes;
+	}
+
+	size_t TextureLoader::ChainBytes(const TextureMemory& memory, int firstLevel) {
+
+		return ChainBytes(memory.internalFormat, memory.width, memory.height, firstLevel, memory.levelCount) * memory.layerCount;
+	}
+
+	void TextureLoader::Shutdown() {
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+			jobs.clear();
+		}
+		jobReady.notify_all();
+		for (std::thread& worker : workers) {
+			worker.join();
+		}
+		workers.clear();
+
+		decoded.clear();
+		requests.clear();
+		arrays.clear();
+		inFlightCount = 0;
+
+		for (PixelBuffer& pixelBuffer : pixelBuffers) {
+			if (pixelBuffer.fence) {
+				glDeleteSync(pixelBuffer.fence);
+			}
+			if (pixelBuffer.buffer) {
+				glDeleteBuffers(1, &pixelBuffer.buffer);
+			}
+			pixelBuffer = PixelBuffer();
+		}
+	}
+
+	bool TextureLoader::LoadImage(const std::string& fileName, std::vector<unsigned char>& pixels, int* width, int* height,
+								  int* channels, int desiredChannels, bool flip) {
+
+		AssetView asset;
+		MappedFile file;
+		if (!AssetPack::Get().Find(fileName, &asset)) {
+			if (!file.Open(fileName)) {
+				return false;
+			}
+			asset = { file.GetData(), file.GetSize(), 0 };
+		}
+
+		if (PngDecoder::IsPng(asset.data, asset.size) &&
+			PngDecoder::Decode(asset.data, asset.size, pixels, width, height, channels, desiredChannels, flip)) {
+			return true;
+		}
+
+		// Thread-local, other threads may be loading with the other orientation
+		stbi_set_flip_vertically_on_load_thread(flip);
+		unsigned char* decoded = stbi_load_from_memory(asset.data, (int)asset.size, width, height, channels, desiredChannels);
+		if (!decoded) {
+			return false;
+		}
+		pixels.assign(decoded, decoded + (size_t)*width * *height * (desiredChannels ? desiredChannels : *channels));
+		stbi_image_free(decoded);
+		return true;
+	}
+
+	bool TextureLoader::ReadImageInfo(const std::string& fileName, int* width, int* height, int* channels) {
+
+		AssetView asset;
+		MappedFile file;
+		if (!AssetPack::Get().Find(fileName, &asset)) {
+			if (!file.Open(fileName)) {
+				return false;
+			}
+			asset = { file.GetData(), file.GetSize(), 0 };
+		}
+		return stbi_info_from_memory(asset.data, (int)asset.size, width, height, channels) != 0;
+	}
+
+	bool TextureLoader::SupportsBlockCompression(bool srgb) {
+
+		return GLEW_EXT_texture_compression_s3tc && (!srgb || GLEW_EXT_texture_sRGB);
+	}
+
+	void TextureLoader::StartWorkers() {
+
+		stopping = false;
+
+		// Leave a core for the GL thread; hardware_concurrency() is 0 when unknown
+		unsigned hw = std::thread::hardware_concurrency();
+		unsigned threadCount = hw > 1 ? hw - 1 : 1;
+		for (unsigned t = 0; t < threadCount; t++) {
+			workers.emplace_back(&TextureLoader::WorkerLoop, this);
+		}
+	}
+
+	void TextureLoader::WorkerLoop() {
+
+		while (true) {
+
+			DecodeJob job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				jobReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (stopping) {
+					return;
+				}
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+
+			const TextureLayout& layout = job.layout;
+			DecodedImage image = { job.texture, job.serial, job.layer, {}, job.baseLevel, 0, false };
+
+			if (IsCompressed(layout.internalFormat)) {
+
+				// GetLayout only picks a compressed layout for a .dds that fits it
+				if (BlockCompression::LoadCompressed(job.fileName, &image.compressed)) {
+					image.droppedLevels = FitMaxSize(image.compressed);
+				}
+				if (image.compressed.width != layout.width || image.compressed.height != layout.height ||
+					image.compressed.levelCount != layout.levelCount) {
+					fprintf(stderr, "ERROR: could not load %s\n", BlockCompression::CompressedPath(job.fileName).c_str());
+					image.compressed.data = nullptr;
+					image.pixels = GreyData(layout.internalFormat, ChainBytes(layout.internalFormat, layout.width, layout.height,
+																			  job.baseLevel, layout.levelCount));
+				}
+			} else {
+
+				// Decoded as RGBA for the mipmap kernels, then packed down to the channels of the array
+				int width, height, channels;
+				bool srgb = job.role == TextureRole::Color;
+				if (!LoadImage(job.fileName, image.pixels, &width, &height, &channels, 4, true)) {
+					fprintf(stderr, "ERROR: could not load %s\n", job.fileName.c_str());
+					width = layout.width;
+					height = layout.height;
+					image.pixels = GreyData(GL_RGBA8, (size_t)width * height * 4);
+				}
+
+				image.droppedLevels = FitMaxSize(image.pixels, &width, &height, srgb);
+				if (width != layout.width || height != layout.height) {
+					// Non-power-of-two images are area-filtered down to the array's size
+					std::vector<unsigned char> resized((size_t)layout.width * layout.height * 4);
+					MipGenerator::Resize(image.pixels.data(), width, height, resized.data(), layout.width, layout.height, srgb);
+					image.pixels.swap(resized);
+					image.resampled = true;
+				}
+
+				MipGenerator::Generate(image.pixels, layout.width, layout.height, srgb);
+				int uploadChannels = FormatChannels(layout.internalFormat);
+				PackChannels(image.pixels, uploadChannels);
+
+				// Only the levels from the base down go to the GPU
+				size_t skipped = MipGenerator::ChainBytes(layout.width, layout.height, job.baseLevel) / 4 * uploadChannels;
+				image.pixels.erase(image.pixels.begin(), image.pixels.begin() + skipped);
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			decoded.push_back(std::move(image));
+			imageReady.notify_one();
+		}
+	}
+
+	// Uploads decoded images until the budget is spent, blocking for images and pixel buffers when wait is set
+	void TextureLoader::Process(double budgetMs, bool wait) {
+
+		double start = NowMs();
+		size_t uploaded = 0;
+
+		while (inFlightCount > 0) {
+
+			if (budgetMs >= 0.0 && uploaded > 0 && NowMs() - start >= budgetMs) {
+				break;
+			}
+
+			DecodedImage image;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				if (wait) {
+					imageReady.wait(lock, [this] { return !decoded.empty(); });
+				}
+				if (decoded.empty()) {
+					break;
+				}
+				image = std::move(decoded.front());
+				decoded.pop_front();
+			}
+
+			auto request = requests.find(image.texture);
+			bool current = request != requests.end() && request->second == image.serial;
+
+			if (current) {
+
+				if (!AcquirePixelBuffer(wait)) {
+					std::lock_guard<std::mutex> lock(mutex);
+					decoded.push_front(std::move(image));
+					break;
+				}
+				if (Upload(image)) {
+					requests.erase(request);
+				}
+			}
+			inFlightCount--;
+			uploaded++;
+		}
+
+		if (uploaded > 0 && requests.empty() && requestedCount > 0) {
+			std::cout << "Textures       : " << requestedCount << " in " << requestedArrayCount << " array textures streamed in "
+					  << (NowMs() - firstRequestTime) / 1000.0 << " s, " << compressedCount << " block-compressed, ";
+			if (maxTextureSize > 0) {
+				std::cout << downscaledCount << " downscaled to " << maxTextureSize << " max, ";
+			}
+			if (resampledCount > 0) {
+				std::cout << resampledCount << " resampled to power-of-two sizes, ";
+			}
+			std::cout << "mipmaps filtered with " << MipGenerator::GetKernelName() << std::endl;
+			requestedCount = 0;
+		}
+	}
+
+	// Makes sure the next pixel buffer in the ring is no longer read by the GPU
+	bool TextureLoader::AcquirePixelBuffer(bool wait) {
+
+		PixelBuffer& pixelBuffer = pixelBuffers[nextPixelBuffer];
+		if (!pixelBuffer.fence) {
+			return true;
+		}
+
+		GLuint64 timeout = wait ? 1000000000ull : 0;
+		GLenum status;
+		do {
+			status = glClientWaitSync(pixelBuffer.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		} while (wait && status == GL_TIMEOUT_EXPIRED);
+
+		if (status == GL_TIMEOUT_EXPIRED) {
+			return false;
+		}
+
+		glDeleteSync(pixelBuffer.fence);
+		pixelBuffer.fence = nullptr;
+		return true;
+	}
+
+	// Queues every layer of an array for decoding from baseLevel down
+	void TextureLoader::QueueLayers(GLuint texture, TextureArray& array, int baseLevel) {
+
+		size_t serial = nextSerial++;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (size_t layer = 0; layer < array.fileNames.size(); layer++) {
+				jobs.push_back({ texture, serial, (int)layer, array.fileNames[layer], array.role, array.layout, baseLevel });
+			}
+		}
+		jobReady.notify_all();
+
+		// A newer serial makes Process drop the images of an earlier request
+		requests[texture] = serial;
+		array.requestedBase = baseLevel;
+		array.pendingLayers = (int)array.fileNames.size();
+		inFlightCount += array.fileNames.size();
+	}
+
+	// Copies the image into the acquired pixel buffer and starts the transfer into its layer
+	bool TextureLoader::Upload(const DecodedImage& image) {
+
+		PixelBuffer& pixelBuffer = pixelBuffers[nextPixelBuffer];
+		TextureArray& array = arrays.at(image.texture);
+		const TextureLayout& layout = array.layout;
+		bool compressed = IsCompressed(layout.internalFormat);
+		GLsizei layerCount = (GLsizei)array.fileNames.size();
+		GLenum format = compressed ? 0 : PixelFormat(FormatChannels(layout.internalFormat));
+
+		GLState::Get().BindTexture(0, GL_TEXTURE_2D_ARRAY, image.texture);
+
+		// The first layer of a request to arrive allocates the levels it adds for every layer; the array keeps
+		// sampling its old base level until the last layer is in
+		for (int level = array.requestedBase; level < array.storageBase; level++) {
+			int width = std::max(1, layout.width >> level);
+			int height = std::max(1, layout.height >> level);
+			if (compressed) {
+				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, layout.internalFormat, width, height, layerCount, 0,
+									   (GLsizei)(LevelBytes(layout.internalFormat, width, height) * layerCount), nullptr);
+			} else {
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, layout.internalFormat, width, height, layerCount, 0, format,
+							 GL_UNSIGNED_BYTE, nullptr);
+			}
+		}
+		array.storageBase = std::min(array.storageBase, array.requestedBase);
+
+		// A .dds brings every level precomputed, the workers built the mipmaps of everything else, so no
+		// glGenerateMipmap stall on the GL thread; the resident levels are uploaded from one buffer
+		const unsigned char* data = image.pixels.data();
+		size_t size = image.pixels.size();
+		if (image.compressed.data) {
+			size_t baseOffset = BlockCompression::LevelOffset(image.compressed, image.baseLevel);
+			data = image.compressed.data + baseOffset;
+			size = image.compressed.size - baseOffset;
+			compressedCount++;
+		}
+		const unsigned char* source = static_cast<const unsigned char*>(FillPixelBuffer(data, size));
+
+		// Rows of one to three byte pixels are not 4-byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		size_t offset = 0;
+		for (int level = image.baseLevel; level < layout.levelCount; level++) {
+			int width = std::max(1, layout.width >> level);
+			int height = std::max(1, layout.height >> level);
+			size_t levelBytes = LevelBytes(layout.internalFormat, width, height);
+			if (compressed) {
+				glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, image.layer, width, height, 1, layout.internalFormat,
+										  (GLsizei)levelBytes, source + offset);
+			} else {
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, image.layer, width, height, 1, format, GL_UNSIGNED_BYTE,
+								source + offset);
+			}
+			offset += levelBytes;
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+		if (!array.uploaded) {
+			downscaledCount += image.droppedLevels > 0 ? 1 : 0;
+			resampledCount += image.resampled ? 1 : 0;
+		}
+
+		bool complete = --array.pendingLayers == 0;
+		if (complete) {
+
+			// Every layer holds the new levels, sample them; a .dds may stop short of 1x1
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, array.requestedBase);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, layout.levelCount - 1);
+
+			TextureMemory& memory = array.memory;
+			memory.internalFormat = layout.internalFormat;
+			memory.width = layout.width;
+			memory.height = layout.height;
+			memory.levelCount = layout.levelCount;
+			memory.layerCount = layerCount;
+			memory.baseLevel = array.requestedBase;
+			memory.bytes = ChainBytes(memory, memory.baseLevel);
+			memory.uncompressedBytes = ChainBytes(GL_RGBA8, memory.width, memory.height, memory.baseLevel, memory.levelCount) * layerCount;
+			array.uploaded = true;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		pixelBuffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		nextPixelBuffer = (nextPixelBuffer + 1) % PBO_COUNT;
+		return complete;
+	}
+
+	int TextureLoader::FitMaxSize(std::vector<unsigned char>& pixels, int* width, int* height, bool srgb) const {
+
+		// Each halving averages 2x2 texels in linear light, so every texel ends up the exact area average
+		// of its source block, with no aliasing from skipping texels
+		int halvings = 0;
+		std::vector<unsigned char> half;
+		while (maxTextureSize > 0 && std::max(*width, *height) > maxTextureSize) {
+			int halfWidth = std::max(1, *width / 2);
+			int halfHeight = std::max(1, *height / 2);
+			half.resize((size_t)halfWidth * halfHeight * 4);
+			MipGenerator::Downsample(pixels.data(), *width, *height, half.data(), srgb);
+			pixels.swap(half);
+			*width = halfWidth;
+			*height = halfHeight;
+			halvings++;
+		}
+		if (halvings > 0) {
+			pixels.shrink_to_fit();
+		}
+		return halvings;
+	}
+
+	int TextureLoader::FitMaxSize(CompressedImage& image) const {
+
+		// The levels are precomputed, the first one that fits becomes level 0
+		int skipped = 0;
+		while (maxTextureSize > 0 && skipped + 1 < image.levelCount &&
+			   std::max(image.width >> skipped, image.height >> skipped) > maxTextureSize) {
+			skipped++;
+		}
+		if (skipped > 0) {
+			size_t offset = BlockCompression::LevelOffset(image, skipped);
+			image.data += offset;
+			image.size -= offset;
+			image.width = std::max(1, image.width >> skipped);
+			image.height = std::max(1, image.height >> skipped);
+			image.levelCount -= skipped;
+		}
+		return skipped;
+	}
+
+	int TextureLoader::ResolveBaseLevel(int requested, int width, int height, int levelCount) const {
+
+		if (requested >= 0) {
+			return std::min(requested, levelCount - 1);
+		}
+		int level = 0;
+		while (startSize > 0 && level + 1 < levelCount && std::max(width >> level, height >> level) > startSize) {
+			level++;
+		}
+		return level;
+	}
+
+	GLenum TextureLoader::ChooseFormat(TextureRole role, int channels) {
+
+		static const GLenum linearFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+
+		if (role == TextureRole::Color) {
+			return channels == 4 ? GL_SRGB8_ALPHA8 : GL_SRGB8;
+		}
+		return linearFormats[channels - 1];
+	}
+
+	// Maps the acquired pixel buffer and fills it, returns where the upload reads from
+	const GLvoid* TextureLoader::FillPixelBuffer(const void* data, size_t size) {
+
+		PixelBuffer& pixelBuffer = pixelBuffers[nextPixelBuffer];
+
+		if (!pixelBuffer.buffer) {
+			glGenBuffers(1, &pixelBuffer.buffer);
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer.buffer);
+		if ((GLsizeiptr)size > pixelBuffer.capacity) {
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)size, nullptr, GL_STREAM_DRAW);
+			pixelBuffer.capacity = (GLsizeiptr)size;
+		}
+
+		// The fence guarantees the GPU is done with the previous contents
+		void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (GLsizeiptr)size,
+										GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if (mapped) {
+			std::memcpy(mapped, data, size);
+			if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+				return (const GLvoid*)0;
+			}
+		}
+
+		// Mapping failed or the contents were lost, upload from client memory instead
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return data;
+	}
+}
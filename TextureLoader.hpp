@@ -0,0 +1,264 @@
+#ifndef TextureLoader_hpp
+#define TextureLoader_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "BlockCompression.hpp"
+#include "MipGenerator.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+	// How a material samples a texture, which decides its internal format
+	enum class TextureRole {
+		// Colour the shader lights with (ambient, diffuse): stored sRGB and filtered in linear space
+		Color,
+		// Values read as they are stored (specular intensity): linear R8/RG8/RGB8/RGBA8 by channel count
+		Data
+	};
+
+	// Asynchronous texture loading into 2D array textures, one image per layer. Request hands out a texture id
+	// right away, holding a grey placeholder in its smallest level; worker threads read each image's block-compressed
+	// .dds when there is one, or decode the image (flipped as it is written), resample it to the array's size and
+	// build its mipmap chain, and Update streams the finished layers into their textures through a ring of pixel
+	// buffer objects on the GL thread, every level of a layer in one go. The array samples its images once all
+	// of its layers have arrived. The CPU pixels are dropped as soon as they are uploaded.
+	// A texture may hold only its smaller levels: RequestLevels streams larger ones in, Evict drops them again.
+	class TextureLoader {
+
+	public:
+		static const int PBO_COUNT = 4;
+
+		// Size and format every layer of an array texture shares
+		struct TextureLayout {
+			GLenum internalFormat;
+			// Size of level 0, powers of two
+			int width;
+			int height;
+			int levelCount;
+
+			bool operator==(const TextureLayout& other) const {
+				return internalFormat == other.internalFormat && width == other.width && height == other.height &&
+					   levelCount == other.levelCount;
+			}
+		};
+
+		// GPU memory of one uploaded texture
+		struct TextureMemory {
+			GLenum internalFormat;
+			// Size of level 0, which may not be resident
+			int width;
+			int height;
+			int levelCount;
+			int layerCount;
+			// Largest resident level, the texture's GL_TEXTURE_BASE_LEVEL
+			int baseLevel;
+			// Resident levels of every layer, RGB8 counted at the four bytes per texel drivers pad it to
+			size_t bytes;
+			// What the same levels would take as RGBA8
+			size_t uncompressedBytes;
+		};
+
+		// GL time Update may spend on uploads per call, at least one image is always uploaded
+		double uploadBudgetMs = 2.0;
+
+		// When set, Request uploads only the levels no larger than this and leaves the rest to RequestLevels;
+		// 0 uploads every level. Read by the workers, set it before the first request.
+		int startSize = 0;
+
+		// When set, larger images are halved on the workers until they fit, the levels above never reach
+		// the GPU; 0 keeps every image at full size. Set it before the first GetLayout.
+		int maxTextureSize = 0;
+
+		TextureLoader() = default;
+		~TextureLoader();
+
+		TextureLoader(const TextureLoader&) = delete;
+		TextureLoader& operator=(const TextureLoader&) = delete;
+
+		// Layout an image is uploaded with, from its file headers: its .dds as it is when the driver takes it and its
+		// size is a power of two, otherwise the image fitted to maxTextureSize and rounded down to powers of two.
+		// An unreadable image gets a 1x1 layout and loads as grey.
+		TextureLayout GetLayout(const std::string& fileName, TextureRole role) const;
+
+		// Creates an array texture with a layer per image file, all of them of the given layout, with placeholder
+		// content, and queues the images for decoding
+		GLuint Request(const std::vector<std::string>& fileNames, TextureRole role, const TextureLayout& layout);
+
+		// Queues an uploaded texture's images again to make them resident from baseLevel down, replacing
+		// any request still outstanding for it
+		void RequestLevels(GLuint texture, int baseLevel);
+
+		// Frees the levels above baseLevel of an uploaded texture, which keeps sampling the smaller ones
+		void Evict(GLuint texture, int baseLevel);
+
+		// Uploads decoded images until the budget is spent or a free pixel buffer is missing
+		void Update();
+
+		// Blocks until every requested texture holds its real image
+		void Finish();
+
+		// Forgets a request whose texture is being deleted, its image is dropped when it arrives
+		void Cancel(GLuint texture);
+
+		// Textures still waiting for an image, first ones and streamed levels
+		size_t GetPendingCount() const { return requests.size(); }
+
+		bool IsPending(GLuint texture) const { return requests.count(texture) != 0; }
+
+		// GPU memory of a texture's uploaded image and mipmaps, 0 while it shows the placeholder
+		size_t GetTextureBytes(GLuint texture) const;
+
+		// What GetTextureBytes would be if the texture were uncompressed RGBA8
+		size_t GetUncompressedBytes(GLuint texture) const;
+
+		// Format, size and memory of an uploaded texture, false while it shows the placeholder
+		bool GetTextureMemory(GLuint texture, TextureMemory* memory) const;
+
+		// Readable name of an internal format the loaders create, for reports
+		static const char* GetFormatName(GLenum internalFormat);
+
+		// GPU memory of levels firstLevel to levelCount - 1 of a texture in one of those formats
+		static size_t ChainBytes(GLenum internalFormat, int width, int height, int firstLevel, int levelCount);
+
+		// GPU memory of levels firstLevel and below of every layer of an uploaded texture
+		static size_t ChainBytes(const TextureMemory& memory, int firstLevel);
+
+		// Stops the workers and frees the pixel buffers, must run while the GL context exists
+		void Shutdown();
+
+		// Decodes an image file, from the asset pack when it holds it, with the first row at the bottom when flip
+		// is set. PNGs go through PngDecoder, everything it does not handle through stb_image; channels and
+		// desiredChannels work like stbi_load's.
+		static bool LoadImage(const std::string& fileName, std::vector<unsigned char>& pixels, int* width, int* height,
+							  int* channels, int desiredChannels, bool flip);
+
+		// Size and channel count of an image file from its headers, without decoding it
+		static bool ReadImageInfo(const std::string& fileName, int* width, int* height, int* channels);
+
+		// Whether the driver takes BC1/BC3 textures, sRGB ones too when srgb is set
+		static bool SupportsBlockCompression(bool srgb);
+
+	private:
+		struct DecodeJob {
+			GLuint texture;
+			// Tells the request apart from earlier ones for a recycled texture id
+			size_t serial;
+			int layer;
+			std::string fileName;
+			TextureRole role;
+			TextureLayout layout;
+			// Largest level to upload
+			int baseLevel;
+		};
+
+		struct DecodedImage {
+			GLuint texture;
+			size_t serial;
+			int layer;
+			// The levels from baseLevel down back to back, in the array's format; grey when the image failed to load
+			std::vector<unsigned char> pixels;
+			int baseLevel;
+			// Levels dropped to fit maxTextureSize
+			int droppedLevels;
+			// Whether the image was resampled to a power-of-two size
+			bool resampled;
+			// Used instead of pixels when its data is set
+			CompressedImage compressed;
+		};
+
+		struct TextureArray {
+			std::vector<std::string> fileNames;
+			TextureRole role;
+			TextureLayout layout;
+			// Smallest level index holding storage, levels above it are released
+			int storageBase;
+			// Base level of the outstanding request and its layers still to arrive
+			int requestedBase = 0;
+			int pendingLayers = 0;
+			// Set once the first request completed and the array samples its images
+			bool uploaded = false;
+			TextureMemory memory = {};
+		};
+
+		struct PixelBuffer {
+			GLuint buffer = 0;
+			GLsizeiptr capacity = 0;
+			// Signalled once the GPU has consumed the last upload from this buffer
+			GLsync fence = nullptr;
+		};
+
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable jobReady;
+		std::condition_variable imageReady;
+		std::deque<DecodeJob> jobs;
+		std::deque<DecodedImage> decoded;
+		bool stopping = false;
+
+		PixelBuffer pixelBuffers[PBO_COUNT];
+		int nextPixelBuffer = 0;
+
+		// Texture -> serial of its outstanding request, touched on the GL thread only
+		std::unordered_map<GLuint, size_t> requests;
+		std::unordered_map<GLuint, TextureArray> arrays;
+		size_t nextSerial = 0;
+		// Images still to come back from the workers, cancelled ones included
+		size_t inFlightCount = 0;
+		size_t requestedCount = 0;
+		size_t requestedArrayCount = 0;
+		size_t compressedCount = 0;
+		size_t downscaledCount = 0;
+		size_t resampledCount = 0;
+		double firstRequestTime = 0.0;
+
+		void StartWorkers();
+
+		void WorkerLoop();
+
+		// Uploads decoded images until the budget is spent, blocking for images and pixel buffers when wait is set
+		void Process(double budgetMs, bool wait);
+
+		// Makes sure the next pixel buffer in the ring is no longer read by the GPU
+		bool AcquirePixelBuffer(bool wait);
+
+		// Queues every layer of an array for decoding from baseLevel down
+		void QueueLayers(GLuint texture, TextureArray& array, int baseLevel);
+
+		// Copies the image into the acquired pixel buffer and starts the transfer into its layer, returns
+		// true when it was the last layer of its request and the array now samples the new levels
+		bool Upload(const DecodedImage& image);
+
+		// Halves RGBA pixels until they fit maxTextureSize, returns the number of halvings
+		int FitMaxSize(std::vector<unsigned char>& pixels, int* width, int* height, bool srgb) const;
+
+		// Skips the levels of a compressed image that exceed maxTextureSize, returns how many
+		int FitMaxSize(CompressedImage& image) const;
+
+		// Level a request starts uploading at: the requested one, or the largest within startSize
+		int ResolveBaseLevel(int requested, int width, int height, int levelCount) const;
+
+		// Internal format for an uncompressed image of the given role and channel count
+		static GLenum ChooseFormat(TextureRole role, int channels);
+
+		// Maps the acquired pixel buffer and fills it, returns where the upload reads from: an offset
+		// into the buffer, or the data itself when mapping failed
+		const GLvoid* FillPixelBuffer(const void* data, size_t size);
+	};
+}
+
+#endif /* TextureLoader_hpp */
@@ -0,0 +1,213 @@
+#include "TextureRegistry.hpp"
+#include "GLState.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <map>
+#include <vector>
+
+namespace gps {
+
+	TextureRegistry& TextureRegistry::Get() {
+
+		// Never destroyed: models may release their textures from static destructors
+		static TextureRegistry* registry = new TextureRegistry();
+		return *registry;
+	}
+
+	std::vector<TextureLayer> TextureRegistry::AcquireLayers(const std::vector<std::string>& fileNames, TextureRole role) {
+
+		struct Group {
+			TextureLoader::TextureLayout layout;
+			// Canonical path -> file name, sorted so the same images always make the same array
+			std::map<std::string, std::string> files;
+		};
+
+		// Images already resident stay in their arrays, the others are grouped by layout
+		std::string prefix = role == TextureRole::Color ? "color\n" : "data\n";
+		std::vector<std::string> keys;
+		std::vector<Group> groups;
+		for (const std::string& fileName : fileNames) {
+
+			keys.push_back(Canonicalize(fileName));
+			if (layers.count(prefix + keys.back()) != 0) {
+				continue;
+			}
+			TextureLoader::TextureLayout layout = loader.GetLayout(fileName, role);
+
+			auto group = std::find_if(groups.begin(), groups.end(), [&](const Group& g) { return g.layout == layout; });
+			if (group == groups.end()) {
+				group = groups.insert(groups.end(), Group{ layout, {} });
+			}
+			group->files.emplace(keys.back(), fileName);
+		}
+
+		for (const Group& group : groups) {
+
+			std::vector<std::string> groupFiles;
+			for (const auto& file : group.files) {
+				groupFiles.push_back(file.second);
+			}
+
+			GLuint texture = loader.Request(groupFiles, role, group.layout);
+			streamer.Add(texture);
+			std::string label = group.files.begin()->first;
+			if (groupFiles.size() > 1) {
+				label += " and " + std::to_string(groupFiles.size() - 1) + " more";
+			}
+
+			Entry& entry = entries[texture];
+			entry.references = 0;
+			entry.label = std::move(label);
+			for (const auto& file : group.files) {
+				entry.images.push_back(prefix + file.first);
+				layers.emplace(entry.images.back(), TextureLayer{ texture, (GLint)entry.images.size() - 1 });
+			}
+		}
+
+		std::vector<TextureLayer> result;
+		std::vector<GLuint> referenced;
+		for (const std::string& key : keys) {
+
+			result.push_back(layers.at(prefix + key));
+			if (std::find(referenced.begin(), referenced.end(), result.back().texture) == referenced.end()) {
+				referenced.push_back(result.back().texture);
+				entries.at(result.back().texture).references++;
+			}
+		}
+		return result;
+	}
+
+	void TextureRegistry::Release(GLuint texture) {
+
+		auto entry = entries.find(texture);
+		if (entry == entries.end() || --entry->second.references > 0) {
+			return;
+		}
+
+		loader.Cancel(texture);
+		streamer.Remove(texture);
+		glDeleteTextures(1, &texture);
+		GLState::Get().ForgetTexture(texture);
+		for (const std::string& image : entry->second.images) {
+			layers.erase(image);
+		}
+		entries.erase(entry);
+	}
+
+	GLuint TextureRegistry::GetBlackArray() {
+
+		if (blackArray == 0) {
+			const unsigned char black[4] = { 0, 0, 0, 255 };
+			glGenTextures(1, &blackArray);
+			GLState::Get().BindTexture(0, GL_TEXTURE_2D_ARRAY, blackArray);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, black);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		}
+		return blackArray;
+	}
+
+	void TextureRegistry::Update() {
+
+		streamer.Update(loader);
+		loader.Update();
+	}
+
+	void TextureRegistry::EnableStreaming(size_t budgetBytes) {
+
+		streamer.budgetBytes = budgetBytes;
+		loader.startSize = budgetBytes > 0 ? TextureStreamer::START_SIZE : 0;
+	}
+
+	size_t TextureRegistry::GetResidentBytes() const {
+
+		size_t bytes = 0;
+		for (const auto& entry : entries) {
+			bytes += loader.GetTextureBytes(entry.first);
+		}
+		return bytes;
+	}
+
+	size_t TextureRegistry::GetUncompressedBytes() const {
+
+		size_t bytes = 0;
+		for (const auto& entry : entries) {
+			bytes += loader.GetUncompressedBytes(entry.first);
+		}
+		return bytes;
+	}
+
+	void TextureRegistry::PrintMemoryReport(std::ostream& out) const {
+
+		struct Line {
+			const std::string* label;
+			TextureLoader::TextureMemory memory;
+		};
+
+		std::vector<Line> lines;
+		for (const auto& entry : entries) {
+			Line line = { &entry.second.label, {} };
+			if (loader.GetTextureMemory(entry.first, &line.memory)) {
+				lines.push_back(line);
+			}
+		}
+		std::sort(lines.begin(), lines.end(), [](const Line& a, const Line& b) { return a.memory.bytes > b.memory.bytes; });
+
+		size_t bytes = 0;
+		size_t uncompressedBytes = 0;
+		out << "Texture memory (" << lines.size() << " of " << entries.size() << " uploaded, mipmaps included):" << std::endl;
+		for (const Line& line : lines) {
+			const TextureLoader::TextureMemory& memory = line.memory;
+			out << "  " << std::setw(9) << std::fixed << std::setprecision(1) << memory.bytes / 1024.0 << " KB  "
+				<< std::setw(13) << std::left << TextureLoader::GetFormatName(memory.internalFormat) << std::right
+				<< std::max(1, memory.width >> memory.baseLevel) << "x" << std::max(1, memory.height >> memory.baseLevel) << " of "
+				<< memory.width << "x" << memory.height << ", " << memory.levelCount - memory.baseLevel << " levels, " << memory.layerCount
+				<< (memory.layerCount == 1 ? " layer  " : " layers  ") << *line.label << std::endl;
+			bytes += memory.bytes;
+			uncompressedBytes += memory.uncompressedBytes;
+		}
+		out << "  total " << bytes / (1024.0 * 1024.0) << " MB, " << uncompressedBytes / (1024.0 * 1024.0)
+			<< " MB as RGBA8" << std::endl;
+
+		const StreamingStats& stats = streamer.GetStats();
+		if (stats.budgetBytes > 0) {
+			out << "  streaming budget " << stats.budgetBytes / (1024.0 * 1024.0) << " MB: " << stats.residentBytes / (1024.0 * 1024.0)
+				<< " MB resident, " << stats.pendingBytes / (1024.0 * 1024.0) << " MB pending, " << stats.wantedBytes / (1024.0 * 1024.0)
+				<< " MB wanted, " << stats.texturesBelowWanted << " of " << stats.textureCount << " textures below wanted detail, "
+				<< stats.streamedIn << " stream-ins and " << stats.evicted << " evictions so far" << std::endl;
+		}
+		out << std::defaultfloat;
+	}
+
+	void TextureRegistry::Shutdown() {
+
+		loader.Shutdown();
+		streamer.Clear();
+
+		for (const auto& entry : entries) {
+			glDeleteTextures(1, &entry.first);
+			GLState::Get().ForgetTexture(entry.first);
+		}
+		entries.clear();
+		layers.clear();
+
+		if (blackArray != 0) {
+			glDeleteTextures(1, &blackArray);
+			GLState::Get().ForgetTexture(blackArray);
+			blackArray = 0;
+		}
+	}
+
+	std::string TextureRegistry::Canonicalize(const std::string& fileName) {
+
+		std::error_code ec;
+		std::filesystem::path path = std::filesystem::weakly_canonical(fileName, ec);
+		if (ec) {
+			path = std::filesystem::path(fileName).lexically_normal();
+		}
+		return path.generic_string();
+	}
+}
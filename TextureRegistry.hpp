@@ -0,0 +1,97 @@
+#ifndef TextureRegistry_hpp
+#define TextureRegistry_hpp
+
+#include "TextureLoader.hpp"
+#include "TextureStreamer.hpp"
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+	// Where one image of a model lives: an array texture and the layer within it
+	struct TextureLayer {
+		GLuint texture;
+		GLint layer;
+	};
+
+	// Process-wide table of array textures and the images they hold, keyed by role and canonical path.
+	// Images a model acquires that are not resident yet are grouped into one new array per size and
+	// format, so its meshes switch layers instead of textures; images already resident are used where
+	// they are, whichever model brought them in. An array is freed when its last user releases it.
+	class TextureRegistry {
+
+	public:
+		// The registry outlives every model, including the global ones destroyed after main returns
+		static TextureRegistry& Get();
+
+		TextureRegistry(const TextureRegistry&) = delete;
+		TextureRegistry& operator=(const TextureRegistry&) = delete;
+
+		// Returns the array texture and layer of every image file, in order, requesting an array from the loader
+		// for every group of new images with the same layout. Repeated files share a layer. Takes one reference
+		// to each distinct array returned.
+		std::vector<TextureLayer> AcquireLayers(const std::vector<std::string>& fileNames, TextureRole role);
+
+		// Drops one reference to an array texture, deleting it with the last one
+		void Release(GLuint texture);
+
+		// 1x1 black array texture (one layer) bound for the roles a mesh has no image for, created on first use
+		GLuint GetBlackArray();
+
+		// Streams mip levels in and out for what the last frame drew, then uploads finished images; once per frame
+		void Update();
+
+		// Textures acquired from now on start with their small levels only and grow within budgetBytes of GPU
+		// memory as they are needed on screen; call before the first Acquire
+		void EnableStreaming(size_t budgetBytes);
+
+		// Notes that a mesh sampling the texture covers projectedPixels on screen this frame
+		void RequestDetail(GLuint texture, float projectedPixels) { streamer.RequestDetail(texture, projectedPixels); }
+
+		TextureLoader& GetLoader() { return loader; }
+
+		const TextureStreamer& GetStreamer() const { return streamer; }
+
+		size_t GetResidentCount() const { return entries.size(); }
+
+		// GPU memory of the uploaded images including their mipmaps, placeholders are not counted
+		size_t GetResidentBytes() const;
+
+		// What the resident textures would take as uncompressed RGBA8
+		size_t GetUncompressedBytes() const;
+
+		// One line per uploaded texture (format, size, mip levels, layers, memory) largest first, then the totals
+		void PrintMemoryReport(std::ostream& out) const;
+
+		// Deletes every texture and stops the loader, must run while the GL context exists
+		void Shutdown();
+
+	private:
+		struct Entry {
+			size_t references;
+			// First image and the number of others, for reports
+			std::string label;
+			// Keys into layers of the images it holds
+			std::vector<std::string> images;
+		};
+
+		TextureLoader loader;
+		TextureStreamer streamer;
+		// Array texture id -> its users and images
+		std::unordered_map<GLuint, Entry> entries;
+		// Role and canonical path of every resident image -> where it lives
+		std::unordered_map<std::string, TextureLayer> layers;
+		GLuint blackArray = 0;
+
+		TextureRegistry() = default;
+
+		// Absolute, normalized form of a path so different spellings share an entry
+		static std::string Canonicalize(const std::string& fileName);
+	};
+}
+
+#endif /* TextureRegistry_hpp */
@@ -0,0 +1,185 @@
+#include "TextureStreamer.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace gps {
+
+	void TextureStreamer::Add(GLuint texture) {
+
+		textures[texture] = StreamedTexture();
+	}
+
+	void TextureStreamer::Remove(GLuint texture) {
+
+		textures.erase(texture);
+	}
+
+	void TextureStreamer::RequestDetail(GLuint texture, float projectedPixels) {
+
+		auto found = textures.find(texture);
+		if (found == textures.end()) {
+			return;
+		}
+		StreamedTexture& state = found->second;
+		if (state.lastUse != frame) {
+			state.lastUse = frame;
+			state.projectedPixels = projectedPixels;
+		} else {
+			state.projectedPixels = std::max(state.projectedPixels, projectedPixels);
+		}
+	}
+
+	void TextureStreamer::Update(TextureLoader& loader) {
+
+		size_t streamedIn = stats.streamedIn;
+		size_t evicted = stats.evicted;
+		stats = StreamingStats();
+		stats.budgetBytes = budgetBytes;
+		stats.streamedIn = streamedIn;
+		stats.evicted = evicted;
+
+		if (!IsEnabled()) {
+			frame++;
+			return;
+		}
+
+		struct Candidate {
+			GLuint texture;
+			StreamedTexture* state;
+			TextureLoader::TextureMemory memory;
+			int wanted;
+			float sampling;
+		};
+		// Textures asking for more levels, and textures that could give their largest one up
+		std::vector<Candidate> below;
+		std::vector<Candidate> donors;
+
+		for (auto& [texture, state] : textures) {
+
+			TextureLoader::TextureMemory memory;
+			if (!loader.GetTextureMemory(texture, &memory)) {
+				// Still the placeholder, or the image failed to load
+				continue;
+			}
+			stats.textureCount++;
+
+			int startLevel = StartLevel(memory);
+			float projectedPixels = frame - state.lastUse <= IDLE_FRAMES ? state.projectedPixels : 0.0f;
+			int wanted = WantedLevel(memory, projectedPixels, startLevel);
+			stats.wantedBytes += TextureLoader::ChainBytes(memory, wanted);
+
+			if (loader.IsPending(texture)) {
+				size_t requested = TextureLoader::ChainBytes(memory, state.requestedLevel);
+				stats.residentBytes += memory.bytes;
+				stats.pendingBytes += requested > memory.bytes ? requested - memory.bytes : 0;
+				stats.texturesBelowWanted += state.requestedLevel > wanted ? 1 : 0;
+				continue;
+			}
+
+			// Nothing on screen needs the levels above wanted any more; the one just above stays until it
+			// has gone unneeded for EVICT_FRAMES
+			if (memory.baseLevel < wanted) {
+				if (state.overResidentSince == 0) {
+					state.overResidentSince = frame;
+				}
+				int keepLevel = frame - state.overResidentSince >= EVICT_FRAMES ? wanted : wanted - 1;
+				if (memory.baseLevel < keepLevel) {
+					loader.Evict(texture, keepLevel);
+					loader.GetTextureMemory(texture, &memory);
+					stats.evicted++;
+				}
+				if (memory.baseLevel == wanted) {
+					state.overResidentSince = 0;
+				}
+			} else {
+				state.overResidentSince = 0;
+			}
+			stats.residentBytes += memory.bytes;
+
+			Candidate candidate = { texture, &state, memory, wanted, Sampling(memory, memory.baseLevel, projectedPixels) };
+			if (wanted < memory.baseLevel) {
+				below.push_back(candidate);
+				stats.texturesBelowWanted++;
+			} else if (memory.baseLevel < startLevel) {
+				donors.push_back(candidate);
+			}
+		}
+
+		// Most undersampled first; donors sorted so the most oversampled is at the back
+		auto bySampling = [](const Candidate& a, const Candidate& b) { return a.sampling < b.sampling; };
+		std::sort(below.begin(), below.end(), bySampling);
+		std::sort(donors.begin(), donors.end(), bySampling);
+
+		for (Candidate& candidate : below) {
+
+			const TextureLoader::TextureMemory& memory = candidate.memory;
+			size_t cost = TextureLoader::ChainBytes(memory, candidate.wanted) - memory.bytes;
+
+			// Take levels from the most oversampled textures while they stay twice as well sampled as the
+			// candidate, so the two do not trade the level back and forth
+			while (stats.residentBytes + stats.pendingBytes + cost > budgetBytes && !donors.empty()) {
+
+				Candidate& donor = donors.back();
+				if (donor.sampling * 0.5f < 2.0f * candidate.sampling) {
+					break;
+				}
+
+				size_t before = donor.memory.bytes;
+				loader.Evict(donor.texture, donor.memory.baseLevel + 1);
+				loader.GetTextureMemory(donor.texture, &donor.memory);
+				stats.residentBytes -= before - donor.memory.bytes;
+				stats.evicted++;
+
+				donor.sampling *= 0.5f;
+				if (donor.memory.baseLevel >= StartLevel(donor.memory)) {
+					donors.pop_back();
+				} else {
+					std::sort(donors.begin(), donors.end(), bySampling);
+				}
+			}
+
+			if (stats.residentBytes + stats.pendingBytes + cost > budgetBytes) {
+				stats.deniedBytes += cost;
+				continue;
+			}
+
+			loader.RequestLevels(candidate.texture, candidate.wanted);
+			candidate.state->requestedLevel = candidate.wanted;
+			stats.pendingBytes += cost;
+			stats.streamedIn++;
+		}
+
+		frame++;
+	}
+
+	int TextureStreamer::WantedLevel(const TextureLoader::TextureMemory& memory, float projectedPixels, int startLevel) {
+
+		if (projectedPixels <= 0.0f) {
+			return startLevel;
+		}
+
+		float wantedSize = projectedPixels * DETAIL_SCALE;
+		int size = std::max(memory.width, memory.height);
+		int level = startLevel;
+		while (level > 0 && (size >> level) < wantedSize) {
+			level--;
+		}
+		return level;
+	}
+
+	int TextureStreamer::StartLevel(const TextureLoader::TextureMemory& memory) {
+
+		int level = 0;
+		while (level + 1 < memory.levelCount && std::max(memory.width >> level, memory.height >> level) > START_SIZE) {
+			level++;
+		}
+		return level;
+	}
+
+	float TextureStreamer::Sampling(const TextureLoader::TextureMemory& memory, int baseLevel, float projectedPixels) {
+
+		float size = (float)std::max(1, std::max(memory.width >> baseLevel, memory.height >> baseLevel));
+		return size / (std::max(projectedPixels, 1.0f) * DETAIL_SCALE);
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef TextureStreamer_hpp
+#define TextureStreamer_hpp
+
+#include "TextureLoader.hpp"
+
+#include <cstddef>
+#include <unordered_map>
+
+namespace gps {
+
+	// Texture streaming counters for monitoring, refreshed by every TextureStreamer::Update
+	struct StreamingStats {
+		size_t budgetBytes = 0;
+		// Uploaded levels of every streamed texture
+		size_t residentBytes = 0;
+		// Levels requested from the loader that have not arrived yet
+		size_t pendingBytes = 0;
+		// What the levels the last frames asked for would take
+		size_t wantedBytes = 0;
+		// Stream-ins the budget held back in this update
+		size_t deniedBytes = 0;
+		size_t textureCount = 0;
+		// Textures holding less detail than their view asks for, pending ones included
+		size_t texturesBelowWanted = 0;
+		// Totals since the start
+		size_t streamedIn = 0;
+		size_t evicted = 0;
+	};
+
+	// Decides how many mipmap levels of each texture are resident. Textures start with their levels
+	// up to START_SIZE only; every frame the meshes report how large they are on screen, and Update
+	// streams in the levels that size calls for, or evicts levels nothing has needed for a while, keeping
+	// resident and pending levels within the budget. When the budget is short, textures that are the
+	// most oversampled on screen give up their largest level to the most undersampled ones.
+	class TextureStreamer {
+
+	public:
+		// Largest level a texture starts with
+		static const int START_SIZE = 128;
+
+		// Frames a texture stays wanted after it was last drawn
+		static const size_t IDLE_FRAMES = 120;
+
+		// Frames a texture keeps one level more than it is wanted at before it gives it up, so a mesh
+		// sitting near a level boundary does not stream the same level out and back in. Levels beyond
+		// that one go at once, and the budget takes even that one back when others are short
+		static const size_t EVICT_FRAMES = 60;
+
+		// Texels wanted per pixel of a mesh's projected diameter: UVs seldom stretch one texture
+		// exactly once across a mesh
+		static constexpr float DETAIL_SCALE = 2.0f;
+
+		// GPU memory the streamed textures may take, 0 disables streaming
+		size_t budgetBytes = 0;
+
+		bool IsEnabled() const { return budgetBytes > 0; }
+
+		void Add(GLuint texture);
+
+		void Remove(GLuint texture);
+
+		void Clear() { textures.clear(); }
+
+		// Notes that a mesh sampling the texture covers projectedPixels on screen this frame
+		void RequestDetail(GLuint texture, float projectedPixels);
+
+		// Requests and evicts levels for what the last frame drew, once per frame
+		void Update(TextureLoader& loader);
+
+		const StreamingStats& GetStats() const { return stats; }
+
+	private:
+		struct StreamedTexture {
+			// Largest projected size reported in the frame lastUse
+			float projectedPixels = 0.0f;
+			size_t lastUse = 0;
+			// Base level of the outstanding stream-in
+			int requestedLevel = 0;
+			// First frame of the current run holding more levels than wanted, 0 when it holds no more
+			size_t overResidentSince = 0;
+		};
+
+		std::unordered_map<GLuint, StreamedTexture> textures;
+		size_t frame = 1;
+		StreamingStats stats;
+
+		// Level whose size is at least DETAIL_SCALE texels per projected pixel, never above startLevel
+		static int WantedLevel(const TextureLoader::TextureMemory& memory, float projectedPixels, int startLevel);
+
+		// Level a texture was first uploaded with
+		static int StartLevel(const TextureLoader::TextureMemory& memory);
+
+		// Texels the resident base level spreads over each wanted texel, below 1 when undersampled
+		static float Sampling(const TextureLoader::TextureMemory& memory, int baseLevel, float projectedPixels);
+	};
+}
+
+#endif /* TextureStreamer_hpp */
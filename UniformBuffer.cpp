@@ -0,0 +1,44 @@
+#include "UniformBuffer.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+	UniformBuffer::~UniformBuffer() {
+
+		if (buffer != 0) {
+			glDeleteBuffers(1, &buffer);
+		}
+	}
+
+	void UniformBuffer::Create(GLuint bindingPoint, size_t size) {
+
+		contents.assign(size, 0);
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)size, contents.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, buffer);
+	}
+
+	bool UniformBuffer::Update(const void* data) {
+
+		if (std::memcmp(contents.data(), data, contents.size()) == 0) {
+			skippedWrites++;
+			return false;
+		}
+		std::memcpy(contents.data(), data, contents.size());
+
+		// Respecifying the whole store lets the driver hand out fresh memory instead of waiting
+		// for draws of the previous frame that still read the old contents
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)contents.size(), contents.data(), GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+		writes++;
+		return true;
+	}
+
+}
@@ -0,0 +1,48 @@
+#ifndef UniformBuffer_hpp
+#define UniformBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+	// Uniform buffer object bound to a fixed binding point, backing a std140 uniform block that any
+	// number of programs read once Shader::bindUniformBlock has pointed them at the same binding point
+	class UniformBuffer {
+
+	public:
+		UniformBuffer() = default;
+		UniformBuffer(const UniformBuffer&) = delete;
+		UniformBuffer& operator=(const UniformBuffer&) = delete;
+		~UniformBuffer();
+
+		// Allocates size bytes and binds the buffer to the binding point for good
+		void Create(GLuint bindingPoint, size_t size);
+
+		// Replaces the whole block with one write, skipped when data matches the last write.
+		// Returns whether the buffer was written.
+		bool Update(const void* data);
+
+		size_t GetWrites() const { return writes; }
+		size_t GetSkippedWrites() const { return skippedWrites; }
+		void ResetCounters() { writes = skippedWrites = 0; }
+
+	private:
+		GLuint buffer = 0;
+		// Copy of the last write, to detect unchanged blocks
+		std::vector<unsigned char> contents;
+		size_t writes = 0;
+		size_t skippedWrites = 0;
+	};
+
+}
+
+#endif /* UniformBuffer_hpp */
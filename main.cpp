@@ -22,7 +22,12 @@
 #include "Model3D.hpp"
 #include "Camera.hpp"
 #include "SkyBox.hpp"
+#include "AssetPack.hpp"
+#include "GLState.hpp"
+#include "UniformBuffer.hpp"
 
+#include <cstddef>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -33,25 +38,24 @@ int retina_width, retina_height;
 GLFWwindow* glWindow = NULL;
 
 glm::mat4 model;
-GLuint modelLoc;
+GLint modelLoc;
 glm::mat4 view;
-GLuint viewLoc;
 glm::mat4 projection;
-GLuint projectionLoc;
 glm::mat3 normalMatrix;
-GLuint normalMatrixLoc;
+GLint normalMatrixLoc;
 
 bool isSunOn;
 glm::vec3 lightDir;
-GLuint lightDirLoc;
 glm::vec3 lightColor;
-GLuint lightColorLoc;
 glm::mat4 lightRotation;
 
 const unsigned int SHADOW_WIDTH = 4092;
 const unsigned int SHADOW_HEIGHT = 4092;
 GLuint shadowMapFBO;
 GLuint depthMapTexture;
+GLint shadowMapLoc;
+// Depth program uniforms, looked up once so the shadow pass does no lookups per draw
+GLint depthModelLoc;
 
 bool sprint = false;
 double globalDeltaTime = 0.0f;
@@ -62,12 +66,43 @@ bool isPosOn;
 // glm::vec3 posColor = glm::vec3(5.0f, 2.5f, 0.5f);
 // GLuint posColorLoc;
 //	For multiple point lights
-const int MAX_POINT_LIGHTS = 10;
+//	Must match MAX_POINT_LIGHTS in basic.frag
+const int MAX_POINT_LIGHTS = 64;
 std::vector<glm::vec3> pointLightPositions;
 glm::vec3 pointLightColor = glm::vec3(5.0f, 2.5f, 0.5f);
 int numActiveLights = 0;
-GLuint numPointLightsLoc;
-GLuint pointLightColorLoc;
+
+//	Uniform blocks shared by every program, written once per frame.
+//	Both mirror the std140 layout of the blocks in the shaders.
+enum UniformBlockBinding : GLuint {
+	FRAME_DATA_BINDING = 0,
+	LIGHT_DATA_BINDING = 1
+};
+
+struct FrameData {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 lightSpaceTrMatrix;
+};
+
+//	Directions and positions in eye space; a vec3 takes 16 bytes unless a scalar follows it
+struct LightData {
+	glm::vec3 lightDir;
+	float padding0;
+	glm::vec3 lightColor;
+	float padding1;
+	glm::vec3 pointLightColor;
+	GLint numPointLights;
+	//	Array elements are 16 bytes apart in std140, w unused
+	glm::vec4 pointLightPositions[MAX_POINT_LIGHTS];
+};
+static_assert(offsetof(LightData, numPointLights) == 44 && offsetof(LightData, pointLightPositions) == 48,
+	"LightData does not match the std140 layout of the LightData block");
+
+FrameData frameData;
+LightData lightData;
+gps::UniformBuffer frameUniforms;
+gps::UniformBuffer lightUniforms;
 
 std::vector<const GLchar*> faces;
 gps::SkyBox mySkyBox;
@@ -104,6 +139,16 @@ gps::Shader depthShader;
 
 static int displayMode = 0;
 bool flatShading = false;
+bool clusterCulling = true;
+
+// Built by the asset_packer target; without it every asset is read from its own file
+std::string assetPackFile = "assets.pack";
+
+// GPU memory streamed model textures may take, 0 loads every texture at full resolution
+size_t textureBudgetMB = 256;
+
+// Largest width or height a model texture is uploaded with, 0 keeps them at their own size
+int maxTextureSize = 0;
 
 struct SceneObject {
     gps::Model3D* model;
@@ -117,6 +162,13 @@ struct SceneObject {
 
 std::vector<SceneObject> sceneObjects;
 
+//	Draws of every pass, sorted by program, material and depth before they are submitted
+gps::RenderQueue renderQueue;
+uint32_t sceneProgram;
+uint32_t depthProgram;
+uint32_t skyboxProgram;
+uint32_t snowProgram;
+
 gps::Shader snowShader;
 GLuint snowVAO, snowVBO;
 GLuint snowTexture;
@@ -124,7 +176,7 @@ bool snowEnabled = false;
 
 //	flat shading
 GLint isFlatShading = 0; // 0 = Smooth, 1 = Flat
-GLuint flatShadingLoc;
+GLint flatShadingLoc;
 
 //=====================================================================================================
 //	Collision detection functions
@@ -246,28 +298,24 @@ GLuint loadTexture(const char* path) {
 	glGenTextures(1, &textureID);
 
 	int width, height, nrComponents;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data) {
+	std::vector<unsigned char> data;
+	if (gps::TextureLoader::LoadImage(path, data, &width, &height, &nrComponents, 0, true)) {
 		GLenum format;
 		if (nrComponents == 1) format = GL_RED;
 		else if (nrComponents == 3) format = GL_RGB;
 		else if (nrComponents == 4) format = GL_RGBA;
 
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+		gps::GLState::Get().BindTexture(0, GL_TEXTURE_2D, textureID);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data.data());
 		glGenerateMipmap(GL_TEXTURE_2D);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
 	}
 	else {
 		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
 	}
 
 	return textureID;
@@ -288,7 +336,7 @@ void initSnow() {
 
 	glGenVertexArrays(1, &snowVAO);
 	glGenBuffers(1, &snowVBO);
-	glBindVertexArray(snowVAO);
+	gps::GLState::Get().BindVertexArray(snowVAO);
 	glBindBuffer(GL_ARRAY_BUFFER, snowVBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
 
@@ -299,23 +347,20 @@ void initSnow() {
 }
 
 void drawSnow() {
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	glDisable(GL_DEPTH_TEST);
+	gps::GLState& state = gps::GLState::Get();
+	state.SetBlend(true);
+	state.SetBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	state.SetDepthTest(false);
 
 	snowShader.useShaderProgram();
 
-	glUniform1f(glGetUniformLocation(snowShader.shaderProgram, "time"), (float)glfwGetTime());
+	snowShader.setFloat("time", (float)glfwGetTime());
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, snowTexture);
-	glUniform1i(glGetUniformLocation(snowShader.shaderProgram, "snowTexture"), 0);
+	state.BindTexture(0, GL_TEXTURE_2D, snowTexture);
+	snowShader.setInt("snowTexture", 0);
 
-	glBindVertexArray(snowVAO);
+	state.BindVertexArray(snowVAO);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
-
-	glEnable(GL_DEPTH_TEST);
-	glDisable(GL_BLEND);
 }
 
 //	Main logic
@@ -350,7 +395,6 @@ void processLights() {
 		} else {
 			pointLightColor = glm::vec3(0.f, 0.f, 0.f);
 		}
-		glUniform3fv(pointLightColorLoc, 1, glm::value_ptr(pointLightColor));
 	}
 
 	if (pressedKeys[GLFW_KEY_G]) {
@@ -361,7 +405,6 @@ void processLights() {
 		} else {
 			lightColor = glm::vec3(0.f, 0.f, 0.f);
 		}
-		glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 	}
 }
 
@@ -385,15 +428,15 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 
 		switch (displayMode) {
 			case 0: // Solid / Smooth
-				glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+				gps::GLState::Get().SetPolygonMode(GL_FILL);
 				break;
 
 			case 1: // Wireframe
-				glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+				gps::GLState::Get().SetPolygonMode(GL_LINE);
 				break;
 
 			case 2: // Polygonal (i think lol)
-				glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
+				gps::GLState::Get().SetPolygonMode(GL_POINT);
 				break;
 		}
 	}
@@ -411,6 +454,14 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 	if (key == GLFW_KEY_LEFT_SHIFT && action == GLFW_PRESS) {
 		sprint = !sprint;
 	}
+	if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+		clusterCulling = !clusterCulling;
+		std::cout << "Cluster culling " << (clusterCulling ? "on" : "off") << std::endl;
+	}
+	if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+		gps::TextureRegistry::Get().PrintMemoryReport(std::cout);
+		std::cout << "  skybox " << mySkyBox.GetTextureBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+	}
 	if (pressedKeys[GLFW_KEY_M]) {
 		snowEnabled = !snowEnabled;
 	}
@@ -418,7 +469,7 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
 		isFlatShading = !isFlatShading;
 
 		myCustomShader.useShaderProgram();
-		glUniform1i(flatShadingLoc, isFlatShading);
+		myCustomShader.setInt(flatShadingLoc, isFlatShading);
 
 		if(isFlatShading)
 			std::cout << "Shading: FLAT (Faceted)" << std::endl;
@@ -514,24 +565,43 @@ void setupPointLights() {
 	pointLightPositions.push_back(glm::vec3(16.0f, 0.f, 24.0f));	//	2nd area, in front of tunnel, 2nd one
 	pointLightPositions.push_back(glm::vec3(20.0f, 0.f, 30.0f));	//	2nd area, in front of gate
 
-	numActiveLights = pointLightPositions.size();
+	numActiveLights = std::min((int)pointLightPositions.size(), MAX_POINT_LIGHTS);
 }
 
-void updatePointLights() {
-	myCustomShader.useShaderProgram();
+glm::mat4 computeLightSpaceTrMatrix() {
+	glm::vec3 lightPosition = lightDir * 20.0f; // Move light back
+	glm::mat4 lightView = glm::lookAt(lightPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
 
-	// Update number of active lights
-	glUniform1i(numPointLightsLoc, numActiveLights);
 
-	// Transform light positions to eye space and send to shader
-	for (int i = 0; i < numActiveLights; i++) {
-		std::string uniformName = "pointLightPositions[" + std::to_string(i) + "]";
-		GLuint location = glGetUniformLocation(myCustomShader.shaderProgram, uniformName.c_str());
+	constexpr GLfloat orthoSize = 20.0f;
+	constexpr GLfloat near_plane = 0.1f;
+	constexpr GLfloat far_plane = 150.0f;
 
-		// Transform to eye space
-		glm::vec4 lightPosEye = view * glm::vec4(pointLightPositions[i], 1.0f);
-		glUniform3fv(location, 1, glm::value_ptr(glm::vec3(lightPosEye)));
+	glm::mat4 lightProjection = glm::ortho(
+		-orthoSize, orthoSize,
+		-orthoSize, orthoSize,
+		near_plane, far_plane
+	);
+	return lightProjection * lightView;
+}
+
+//	Writes the camera and lights of this frame to the shared uniform blocks
+void updateUniformBlocks() {
+	frameData.view = view;
+	frameData.projection = projection;
+	frameData.lightSpaceTrMatrix = computeLightSpaceTrMatrix();
+	frameUniforms.Update(&frameData);
+
+	lightData.lightDir = glm::inverseTranspose(glm::mat3(view)) * lightDir;
+	lightData.lightColor = lightColor;
+	lightData.pointLightColor = pointLightColor;
+	lightData.numPointLights = numActiveLights;
+
+	// Transform light positions to eye space
+	for (int i = 0; i < numActiveLights; i++) {
+		lightData.pointLightPositions[i] = view * glm::vec4(pointLightPositions[i], 1.0f);
 	}
+	lightUniforms.Update(&lightData);
 }
 
 bool initOpenGLWindow() {
@@ -579,8 +649,9 @@ bool initOpenGLWindow() {
 void initOpenGLState() {
 	glClearColor(0.5, 0.5, 0.5, 1.0);
 	glViewport(0, 0, retina_width, retina_height);
-	glEnable(GL_DEPTH_TEST);
-	glDepthFunc(GL_LESS);
+	gps::GLState::Get().SetDepthTest(true);
+	gps::GLState::Get().SetDepthFunc(GL_LESS);
+	gps::GLState::Get().SetPolygonMode(GL_FILL);
 	glEnable(GL_CULL_FACE);
 	glCullFace(GL_BACK);
 	glFrontFace(GL_CCW);
@@ -590,10 +661,26 @@ void initOpenGLState() {
 }
 
 void initObjects() {
+	if (!assetPackFile.empty()) {
+		if (gps::AssetPack::Get().Open(assetPackFile)) {
+			std::cout << "Asset pack     : " << assetPackFile << std::endl;
+		} else {
+			std::cout << "Asset pack     : " << assetPackFile << " not found, reading individual files" << std::endl;
+		}
+	}
+
+	gps::TextureRegistry::Get().EnableStreaming(textureBudgetMB * 1024 * 1024);
+	gps::TextureRegistry::Get().GetLoader().maxTextureSize = maxTextureSize;
+
 	snow_town.LoadModel("models/snow_town/snow_town.obj", "models/snow_town/");
 	campfire.LoadModel("models/campfire/campfire.obj", "models/campfire/");
 	flag.LoadModel("models/flagpole/flag.obj", "models/flagpole/");
 	pole.LoadModel("models/flagpole/pole.obj", "models/flagpole/");
+
+	const gps::MemoryStats& memory = gps::Model3D::memoryStats;
+	std::cout << "Index buffers  : " << memory.indexBufferBytes / 1024 << " KB ("
+			  << memory.indexBytesSaved / 1024 << " KB saved by 16-bit indices)" << std::endl;
+
 	// Initialize scene objects after loading models
 	initSceneObjects();
 
@@ -608,6 +695,12 @@ void initShaders() {
 	skyboxShader.useShaderProgram();
 	snowShader.loadShader("shaders/snow.vert", "shaders/snow.frag");
 	snowShader.useShaderProgram();
+
+	//	Every program reads the camera and lights from the same buffers
+	myCustomShader.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+	myCustomShader.bindUniformBlock("LightData", LIGHT_DATA_BINDING);
+	depthShader.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
+	skyboxShader.bindUniformBlock("FrameData", FRAME_DATA_BINDING);
 }
 
 void initUniforms() {
@@ -617,56 +710,47 @@ void initUniforms() {
     isPosOn = true;
 
     model = glm::mat4(1.0f);
-    modelLoc = glGetUniformLocation(myCustomShader.shaderProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    modelLoc = myCustomShader.getUniformLocation("model");
+    myCustomShader.setMat4(modelLoc, model);
 
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myCustomShader.shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     normalMatrix = glm::mat3(glm::inverseTranspose(view*model));
-    normalMatrixLoc = glGetUniformLocation(myCustomShader.shaderProgram, "normalMatrix");
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    normalMatrixLoc = myCustomShader.getUniformLocation("normalMatrix");
+    myCustomShader.setMat3(normalMatrixLoc, normalMatrix);
 
     projection = glm::perspective(glm::radians(45.0f),
         (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myCustomShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
 
     // Directional light
     lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
-    lightDirLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightDir");
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view)) * lightDir));
-
     lightColor = glm::vec3(0.1f, 0.1f, 0.15f);
-    lightColorLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightColor");
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 
-	flatShadingLoc = glGetUniformLocation(myCustomShader.shaderProgram, "isFlatShading");
-	glUniform1i(flatShadingLoc, isFlatShading);
+	flatShadingLoc = myCustomShader.getUniformLocation("isFlatShading");
+	myCustomShader.setInt(flatShadingLoc, isFlatShading);
+
+	shadowMapLoc = myCustomShader.getUniformLocation("shadowMap");
 
 	//	Point lights
     setupPointLights();
 
     //	Send data to gpu
-    numPointLightsLoc = glGetUniformLocation(myCustomShader.shaderProgram, "numPointLights");
-    pointLightColorLoc = glGetUniformLocation(myCustomShader.shaderProgram, "pointLightColor");
+    frameUniforms.Create(FRAME_DATA_BINDING, sizeof(FrameData));
+    lightUniforms.Create(LIGHT_DATA_BINDING, sizeof(LightData));
+    updateUniformBlocks();
 
-    glUniform1i(numPointLightsLoc, numActiveLights);
-    glUniform3fv(pointLightColorLoc, 1, glm::value_ptr(pointLightColor));
+    depthModelLoc = depthShader.getUniformLocation("model");
 
-    for (int i = 0; i < numActiveLights; i++) {
-        std::string uniformName = "pointLightPositions[" + std::to_string(i) + "]";
-        GLuint location = glGetUniformLocation(myCustomShader.shaderProgram, uniformName.c_str());
-        glm::vec4 lightPosEye = view * glm::vec4(pointLightPositions[i], 1.0f);
-        glUniform3fv(location, 1, glm::value_ptr(glm::vec3(lightPosEye)));
-    }
+    sceneProgram = renderQueue.AddProgram(myCustomShader, modelLoc, normalMatrixLoc);
+    depthProgram = renderQueue.AddProgram(depthShader, depthModelLoc, -1);
+    skyboxProgram = renderQueue.AddProgram(skyboxShader, -1, -1);
+    snowProgram = renderQueue.AddProgram(snowShader, -1, -1);
 }
 
 void initFBO() {
 	glGenFramebuffers(1, &shadowMapFBO);
 	glGenTextures(1, &depthMapTexture);
-	glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+	gps::GLState::Get().BindTexture(0, GL_TEXTURE_2D, depthMapTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
 				SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -692,40 +776,36 @@ void initSkybox() {
 	mySkyBox.Load(faces);
 }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-	glm::vec3 lightPosition = lightDir * 20.0f; // Move light back
-	glm::mat4 lightView = glm::lookAt(lightPosition, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-
-
-	constexpr GLfloat orthoSize = 20.0f;
-	constexpr GLfloat near_plane = 0.1f;
-	constexpr GLfloat far_plane = 150.0f;
+void queueObjects(gps::RenderPass pass) {
+	bool depthPass = pass == gps::RenderPass::Shadow;
 
-	glm::mat4 lightProjection = glm::ortho(
-		-orthoSize, orthoSize,
-		-orthoSize, orthoSize,
-		near_plane, far_plane
-	);
-	return lightProjection * lightView;
-}
-
-void drawObjects(gps::Shader shader, bool depthPass) {
-	shader.useShaderProgram();
-
-	// Draw all scene objects
+	// Queue all scene objects
 	for (const auto& obj : sceneObjects) {
-		glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"),
-						  1, GL_FALSE, glm::value_ptr(obj.modelMatrix));
-
+		// Both passes pick levels from the camera so shadows match the visible geometry,
+		// clusters are culled against the pass's own view
+		gps::DrawView drawView;
+		drawView.modelView = view * obj.modelMatrix;
+		drawView.pixelsPerUnit = retina_height / (2.0f * tanf(glm::radians(45.0f) * 0.5f));
+		drawView.modelClip = (depthPass ? frameData.lightSpaceTrMatrix : projection * view) * obj.modelMatrix;
+		drawView.cullClusters = clusterCulling;
+
+		gps::DrawObject object;
+		object.modelMatrix = obj.modelMatrix;
 		if (!depthPass) {
-			normalMatrix = glm::mat3(glm::inverseTranspose(view * obj.modelMatrix));
-			glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+			object.normalMatrix = glm::mat3(glm::inverseTranspose(view * obj.modelMatrix));
 		}
+		object.clusterView = gps::ClusterView::FromClipMatrix(drawView.modelClip);
+		object.cullClusters = clusterCulling;
 
-		obj.model->Draw(shader);
+		// The shadow pass reads positions only, so it skips textures and the interleaved vertex
+		obj.model->Queue(renderQueue, pass, depthPass ? depthProgram : sceneProgram, renderQueue.AddObject(object), drawView);
 	}
 }
 
+void drawSky() {
+	mySkyBox.Draw(skyboxShader);
+}
+
 float lastTimeStamp = glfwGetTime();
 int frameCount = 0;
 int lastFPSTime = 0;
@@ -742,19 +822,80 @@ void renderScene() {
     frameCount++;
     if (currentTimeStamp - lastFPSTime >= 1.0) {
         double fps = (double)frameCount / (currentTimeStamp - lastFPSTime);
-        std::cout << "FPS: " << fps << std::endl;
+        gps::DrawStats& stats = gps::Model3D::drawStats;
+        std::cout << "FPS: " << fps << " | triangles/frame: " << stats.triangles / frameCount
+                  << " of " << stats.fullTriangles / frameCount << " at full detail"
+                  << " | draws/frame: " << stats.drawCalls / frameCount;
+        if (stats.clusters > 0) {
+            std::cout << " | clusters culled: " << 100.0 * stats.culledClusters / stats.clusters << "%";
+        }
+        gps::TextureRegistry& textures = gps::TextureRegistry::Get();
+        size_t textureBytes = textures.GetResidentBytes() + mySkyBox.GetTextureBytes();
+        size_t uncompressedBytes = textures.GetUncompressedBytes() + mySkyBox.GetUncompressedBytes();
+        std::cout << " | textures: " << textures.GetResidentCount() << " arrays resident, "
+                  << textureBytes / (1024.0 * 1024.0) << " MB ("
+                  << (uncompressedBytes - textureBytes) / (1024.0 * 1024.0) << " MB saved over RGBA8)";
+        const gps::StreamingStats& streaming = textures.GetStreamer().GetStats();
+        if (streaming.budgetBytes > 0) {
+            std::cout << " | streaming: " << (streaming.residentBytes + streaming.pendingBytes) / (1024.0 * 1024.0) << " of "
+                      << streaming.budgetBytes / (1024.0 * 1024.0) << " MB, " << streaming.texturesBelowWanted
+                      << " below wanted detail";
+            if (streaming.deniedBytes > 0) {
+                std::cout << ", " << streaming.deniedBytes / (1024.0 * 1024.0) << " MB held back by the budget";
+            }
+        }
+        gps::UniformStats& uniforms = gps::Shader::uniformStats;
+        const gps::StateStats& stateStats = gps::GLState::Get().GetStats();
+        std::cout << " | state changes/frame: " << stateStats.issued / frameCount << " issued, "
+                  << stateStats.filtered / frameCount << " filtered";
+        std::cout << " | uniforms/frame: " << uniforms.issued / frameCount << " set, "
+                  << uniforms.skipped / frameCount << " unchanged, "
+                  << (double)(frameUniforms.GetWrites() + lightUniforms.GetWrites()) / frameCount << " block writes";
+        std::cout << std::endl;
+        stats = gps::DrawStats();
+        uniforms = gps::UniformStats();
+        frameUniforms.ResetCounters();
+        lightUniforms.ResetCounters();
+        gps::GLState::Get().ResetStats();
         lastFPSTime = currentTimeStamp;
         frameCount = 0;
     }
 
+    view = myCamera.getViewMatrix();
+    projection = glm::perspective(glm::radians(45.0f),
+        (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
+    updateUniformBlocks();
+
+    // Opaque passes, the snow overlay of the last frame changed these
+    gps::GLState& state = gps::GLState::Get();
+    state.SetDepthTest(true);
+    state.SetBlend(false);
+    state.SetDepthFunc(GL_LESS);
+
+    // Every draw of the frame, in submission order once sorted
+    renderQueue.Clear();
+    queueObjects(gps::RenderPass::Shadow);
+    queueObjects(gps::RenderPass::Opaque);
+
+    gps::DrawPacket skyPacket;
+    skyPacket.program = skyboxProgram;
+    skyPacket.draw = drawSky;
+    renderQueue.Push(gps::RenderQueue::MakeKey(gps::RenderPass::Sky, skyboxProgram, 0, 0.0f), skyPacket);
+
+	if (snowEnabled) {
+		gps::DrawPacket snowPacket;
+		snowPacket.program = snowProgram;
+		snowPacket.draw = drawSnow;
+		renderQueue.Push(gps::RenderQueue::MakeKey(gps::RenderPass::Overlay, snowProgram, 0, 0.0f), snowPacket);
+	}
+
+    renderQueue.Sort();
+
     // Shadow map pass
-    depthShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(depthShader.shaderProgram, "lightSpaceTrMatrix"),
-        1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
     glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
     glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
     glClear(GL_DEPTH_BUFFER_BIT);
-    drawObjects(depthShader, true);
+    renderQueue.Submit(gps::RenderPass::Shadow, gps::Model3D::drawStats);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
     // Main render pass
@@ -762,42 +903,62 @@ void renderScene() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     myCustomShader.useShaderProgram();
 
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-    updatePointLights();
-
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+    state.BindTexture(3, GL_TEXTURE_2D, depthMapTexture);
+    myCustomShader.setInt(shadowMapLoc, 3);
 
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view)) * lightDir));
-
-    projection = glm::perspective(glm::radians(45.0f),
-        (float)retina_width / (float)retina_height, 0.1f, 1000.0f);
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "shadowMap"), 3);
-    glUniformMatrix4fv(glGetUniformLocation(myCustomShader.shaderProgram, "lightSpaceTrMatrix"),
-            1, GL_FALSE, glm::value_ptr(computeLightSpaceTrMatrix()));
-
-    drawObjects(myCustomShader, false);
-    mySkyBox.Draw(skyboxShader, view, projection);
+    renderQueue.Submit(gps::RenderPass::Opaque, gps::Model3D::drawStats);
+    renderQueue.Submit(gps::RenderPass::Sky, gps::Model3D::drawStats);
+    renderQueue.Submit(gps::RenderPass::Overlay, gps::Model3D::drawStats);
+}
 
-	if (snowEnabled) {
-		drawSnow();
+//	Command line options
+void parseArguments(int argc, const char * argv[]) {
+	for (int i = 1; i < argc; i++) {
+		std::string argument = argv[i];
+
+		if (argument == "--verify-obj") {
+			gps::Model3D::loadOptions.verifyObjParser = true;
+		} else if (argument == "--obj-loader=tinyobj") {
+			gps::Model3D::loadOptions.objLoader = gps::ObjLoader::TinyObj;
+		} else if (argument == "--obj-loader=parallel") {
+			gps::Model3D::loadOptions.objLoader = gps::ObjLoader::Parallel;
+		} else if (argument == "--obj-loader=stream") {
+			gps::Model3D::loadOptions.objLoader = gps::ObjLoader::Streaming;
+		} else if (argument == "--no-mesh-optimize") {
+			gps::Model3D::loadOptions.optimizeMeshes = false;
+		} else if (argument == "--no-clusters") {
+			gps::Model3D::loadOptions.buildClusters = false;
+		} else if (argument == "--no-material-merge") {
+			gps::Model3D::loadOptions.mergeMaterials = false;
+		} else if (argument == "--no-lod") {
+			gps::Model3D::loadOptions.generateLods = false;
+		} else if (argument == "--vertex-format=float") {
+			gps::Model3D::loadOptions.vertexFormat = gps::VertexFormat::Float;
+		} else if (argument == "--vertex-format=packed") {
+			gps::Model3D::loadOptions.vertexFormat = gps::VertexFormat::Packed;
+		} else if (argument.rfind("--asset-pack=", 0) == 0) {
+			assetPackFile = argument.substr(std::string("--asset-pack=").size());
+		} else if (argument == "--no-asset-pack") {
+			assetPackFile.clear();
+		} else if (argument.rfind("--texture-budget=", 0) == 0) {
+			textureBudgetMB = std::strtoul(argument.c_str() + std::string("--texture-budget=").size(), nullptr, 10);
+		} else if (argument.rfind("--max-texture-size=", 0) == 0) {
+			maxTextureSize = std::atoi(argument.c_str() + std::string("--max-texture-size=").size());
+		} else {
+			std::cerr << "Unknown option: " << argument << std::endl;
+		}
 	}
 }
 
 void cleanup() {
+	gps::TextureRegistry::Get().Shutdown();
 	glfwDestroyWindow(glWindow);
 	glfwTerminate();
 }
 
 int main(int argc, const char * argv[]) {
+	parseArguments(argc, argv);
+
 	if (!initOpenGLWindow()) {
 		glfwTerminate();
 		return 1;
@@ -813,6 +974,8 @@ int main(int argc, const char * argv[]) {
 
 	while (!glfwWindowShouldClose(glWindow)) {
 		processMovement();
+		// Model textures finish loading in the background, a few per frame
+		gps::TextureRegistry::Get().Update();
 		renderScene();
 		glfwPollEvents();
 		glfwSwapBuffers(glWindow);
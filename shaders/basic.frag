@@ -5,9 +5,15 @@ in vec4 fPosEye;
 
 out vec4 fColor;
 
-//lighting
-uniform	vec3 lightDir;
-uniform	vec3 lightColor;
+//lighting, eye space; LightData in main.cpp, which must use the same MAX_POINT_LIGHTS
+#define MAX_POINT_LIGHTS 64
+layout(std140) uniform LightData {
+	vec3 lightDir;
+	vec3 lightColor;
+	vec3 pointLightColor;  //  Shared color
+	int numPointLights;  // Actual number of lights active
+	vec3 pointLightPositions[MAX_POINT_LIGHTS];
+};
 
 vec3 ambient = vec3(0.f);
 float ambientStrength = 0.2f;
@@ -17,11 +23,6 @@ float specularStrength = 0.5f;
 float shininess = 32.0f;
 
 //  Needed for pos lighting, for attenuation
-//  Multiple positional lights
-#define MAX_POINT_LIGHTS 10
-uniform int numPointLights;  // Actual number of lights active
-uniform vec3 pointLightPositions[MAX_POINT_LIGHTS];
-uniform vec3 pointLightColor;  //  Shared color
 float constant = 1.f;
 float linear = 2.f;
 float quadratic = 4.f;
@@ -31,9 +32,10 @@ vec3 specularPoint = vec3(0.f);
 //uniform vec3 lightPos;
 //uniform vec3 posColor;
 
-//needed for light maps
-uniform sampler2D diffuseTexture;
-uniform sampler2D specularTexture;
+//needed for light maps, one layer of an array texture per map
+uniform sampler2DArray diffuseTexture;
+uniform sampler2DArray specularTexture;
+flat in uvec2 fTextureLayers;
 in vec2 fragTexCoords;
 
 //shadows
@@ -141,8 +143,8 @@ void main()
     computeLightComponents(normalEye);
 
     //	we dont use alpha blending, use just rgb values
-    vec3 texDiffuse = texture(diffuseTexture, fragTexCoords).rgb;
-    vec3 texSpecular = texture(specularTexture, fragTexCoords).rgb;
+    vec3 texDiffuse = texture(diffuseTexture, vec3(fragTexCoords, fTextureLayers.x)).rgb;
+    vec3 texSpecular = texture(specularTexture, vec3(fragTexCoords, fTextureLayers.y)).rgb;
 
     float shadow = computeShadow();
     vec3 lightingDir = (ambient + (1.0f - shadow) * diffuse) * texDiffuse +
@@ -3,24 +3,36 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+//layers of the diffuse and specular arrays, per vertex so meshes sampling other layers draw together
+layout(location=3) in uvec2 vTextureLayers;
 
 out vec3 fNormal;
 out vec4 fPosEye;
 out vec2 fragTexCoords;
 out vec4 fragPosLightSpace;
+flat out uvec2 fTextureLayers;
+
+//per-frame data shared with the other programs, FrameData in main.cpp
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 lightSpaceTrMatrix;
+};
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 uniform	mat3 normalMatrix;
-uniform mat4 lightSpaceTrMatrix;
+//dequantization of packed positions (0 / 1 for float vertices)
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 
 void main()
 {
+	vec3 position = positionOffset + vPosition * positionScale;
 	//compute eye space coordinates
-	fPosEye = view * model * vec4(vPosition, 1.0f);
+	fPosEye = view * model * vec4(position, 1.0f);
 	fNormal = normalize(normalMatrix * vNormal);
 	fragTexCoords = vTexCoords;//light maps
-	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(vPosition, 1.f);
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	fTextureLayers = vTextureLayers;
+	fragPosLightSpace = lightSpaceTrMatrix * model * vec4(position, 1.f);
+	gl_Position = projection * view * model * vec4(position, 1.0f);
 }
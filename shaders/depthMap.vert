@@ -1,8 +1,15 @@
 #version 410 core
 layout(location=0) in vec3 vPosition;
-uniform mat4 lightSpaceTrMatrix;
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 lightSpaceTrMatrix;
+};
 uniform mat4 model;
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
 void main()
 {
-    gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+    vec3 position = positionOffset + vPosition * positionScale;
+    gl_Position = lightSpaceTrMatrix * model * vec4(position, 1.0f);
 }
\ No newline at end of file